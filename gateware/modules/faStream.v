@@ -0,0 +1,53 @@
+//
+// Fast acquisition position stream
+// Once every FA toggle has changed, the time stamp and the positions from
+// all DSBPMs are written as one row of a ring buffer.  The processor reads
+// a row by writing its address to the CSR then reading the data words.
+// The CSR readback includes a free-running row count from which the
+// processor can determine how many rows are available or have been lost.
+//
+module faStream #(
+    parameter TOGGLE_COUNT = 2,
+    parameter WORD_COUNT   = 10,
+    parameter ADDR_WIDTH   = 9) (
+    input                             sysClk,
+    input                             sysCsrStrobe,
+    input                      [31:0] sysGpioOut,
+    output wire                [31:0] sysCsr,
+    output wire [(WORD_COUNT*32)-1:0] sysData,
+
+    input          [TOGGLE_COUNT-1:0] sysFaToggles,
+    input       [(WORD_COUNT*32)-1:0] sysValues);
+
+reg [ADDR_WIDTH-1:0] sysReadAddress = 0;
+reg                  sysRunning = 0;
+reg           [23:0] sysRowCount = 0;
+wire [ADDR_WIDTH-1:0] sysWriteAddress = sysRowCount[ADDR_WIDTH-1:0];
+wire [3:0] addrWidth = ADDR_WIDTH;
+reg [(WORD_COUNT*32)-1:0] dpram[0:(1<<ADDR_WIDTH)-1], dpramQ;
+assign sysData = dpramQ;
+assign sysCsr = { sysRunning, {3{1'b0}}, addrWidth, sysRowCount };
+
+reg [TOGGLE_COUNT-1:0] sysFaMatch = 0, sysFaPending = 0;
+
+always @(posedge sysClk) begin
+    if (sysCsrStrobe) begin
+        sysReadAddress <= sysGpioOut[ADDR_WIDTH-1:0];
+        sysRunning <= sysGpioOut[31];
+    end
+    dpramQ <= dpram[sysReadAddress];
+
+    sysFaMatch <= sysFaToggles;
+    if (sysFaPending == {TOGGLE_COUNT{1'b1}}) begin
+        sysFaPending <= sysFaToggles ^ sysFaMatch;
+        if (sysRunning) begin
+            dpram[sysWriteAddress] <= sysValues;
+            sysRowCount <= sysRowCount + 1;
+        end
+    end
+    else begin
+        sysFaPending <= sysFaPending | (sysFaToggles ^ sysFaMatch);
+    end
+end
+
+endmodule
@@ -1,6 +1,9 @@
 //
 // Generic DAC streamer
 //
+// The table write address advances after each table write so a table
+// can be loaded by writing its start address once followed by the data.
+//
 module genericDACStreamer #(
     parameter BUS_WIDTH             = 32,
     parameter AXIS_DATA_WIDTH       = 256,
@@ -87,6 +90,9 @@ always @(posedge sysClk) begin
     if (sysAddressStrobe) begin
         sysMemWrAddress <= sysGpioData[WRITE_ADDRESS_WIDTH-1:0];
     end
+    else if (sysMemWrStrobe) begin
+        sysMemWrAddress <= sysMemWrAddress + 1;
+    end
     if (sysGpioStrobe) begin
         case (sysMemWrBankSelect)
         1'b0: sysLastIdx <= sysMemWrAddress[SAMPLES_PER_CLOCK_WIDTH+:READ_ADDRESS_WIDTH];
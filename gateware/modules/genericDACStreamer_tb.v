@@ -164,8 +164,8 @@ initial begin
     wait(module_start_fill_table);
     @(posedge clk);
 
-    // Populate DAC table
-    repeat(NUM_DAC_TABLE_SAMPLES) begin
+    // Populate first half of DAC table, writing address for each sample
+    repeat(NUM_DAC_TABLE_SAMPLES/2) begin
         CSR0.write32(WR_REG_OFFSET_ADDRESS, dacAddr);
         @(posedge clk);
         CSR0.write32(WR_REG_OFFSET_CSR, WR_W_CSR_ADDRESS_BANK |
@@ -176,6 +176,17 @@ initial begin
         dacData = dacData + 1;
     end
 
+    // Populate second half of DAC table using address auto-increment
+    CSR0.write32(WR_REG_OFFSET_ADDRESS, dacAddr);
+    @(posedge clk);
+    repeat(NUM_DAC_TABLE_SAMPLES/2) begin
+        CSR0.write32(WR_REG_OFFSET_CSR, WR_W_CSR_ADDRESS_BANK |
+            (dacData & WR_W_CSR_ADDRESS_MASK));
+        @(posedge clk);
+
+        dacData = dacData + 1;
+    end
+
     // Start iterating table for a few cycles
     CSR0.write32(WR_REG_OFFSET_CSR, WR_W_CSR_GPIO_BANK | WR_W_CSR_GPIO_RUN);
     @(posedge clk);
@@ -230,4 +241,20 @@ end
 
 assign axis_TREADY = 1'b1;
 
+// Each table entry was written with its own address
+integer lane;
+always @(posedge axis_clk) begin
+    if (DUT.axisRun && axis_TVALID) begin
+        for (lane = 0 ; lane < SAMPLES_PER_CLOCK ; lane = lane + 1) begin
+            if (axis_TDATA[lane*DAC_DATA_WIDTH+:DAC_DATA_WIDTH] !==
+                            DUT.axisCurrentIndex*SAMPLES_PER_CLOCK + lane) begin
+                if (errors < 10)
+                    $display("Index %d lane %d: got %x", DUT.axisCurrentIndex,
+                        lane, axis_TDATA[lane*DAC_DATA_WIDTH+:DAC_DATA_WIDTH]);
+                errors = errors + 1;
+            end
+        end
+    end
+end
+
 endmodule
@@ -17,14 +17,16 @@ module genericWaveformRecorder #(
     parameter AXI_ADDR_WIDTH  = 32,
     parameter AXI_DATA_WIDTH  = 128,
     parameter FIFO_CAPACITY   = 256, // Minimum of 16
-    parameter ACQ_CAPACITY    = 1 << 23 // Max samples (4 32-bit values/sample)
+    parameter ACQ_CAPACITY    = 1 << 23, // Max samples (4 32-bit values/sample)
+    parameter SEGMENT_CAPACITY = 64 // Power of 2, maximum of 64
     ) (
     // sysClk synchronous signals
     input                        sysClk,
     input        [BUS_WIDTH-1:0] writeData,
-    input                  [4:0] regStrobes,
+    input                  [6:0] regStrobes,
     output wire       [BUS_WIDTH-1:0] csr, pretrigCount, acqCount, acqAddressMSB, acqAddressLSB,
     output wire  [TIMESTAMP_WIDTH-1:0] whenTriggered,
+    output wire       [BUS_WIDTH-1:0] writeCount,
 
     // clk synchronous signals
     input                        clk,
@@ -57,6 +59,10 @@ parameter WRITE_COUNT_WIDTH = $clog2(ACQ_CAPACITY+1);
 parameter BEATCOUNT_WIDTH   = HIGH_BANDWIDTH_MODE == "TRUE"? 6:3; // 64 x 8 beats per transfer
 parameter MULTI_BEAT_LENGTH = (1 << BEATCOUNT_WIDTH);
 parameter FIFO_ADDR_WIDTH   = $clog2(FIFO_CAPACITY);
+parameter SEGMENT_SHIFT_MAX = $clog2(SEGMENT_CAPACITY);
+parameter SEGMENT_SHIFT_WIDTH = $clog2(SEGMENT_SHIFT_MAX+1);
+parameter SEGMENT_INDEX_WIDTH = SEGMENT_SHIFT_MAX;
+parameter SEGMENT_COUNT_WIDTH = SEGMENT_SHIFT_MAX+1;
 
 localparam FIFO_PROG_EMPTY_THRESHOLD = MULTI_BEAT_LENGTH-1;
 
@@ -97,6 +103,13 @@ if (FIFO_CAPACITY < 16) begin
 end
 endgenerate
 
+generate
+if ((SEGMENT_CAPACITY < 2) || (SEGMENT_CAPACITY > 64)
+ || ((1 << SEGMENT_SHIFT_MAX) != SEGMENT_CAPACITY)) begin
+    SEGMENT_CAPACITY_must_be_a_power_of_2_from_2_to_64 error();
+end
+endgenerate
+
 generate
 if (!(DATA_WIDTH == AXI_DATA_WIDTH || 2*DATA_WIDTH == AXI_DATA_WIDTH)) begin
     DATA_WIDTH_is_different_than_once_or_twice_AXI_DATA_WIDTH error();
@@ -113,10 +126,17 @@ wire sysPretrigStrobe = regStrobes[1];
 wire sysAcqCountStrobe = regStrobes[2];
 wire sysAddrLSBStrobe = regStrobes[3];
 wire sysAddrMSBStrobe = regStrobes[4];
+wire sysSegmentShiftStrobe = regStrobes[5];
+wire sysSegmentSelectStrobe = regStrobes[6];
 reg [WRITE_COUNT_WIDTH-1:0] sysPretrigCount_r, sysAcqCount_r;
+reg [SEGMENT_SHIFT_WIDTH-1:0] sysSegmentShift = 0;
+reg [SEGMENT_INDEX_WIDTH-1:0] sysSegmentSelect = 0;
+wire [SEGMENT_COUNT_WIDTH-1:0] sysSegmentsDone;
+wire                    [6:0] sysCsrSegmentsDone = sysSegmentsDone;
 reg [7:0] sysCsrTriggerEnables = 0;
 reg      sysCsrTestMode = 0;
 reg      sysCsrDiagMode = 0;
+reg      sysCsrContinuousMode = 0;
 wire     sysFull, sysOverrun;
 reg      sysCsrArmed = 0;
 wire     sysAcqArmed;
@@ -124,8 +144,8 @@ wire     sysAcqPretrigLeftDone;
 wire [1:0] sysCsrBRESP;
 wire [2:0] sysState;
 assign csr = { sysCsrTriggerEnables,
-               7'b0, sysAcqPretrigLeftDone,
-               6'b0, sysCsrTestMode, sysCsrDiagMode,
+               sysCsrSegmentsDone, sysAcqPretrigLeftDone,
+               5'b0, sysCsrContinuousMode, sysCsrTestMode, sysCsrDiagMode,
               sysFull, sysCsrBRESP, sysOverrun, sysState, sysAcqArmed };
 reg [2*BUS_WIDTH-1:0] sysAcqBase;
 
@@ -138,9 +158,15 @@ always @(posedge sysClk) begin
     if (sysAcqCountStrobe) sysAcqCount_r                    <= writeData;
     if (sysAddrLSBStrobe)  sysAcqBase[0+:BUS_WIDTH]         <= writeData;
     if (sysAddrMSBStrobe)  sysAcqBase[BUS_WIDTH+:BUS_WIDTH] <= writeData;
+    if (sysSegmentShiftStrobe) begin
+        sysSegmentShift <= (writeData > SEGMENT_SHIFT_MAX) ? SEGMENT_SHIFT_MAX :
+                                                             writeData;
+    end
+    if (sysSegmentSelectStrobe) sysSegmentSelect            <= writeData;
     if (sysCsrStrobe) begin
         sysCsrToggle <= ~sysCsrToggle;
         sysCsrTriggerEnables <= writeData[31:24];
+        sysCsrContinuousMode <= writeData[10];
         sysCsrTestMode <= writeData[9];
         sysCsrDiagMode <= writeData[8];
         sysCsrArmed <= writeData[0];
@@ -153,13 +179,19 @@ end
 //
 wire [WRITE_COUNT_WIDTH-1:0] csrPretrigCount, csrAcqCount;
 wire [7:0] csrTriggerEnables;
-wire       csrToggle, csrArmed, csrTestMode, csrDiagMode;
+wire       csrToggle, csrArmed, csrContinuousMode, csrTestMode, csrDiagMode;
 wire [2*BUS_WIDTH-1:0] acqBase;
-forwardData #(.DATA_WIDTH(1+1+1+1+8+BUS_WIDTH+BUS_WIDTH+WRITE_COUNT_WIDTH+WRITE_COUNT_WIDTH))
+wire [SEGMENT_SHIFT_WIDTH-1:0] csrSegmentShift;
+wire [SEGMENT_INDEX_WIDTH-1:0] csrSegmentSelect;
+forwardData #(.DATA_WIDTH(1+1+1+1+1+8+BUS_WIDTH+BUS_WIDTH+WRITE_COUNT_WIDTH+WRITE_COUNT_WIDTH+
+                          SEGMENT_SHIFT_WIDTH+SEGMENT_INDEX_WIDTH))
   forwardCSRtoAcq (
     .inClk(sysClk),
-    .inData({   sysCsrToggle,
+    .inData({   sysSegmentShift,
+                sysSegmentSelect,
+                sysCsrToggle,
                 sysCsrArmed,
+                sysCsrContinuousMode,
                 sysCsrTestMode,
                 sysCsrDiagMode,
                 sysCsrTriggerEnables,
@@ -168,8 +200,11 @@ forwardData #(.DATA_WIDTH(1+1+1+1+8+BUS_WIDTH+BUS_WIDTH+WRITE_COUNT_WIDTH+WRITE_
                 sysAcqCount_r,
                 sysPretrigCount_r }),
     .outClk(clk),
-    .outData({  csrToggle,
+    .outData({  csrSegmentShift,
+                csrSegmentSelect,
+                csrToggle,
                 csrArmed,
+                csrContinuousMode,
                 csrTestMode,
                 csrDiagMode,
                 csrTriggerEnables,
@@ -212,10 +247,33 @@ reg                         triggerFlag = 0, triggered = 0;
 reg                         acqPretrigLeftDone = 0;
 reg [WRITE_COUNT_WIDTH-1:0] acqPretrigLeft = 0, acqLeft = 0;
 reg  [WRITE_ADDR_WIDTH-1:0] writeAddr = 0;
+
+//
+// Segmented acquisition.
+// The buffer is split into 2**acqSegmentShift segments, each a ring
+// buffer of its own occupying the most significant address bits.
+// Each trigger fills the next segment.  The address following the
+// last word and the trigger time of each completed segment are kept
+// in a table which the processor reads through the address and
+// timestamp registers.
+//
+reg [SEGMENT_SHIFT_WIDTH-1:0] acqSegmentShift = 0;
+reg [SEGMENT_COUNT_WIDTH-1:0] segmentsDone = 0;
+reg                           segmentPending = 0;
+wire   [WRITE_ADDR_WIDTH-1:0] segmentIndexMask =
+                             ~({WRITE_ADDR_WIDTH{1'b1}} >> acqSegmentShift);
+wire    [WRITE_ADDR_WIDTH:0]  segmentCapacity = ACQ_CAPACITY >> acqSegmentShift;
+reg [WRITE_ADDR_WIDTH+TIMESTAMP_WIDTH-1:0] segmentTable [0:SEGMENT_CAPACITY-1];
+wire [WRITE_ADDR_WIDTH+TIMESTAMP_WIDTH-1:0] segmentEntry =
+                                                segmentTable[csrSegmentSelect];
+wire [WRITE_ADDR_WIDTH-1:0] nextWriteAddr = (writeAddr & segmentIndexMask) |
+                                        ((writeAddr + 1) & ~segmentIndexMask);
+
 assign axi_AWADDR = { acqBase[AXI_ADDR_WIDTH-1:WRITE_ADDR_WIDTH + WRITE_ADDR_ALIGNMENT],
                         writeAddr,
                         {WRITE_ADDR_ALIGNMENT{1'b0}} };
 reg [BEATCOUNT_WIDTH-1:0] beatCount;
+reg   [BEATCOUNT_WIDTH:0] burstLength = 0;
 assign axi_AWLEN = { {(8-BEATCOUNT_WIDTH){1'b0}}, beatCount };
 assign axi_WLAST = (state == S_DATA) && (beatCount == 0);
 
@@ -310,6 +368,12 @@ assign axi_WSTRB = {(AXI_DATA_WIDTH/8){1'b1}};
 //
 reg csrStrobe = 0, csrToggle_d1 = 0;
 reg acqArmed = 0, overrun = 0, full = 0;
+
+// Words written and acknowledged since the recorder was armed.
+// In continuous mode the recorder ignores triggers and keeps writing
+// the ring buffer until disarmed.  The processor follows this count
+// to find data that is safe to read.
+reg [BUS_WIDTH-1:0] acqWriteCount = 0;
 reg [TIMESTAMP_WIDTH-1:0] acqWhenTriggered = 0;
 reg [1:0] csrBRESP = 0;
 always @(posedge clk) begin
@@ -323,6 +387,11 @@ always @(posedge clk) begin
             if (!acqArmed) begin
                 overrun <= 0;
                 writeAddr <= 0;
+                acqWriteCount <= 0;
+                acqSegmentShift <= csrContinuousMode ? 0 : csrSegmentShift;
+                segmentsDone <= 0;
+                segmentPending <= 0;
+                if (csrContinuousMode) acqWhenTriggered <= timestamp;
                 acqPretrigLeft <= csrPretrigCount;
                 acqLeft <= csrAcqCount;
                 acqArmed <= 1;
@@ -340,6 +409,7 @@ always @(posedge clk) begin
     triggerReg_d <= triggerReg;
     if (acqArmed) begin
         if ((acqPretrigLeft == 0)
+         && !csrContinuousMode
          && ((csrTriggerEnables & triggerReg & ~triggerReg_d) != 0)) begin
             triggerFlag <= 1;
         end
@@ -355,8 +425,13 @@ always @(posedge clk) begin
                     // the CSR reg values forwared to the CLK
                     // domain
                     if (!csrStrobe) begin
-                        acqArmed <= 0;
-                        full <= 1;
+                        if (acqSegmentShift) begin
+                            segmentPending <= 1;
+                        end
+                        else begin
+                            acqArmed <= 0;
+                            full <= 1;
+                        end
                     end
                 end
             end
@@ -376,6 +451,32 @@ always @(posedge clk) begin
         acqPretrigLeftDone <= 0;
     end
 
+    //
+    // Move on to the next segment once all words of the
+    // current segment have been written to memory.
+    // Data arriving meanwhile is discarded so no trigger
+    // is accepted until the next pretrigger section is full.
+    //
+    if (acqArmed && segmentPending && fifoEmpty && (state == S_WAIT)
+     && !csrStrobe) begin
+        segmentTable[segmentsDone[0+:SEGMENT_INDEX_WIDTH]] <=
+                                            { writeAddr, acqWhenTriggered };
+        segmentsDone <= segmentsDone + 1;
+        segmentPending <= 0;
+        if ((segmentsDone + 1) == (1 << acqSegmentShift)) begin
+            acqArmed <= 0;
+            full <= 1;
+        end
+        else begin
+            writeAddr <= (writeAddr & segmentIndexMask) + segmentCapacity;
+            acqPretrigLeft <= csrPretrigCount;
+            acqLeft <= csrAcqCount;
+            acqPretrigLeftDone <= 0;
+            triggerFlag <= 0;
+            triggered <= 0;
+        end
+    end
+
     //
     // Acquisition AXI master state machine
     //
@@ -388,13 +489,16 @@ always @(posedge clk) begin
     //
     S_WAIT: begin
         if (!fifoProgEmpty
-         && (writeAddr <= (ACQ_CAPACITY-MULTI_BEAT_LENGTH))) begin
+         && ((writeAddr & ~segmentIndexMask) <=
+                                  (segmentCapacity-MULTI_BEAT_LENGTH))) begin
             beatCount <= MULTI_BEAT_LENGTH-1;
+            burstLength <= MULTI_BEAT_LENGTH;
             axi_AWVALID <= 1;
             state <= S_ADDR;
         end
         else if (!fifoEmpty) begin
             beatCount <= 0;
+            burstLength <= 1;
             axi_AWVALID <= 1;
             state <= S_ADDR;
         end
@@ -416,7 +520,7 @@ always @(posedge clk) begin
     //
     S_DATA: begin
         if (axi_WREADY) begin
-            writeAddr <= writeAddr + 1;
+            writeAddr <= nextWriteAddr;
             if (beatCount) begin
                 beatCount <= beatCount - 1;
             end
@@ -433,6 +537,7 @@ always @(posedge clk) begin
     S_ACK: begin
         if (axi_BVALID) begin
             csrBRESP <= axi_BRESP;
+            acqWriteCount <= acqWriteCount + burstLength;
             if ((axi_BRESP != 0) && !csrStrobe) begin
                 acqArmed <= 0;
                 acqLeft <= 0;
@@ -508,16 +613,24 @@ endgenerate
 
 //
 // clk to sysClk
+// Segmented acquisitions report the selected segment table entry.
 //
 wire [AXI_ADDR_WIDTH-1:0] sysAxi_AWADDR;
 wire [TIMESTAMP_WIDTH-1:0] sysWhenTriggered;
-forwardData #(.DATA_WIDTH(AXI_ADDR_WIDTH+TIMESTAMP_WIDTH+1+1+2+3+1+1))
+wire [AXI_ADDR_WIDTH-1:0] reportAddr = acqSegmentShift ?
+            { acqBase[AXI_ADDR_WIDTH-1:WRITE_ADDR_WIDTH + WRITE_ADDR_ALIGNMENT],
+              segmentEntry[TIMESTAMP_WIDTH+:WRITE_ADDR_WIDTH],
+              {WRITE_ADDR_ALIGNMENT{1'b0}} } : axi_AWADDR;
+wire [TIMESTAMP_WIDTH-1:0] reportWhenTriggered = acqSegmentShift ?
+            segmentEntry[0+:TIMESTAMP_WIDTH] : acqWhenTriggered;
+forwardData #(.DATA_WIDTH(AXI_ADDR_WIDTH+TIMESTAMP_WIDTH+BUS_WIDTH+SEGMENT_COUNT_WIDTH+1+1+2+3+1+1))
   forwardAcqtoCSR (
     .inClk(clk),
-    .inData({   axi_AWADDR, acqWhenTriggered, overrun, full,
-                csrBRESP, state, acqArmed, acqPretrigLeftDone     }),
+    .inData({   reportAddr, reportWhenTriggered, acqWriteCount, segmentsDone,
+                overrun, full, csrBRESP, state, acqArmed, acqPretrigLeftDone }),
     .outClk(sysClk),
-    .outData({  sysAxi_AWADDR, sysWhenTriggered, sysOverrun, sysFull,
-                sysCsrBRESP, sysState, sysAcqArmed, sysAcqPretrigLeftDone}));
+    .outData({  sysAxi_AWADDR, sysWhenTriggered, writeCount, sysSegmentsDone,
+                sysOverrun, sysFull, sysCsrBRESP, sysState, sysAcqArmed,
+                sysAcqPretrigLeftDone }));
 
 endmodule
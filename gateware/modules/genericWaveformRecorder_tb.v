@@ -10,8 +10,8 @@ module genericWaveformRecorder_tb #(
     parameter AXI_DATA_WIDTH = 128
 );
 
-// generate valid every 16 CC
-localparam VALID_CNT_MAX = 16;
+// generate valid every 4 CC
+localparam VALID_CNT_MAX = 4;
 localparam VALID_CNT_WIDTH = $clog2(VALID_CNT_MAX);
 
 //
@@ -24,6 +24,8 @@ localparam WR_REG_OFFSET_ADDRESS_LSB          = 3;
 localparam WR_REG_OFFSET_ADDRESS_MSB          = 4;
 localparam WR_REG_OFFSET_TIMESTAMP_SECONDS    = 5;
 localparam WR_REG_OFFSET_TIMESTAMP_TICKS      = 6;
+localparam WR_REG_OFFSET_SEGMENT_SHIFT        = 5; // Write only
+localparam WR_REG_OFFSET_SEGMENT_SELECT       = 6; // Write only
 
 //
 // Write CSR fields
@@ -34,7 +36,7 @@ localparam WR_W_CSR_EVENT_TRIGGER_6_ENABLE   = 'h40000000;
 localparam WR_W_CSR_EVENT_TRIGGER_5_ENABLE   = 'h20000000;
 localparam WR_W_CSR_EVENT_TRIGGER_4_ENABLE   = 'h10000000;
 localparam WR_W_CSR_SOFT_TRIGGER_ENABLE      = 'h01000000;
-localparam WR_W_CSR_RESET_BAR_MODE           = 'h400;
+localparam WR_W_CSR_CONTINUOUS_MODE          = 'h400;
 localparam WR_W_CSR_TEST_ACQUISITION_MODE    = 'h200;
 localparam WR_W_CSR_DIAGNOSTIC_MODE          = 'h100;
 localparam WR_W_CSR_ARM                      = 'h1;
@@ -42,18 +44,34 @@ localparam WR_W_CSR_ARM                      = 'h1;
 //
 // Read CSR fields
 //
-localparam WR_R_CSR_TRIGGER_MASK             = 'hFF000000; // 1 0000 0000
-localparam WR_R_CSR_PRE_TRIG_DONE            = 'h200; // 10 0000 0000
-localparam WR_R_CSR_DIAG_MODE                = 'h100; // 1 0000 0000
+localparam WR_R_CSR_TRIGGER_MASK             = 'hFF000000;
+localparam WR_R_CSR_SEGMENTS_DONE            = 'hFE0000;
+localparam WR_R_CSR_SEGMENTS_DONE_SHIFT      = 17;
+localparam WR_R_CSR_PRE_TRIG_DONE            = 'h10000;
+localparam WR_R_CSR_CONTINUOUS_MODE          = 'h400;
+localparam WR_R_CSR_TEST_MODE                = 'h200;
+localparam WR_R_CSR_DIAG_MODE                = 'h100;
 localparam WR_R_CSR_FULL                     = 'h80;  // 1000 0000
 localparam WR_R_CSR_BRESP                    = 'h60;  // 0110 0000
 localparam WR_R_CSR_OVERRUN                  = 'h10;  // 1 0000
 localparam WR_R_CSR_STATE                    = 'hE;   // 1110
 localparam WR_R_CSR_ARM                      = 'h1;   // 0001
 
+//
+// Acquisition parameters
+//
+localparam ACQ_BASE = 32'h00010000;
+localparam ACQ_WORD_BYTES = AXI_DATA_WIDTH / 8;
+localparam SINGLE_PRETRIG = 32;
+localparam SINGLE_ACQ = 128;
+localparam SEG_SHIFT = 2;
+localparam SEG_COUNT = 1 << SEG_SHIFT;
+localparam SEG_CAPACITY = ACQ_CAPACITY / SEG_COUNT;
+localparam SEG_PRETRIG = 32;
+localparam SEG_ACQ = 96;
+
 reg module_done = 0;
 reg module_ready = 0;
-reg module_accepting_trigger = 0;
 integer errors = 0;
 integer idx = 0;
 initial begin
@@ -77,7 +95,7 @@ integer cc;
 reg clk = 0;
 initial begin
     clk = 0;
-    for (cc = 0; cc < 3000; cc = cc+1) begin
+    for (cc = 0; cc < 40000; cc = cc+1) begin
         clk = 0; #5;
         clk = 1; #5;
     end
@@ -87,7 +105,7 @@ integer adc_cc;
 reg adc_clk = 0;
 initial begin
     adc_clk = 0;
-    for (adc_cc = 0; adc_cc < 3000; adc_cc = adc_cc+1) begin
+    for (adc_cc = 0; adc_cc < 50000; adc_cc = adc_cc+1) begin
         adc_clk = 0; #4;
         adc_clk = 1; #4;
     end
@@ -154,7 +172,7 @@ genericWaveformRecorder #(
   DUT(
     .sysClk(clk),
     .writeData(GPIO_OUT),
-    .regStrobes(GPIO_STROBES[0+:5]),
+    .regStrobes(GPIO_STROBES[0+:7]),
     .csr(wfr_CSR),
     .pretrigCount(wfr_pretrig_count),
     .acqCount(wfr_acq_count),
@@ -183,21 +201,98 @@ always @(posedge adc_clk) begin
     wr_axi_BVALID <= wr_axi_WVALID;
 end
 
+//
+// Memory model
+// Record the least significant lane of each word written and confirm
+// that segmented acquisitions stay within the current segment.
+//
+reg             [DATA_WIDTH-1:0] mem [0:ACQ_CAPACITY-1];
+reg [$clog2(ACQ_CAPACITY)-1:0] memAddr = 0;
+reg                              checkSegments = 0;
+integer                          segWrites [0:SEG_COUNT-1];
+always @(posedge adc_clk) begin
+    if (wr_axi_AWVALID && wr_axi_AWREADY) begin
+        memAddr <= (wr_axi_AWADDR - ACQ_BASE) / ACQ_WORD_BYTES;
+    end
+    if (wr_axi_WVALID && wr_axi_WREADY) begin
+        mem[memAddr] <= wr_axi_WDATA[DATA_WIDTH-1:0];
+        memAddr <= memAddr + 1;
+        if (checkSegments) begin
+            if ((memAddr / SEG_CAPACITY) != DUT.segmentsDone) begin
+                $display("@%0d: Write to %d outside segment %d", $time,
+                                                memAddr, DUT.segmentsDone);
+                errors = errors + 1;
+            end
+            else begin
+                segWrites[memAddr / SEG_CAPACITY] =
+                                    segWrites[memAddr / SEG_CAPACITY] + 1;
+            end
+        end
+    end
+end
+
+//
+// Confirm that the 'count' words preceding 'endIndex' in the ring
+// starting at 'base' hold consecutive samples.
+// Returns the first and last samples.
+//
+task checkRing;
+    input integer base, capacity, endIndex, count;
+    output integer first, last;
+    integer k, offset, expected;
+begin
+    offset = (endIndex - base + capacity - 1) % capacity;
+    last = mem[base + offset];
+    if (^mem[base + offset] === 1'bx) begin
+        $display("@%0d: Word %d never written", $time, base + offset);
+        errors = errors + 1;
+    end
+    for (k = 0 ; k < count ; k = k + 1) begin
+        offset = (endIndex - base + capacity - 1 - k) % capacity;
+        expected = (last - k) & ((1 << DATA_WIDTH) - 1);
+        if (mem[base + offset] !== expected) begin
+            $display("@%0d: Word %d is %d, expected %d", $time,
+                                        base + offset, mem[base + offset], expected);
+            errors = errors + 1;
+        end
+    end
+    first = (last - count + 1) & ((1 << DATA_WIDTH) - 1);
+end
+endtask
+
+task trigger;
+begin
+    @(posedge adc_clk);
+    triggers <= 8'h1;
+    @(posedge adc_clk);
+    triggers <= 8'h0;
+end
+endtask
+
 // stimulus
+reg [31:0] csr, addrLSB, ticks, previousTicks;
+integer seg, endIndex, first, last, previousLast, wrapped;
 initial begin
     wait(CSR0.ready);
     @(posedge clk);
 
     module_done = 0;
+    for (seg = 0 ; seg < SEG_COUNT ; seg = seg + 1) segWrites[seg] = 0;
+
+    //
+    // Single acquisition
+    //
     @(posedge clk);
-    CSR0.write32(WR_REG_OFFSET_PRETRIGGER_COUNT, 32);
+    CSR0.write32(WR_REG_OFFSET_PRETRIGGER_COUNT, SINGLE_PRETRIG);
     @(posedge clk);
-    CSR0.write32(WR_REG_OFFSET_ACQUISITION_COUNT, 128);
+    CSR0.write32(WR_REG_OFFSET_ACQUISITION_COUNT, SINGLE_ACQ);
     @(posedge clk);
-    CSR0.write32(WR_REG_OFFSET_ADDRESS_LSB, 32'h00010000);
+    CSR0.write32(WR_REG_OFFSET_ADDRESS_LSB, ACQ_BASE);
     @(posedge clk);
     CSR0.write32(WR_REG_OFFSET_ADDRESS_MSB, 0);
     @(posedge clk);
+    CSR0.write32(WR_REG_OFFSET_SEGMENT_SHIFT, 0);
+    @(posedge clk);
     CSR0.write32(WR_REG_OFFSET_CSR,
         WR_W_CSR_SOFT_TRIGGER_ENABLE |
         WR_W_CSR_ARM);
@@ -211,27 +306,91 @@ initial begin
     // wait until module has acquired all pretrig samples
     wait(wfr_CSR & WR_R_CSR_PRE_TRIG_DONE);
     @(posedge clk);
-    module_accepting_trigger = 1;
+    repeat(100) @(posedge adc_clk);
+    trigger;
 
     wait(!(wfr_CSR & WR_R_CSR_ARM));
+    repeat(100) @(posedge clk);
+    CSR0.read32(WR_REG_OFFSET_CSR, csr);
+    if (!(csr & WR_R_CSR_FULL)) begin
+        $display("@%0d: Single acquisition not full", $time);
+        errors = errors + 1;
+    end
+    CSR0.read32(WR_REG_OFFSET_ADDRESS_LSB, addrLSB);
+    endIndex = (addrLSB - ACQ_BASE) / ACQ_WORD_BYTES;
+    checkRing(0, ACQ_CAPACITY, endIndex, SINGLE_ACQ, first, last);
+
+    //
+    // Segmented acquisition.
+    // Delay the first and third triggers long enough for
+    // the pretrigger data to wrap around the segment.
+    //
+    CSR0.write32(WR_REG_OFFSET_PRETRIGGER_COUNT, SEG_PRETRIG);
     @(posedge clk);
-    module_accepting_trigger = 0;
-    module_ready = 0;
-    module_done = 1;
-
-end
-
-initial begin
-    wait (module_accepting_trigger);
-    @(posedge adc_clk);
+    CSR0.write32(WR_REG_OFFSET_ACQUISITION_COUNT, SEG_ACQ);
+    @(posedge clk);
+    CSR0.write32(WR_REG_OFFSET_SEGMENT_SHIFT, SEG_SHIFT);
+    @(posedge clk);
+    checkSegments = 1;
+    CSR0.write32(WR_REG_OFFSET_CSR,
+        WR_W_CSR_SOFT_TRIGGER_ENABLE |
+        WR_W_CSR_ARM);
+    wait(wfr_CSR & WR_R_CSR_ARM);
+    for (seg = 0 ; seg < SEG_COUNT ; seg = seg + 1) begin
+        wait((((wfr_CSR & WR_R_CSR_SEGMENTS_DONE) >>
+                                WR_R_CSR_SEGMENTS_DONE_SHIFT) == seg)
+          && (wfr_CSR & WR_R_CSR_PRE_TRIG_DONE));
+        if ((seg % 2) == 0)
+            repeat((SEG_CAPACITY + 16) * VALID_CNT_MAX) @(posedge adc_clk);
+        else
+            repeat(10) @(posedge adc_clk);
+        trigger;
+        wait((((wfr_CSR & WR_R_CSR_SEGMENTS_DONE) >>
+                                WR_R_CSR_SEGMENTS_DONE_SHIFT) == (seg + 1))
+          || !(wfr_CSR & WR_R_CSR_ARM));
+    end
+    wait(!(wfr_CSR & WR_R_CSR_ARM));
+    repeat(100) @(posedge clk);
+    checkSegments = 0;
+    CSR0.read32(WR_REG_OFFSET_CSR, csr);
+    if (!(csr & WR_R_CSR_FULL)
+     || (((csr & WR_R_CSR_SEGMENTS_DONE) >> WR_R_CSR_SEGMENTS_DONE_SHIFT)
+                                                            != SEG_COUNT)) begin
+        $display("@%0d: Segmented acquisition CSR %x", $time, csr);
+        errors = errors + 1;
+    end
 
-    repeat(100) begin
-        @(posedge adc_clk);
+    //
+    // Check each segment table entry and its data
+    //
+    wrapped = 0;
+    for (seg = 0 ; seg < SEG_COUNT ; seg = seg + 1) begin
+        CSR0.write32(WR_REG_OFFSET_SEGMENT_SELECT, seg);
+        repeat(50) @(posedge clk);
+        CSR0.read32(WR_REG_OFFSET_ADDRESS_LSB, addrLSB);
+        CSR0.read32(WR_REG_OFFSET_TIMESTAMP_TICKS, ticks);
+        endIndex = (addrLSB - ACQ_BASE) / ACQ_WORD_BYTES;
+        if ((endIndex / SEG_CAPACITY) != seg) begin
+            $display("@%0d: Segment %d ends at %d", $time, seg, endIndex);
+            errors = errors + 1;
+        end
+        checkRing(seg * SEG_CAPACITY, SEG_CAPACITY, endIndex, SEG_ACQ,
+                                                                first, last);
+        if ((seg != 0) && ((first <= previousLast) || (ticks <= previousTicks))) begin
+            $display("@%0d: Segment %d out of order", $time, seg);
+            errors = errors + 1;
+        end
+        if (segWrites[seg] > SEG_CAPACITY) wrapped = wrapped + 1;
+        previousLast = last;
+        previousTicks = ticks;
+    end
+    if (wrapped == 0) begin
+        $display("@%0d: No segment wrapped", $time);
+        errors = errors + 1;
     end
 
-    triggers <= 8'h1;
-    @(posedge adc_clk);
-    triggers <= 8'h0;
+    module_ready = 0;
+    module_done = 1;
 end
 
 wire valid_comb = (valid_cnt == 0) & module_ready;
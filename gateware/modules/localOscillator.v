@@ -6,6 +6,15 @@
 //    Pilot tones (plCos, plSin, phCos, phSin)
 // Also generate turn-by-turn and multi-turn aquisition markers.
 //
+// The table write address advances after each table write so a table
+// bank can be loaded by writing its start address once followed by the data.
+//
+// Each table is double buffered.  Writes go to the shadow bank while the
+// demodulators read from the active bank.  A swap request exchanges the
+// banks, and the table length, when the table index next wraps to zero,
+// or immediately if the oscillators are not running.  The RF and pilot
+// tone tables swap independently.
+//
 //
 // Identifiers beginning with 'sys' are in the system clock domain.
 // All others are in the ADC clock domain.
@@ -56,37 +65,48 @@ assign sysPhMemWrStrobe = sysGpioStrobe && (sysMemWrBankSelect == 2'b10);
 // Assume that PT_WR_ADDRESS_WIDTH equals or exceeds RF_WR_ADDRESS_WIDTH.
 reg [PT_WR_ADDRESS_WIDTH-1:0] sysMemWrAddress;
 
+//
+// Bank swap handshake
+//
+reg  sysRfSwapReq = 0, sysPtSwapReq = 0;
+wire sysRfSwapAck, sysPtSwapAck;
+wire sysRfActiveBank, sysPtActiveBank;
+wire sysRfSwapPending = (sysRfSwapReq != sysRfSwapAck);
+wire sysPtSwapPending = (sysPtSwapReq != sysPtSwapAck);
+
 //
 // Instantiate the three lookup tables
+// Most significant address bit selects the bank.
 //
 reg [RF_RD_ADDRESS_WIDTH-1:0] rfIndex = 0;
 reg [PT_RD_ADDRESS_WIDTH-1:0] ptIndex = 0;
-localOscillatorDPRAM #(.WRITE_ADDRESS_WIDTH(RF_WR_ADDRESS_WIDTH),
+reg                           rfActiveBank = 0, ptActiveBank = 0;
+localOscillatorDPRAM #(.WRITE_ADDRESS_WIDTH(RF_WR_ADDRESS_WIDTH+1),
                        .WRITE_DATA_WIDTH(OUTPUT_WIDTH))
   rfTable (.wClk(sysClk),
            .wEnable(sysRfMemWrStrobe),
-           .wAddr(sysMemWrAddress[RF_WR_ADDRESS_WIDTH-1:0]),
+           .wAddr({!sysRfActiveBank, sysMemWrAddress[RF_WR_ADDRESS_WIDTH-1:0]}),
            .wData(sysMemWrData),
            .rClk(clk),
-           .rAddr(rfIndex),
+           .rAddr({rfActiveBank, rfIndex}),
            .rData({rfSin, rfCos}));
-localOscillatorDPRAM #(.WRITE_ADDRESS_WIDTH(PT_WR_ADDRESS_WIDTH),
+localOscillatorDPRAM #(.WRITE_ADDRESS_WIDTH(PT_WR_ADDRESS_WIDTH+1),
                        .WRITE_DATA_WIDTH(OUTPUT_WIDTH))
   plTable (.wClk(sysClk),
            .wEnable(sysPlMemWrStrobe),
-           .wAddr(sysMemWrAddress),
+           .wAddr({!sysPtActiveBank, sysMemWrAddress}),
            .wData(sysMemWrData),
            .rClk(clk),
-           .rAddr(ptIndex),
+           .rAddr({ptActiveBank, ptIndex}),
            .rData({plSin, plCos}));
-localOscillatorDPRAM #(.WRITE_ADDRESS_WIDTH(PT_WR_ADDRESS_WIDTH),
+localOscillatorDPRAM #(.WRITE_ADDRESS_WIDTH(PT_WR_ADDRESS_WIDTH+1),
                        .WRITE_DATA_WIDTH(OUTPUT_WIDTH))
   phTable (.wClk(sysClk),
            .wEnable(sysPhMemWrStrobe),
-           .wAddr(sysMemWrAddress),
+           .wAddr({!sysPtActiveBank, sysMemWrAddress}),
            .wData(sysMemWrData),
            .rClk(clk),
-           .rAddr(ptIndex),
+           .rAddr({ptActiveBank, ptIndex}),
            .rData({phSin, phCos}));
 
 //
@@ -94,7 +114,10 @@ localOscillatorDPRAM #(.WRITE_ADDRESS_WIDTH(PT_WR_ADDRESS_WIDTH),
 //
 reg                      sysUseRMS = 0, sysIsSingle = 0, sysRun = 0;
 reg                      rfSynced = 0, ptSynced = 0;
-assign sysGpioCsr = { {32-2-4{1'b0}},
+assign sysGpioCsr = { {32-16{1'b0}},
+                      sysPtActiveBank, sysRfActiveBank,
+                      sysPtSwapPending, sysRfSwapPending,
+                      6'b0,
                       ptSynced, rfSynced,
                       1'b0, sysUseRMS, sysIsSingle, sysRun };
 reg [RF_RD_ADDRESS_WIDTH-1:0] sysRfLastIdx;
@@ -103,6 +126,9 @@ always @(posedge sysClk) begin
     if (sysAddressStrobe) begin
         sysMemWrAddress <= sysGpioData[PT_WR_ADDRESS_WIDTH-1:0];
     end
+    else if (sysRfMemWrStrobe || sysPlMemWrStrobe || sysPhMemWrStrobe) begin
+        sysMemWrAddress <= sysMemWrAddress + 1;
+    end
     if (sysGpioStrobe) begin
         case (sysMemWrBankSelect)
         2'b00: sysRfLastIdx <= sysMemWrAddress[1+:RF_RD_ADDRESS_WIDTH];
@@ -112,6 +138,8 @@ always @(posedge sysClk) begin
             sysRun      <= sysGpioData[0];
             sysIsSingle <= sysGpioData[1];
             sysUseRMS   <= sysGpioData[2];
+            if (sysGpioData[8]) sysRfSwapReq <= !sysRfSwapReq;
+            if (sysGpioData[9]) sysPtSwapReq <= !sysPtSwapReq;
         end
         default: ;
         endcase
@@ -123,15 +151,50 @@ end
 //////////////////////////////////////////////////////////////////////////////
 
 wire run, isSingle;
-wire [RF_RD_ADDRESS_WIDTH-1:0] rfLastIdx;
-wire [PT_RD_ADDRESS_WIDTH-1:0] ptLastIdx;
+wire rfSwapReq, ptSwapReq;
+wire [RF_RD_ADDRESS_WIDTH-1:0] rfStagedLastIdx;
+wire [PT_RD_ADDRESS_WIDTH-1:0] ptStagedLastIdx;
+reg  [RF_RD_ADDRESS_WIDTH-1:0] rfLastIdx = 0;
+reg  [PT_RD_ADDRESS_WIDTH-1:0] ptLastIdx = 0;
+reg                            rfSwapAck = 0, ptSwapAck = 0;
 
-forwardData #(.DATA_WIDTH(2+PT_RD_ADDRESS_WIDTH+RF_RD_ADDRESS_WIDTH))
+// Swap request and staged table lengths arrive together
+forwardData #(.DATA_WIDTH(4+PT_RD_ADDRESS_WIDTH+RF_RD_ADDRESS_WIDTH))
   loInfo (
     .inClk(sysClk),
-    .inData({ sysRun, sysIsSingle, sysPtLastIdx, sysRfLastIdx }),
+    .inData({ sysRun, sysIsSingle, sysRfSwapReq, sysPtSwapReq,
+              sysPtLastIdx, sysRfLastIdx }),
     .outClk(clk),
-    .outData({ run, isSingle, ptLastIdx, rfLastIdx }));
+    .outData({ run, isSingle, rfSwapReq, ptSwapReq,
+               ptStagedLastIdx, rfStagedLastIdx }));
+
+forwardData #(.DATA_WIDTH(4))
+  loBankInfo (
+    .inClk(clk),
+    .inData({ rfActiveBank, ptActiveBank, rfSwapAck, ptSwapAck }),
+    .outClk(sysClk),
+    .outData({ sysRfActiveBank, sysPtActiveBank, sysRfSwapAck, sysPtSwapAck }));
+
+//
+// Swap banks at the end of a table pass so that every pass through
+// a table reads from a single bank.
+//
+wire rfSwap = (rfSwapReq != rfSwapAck)
+           && (!run || (!adcSyncMarker && (rfIndex == rfLastIdx)));
+wire ptSwap = (ptSwapReq != ptSwapAck)
+           && (!run || (!adcSyncMarker && (ptIndex == ptLastIdx)));
+always @(posedge clk) begin
+    if (rfSwap) begin
+        rfActiveBank <= !rfActiveBank;
+        rfLastIdx <= rfStagedLastIdx;
+        rfSwapAck <= rfSwapReq;
+    end
+    if (ptSwap) begin
+        ptActiveBank <= !ptActiveBank;
+        ptLastIdx <= ptStagedLastIdx;
+        ptSwapAck <= ptSwapReq;
+    end
+end
 reg [RF_RD_ADDRESS_WIDTH-1:0] singleMatch = 0;
 reg                           singleActive = 0;
 always @(posedge clk)
@@ -0,0 +1,299 @@
+`timescale 1ns / 100ps
+
+//
+// Check that local oscillator bank swaps are glitch-free.
+// Each table value holds its table number and row so every output
+// sample can be traced to the bank and row it came from.
+// Tables are swapped while the oscillators are running, with the
+// replacement tables a different length from the ones they replace.
+//
+module localOscillator_tb #(
+    parameter CSR_DATA_BUS_WIDTH = 32,
+    parameter CSR_STROBE_BUS_WIDTH = 8,
+
+    parameter OUTPUT_WIDTH = 18,
+    parameter GPIO_LO_RF_ROW_CAPACITY = 16,
+    parameter GPIO_LO_PT_ROW_CAPACITY = 64
+);
+
+//
+// Register offsets
+//
+localparam LO_REG_OFFSET_CSR                  = 0;
+localparam LO_REG_OFFSET_ADDRESS              = 1;
+
+//
+// Write CSR fields
+//
+localparam LO_W_CSR_BANK_RF                   = 'h00000000;
+localparam LO_W_CSR_BANK_PL                   = 'h40000000;
+localparam LO_W_CSR_BANK_PH                   = 'h80000000;
+localparam LO_W_CSR_BANK_NONE                 = 'hC0000000;
+localparam LO_W_CSR_RUN                       = 'h00000001;
+localparam LO_W_CSR_RF_SWAP                   = 'h00000100;
+localparam LO_W_CSR_PT_SWAP                   = 'h00000200;
+
+//
+// Read CSR fields
+//
+localparam LO_R_CSR_RF_SWAP_PENDING           = 'h00001000;
+localparam LO_R_CSR_PT_SWAP_PENDING           = 'h00002000;
+
+//
+// Table value fields
+//
+localparam TABLE_ID_SHIFT = 16;
+localparam ROW_MASK       = (1 << TABLE_ID_SHIFT) - 1;
+
+reg module_done = 0;
+integer errors = 0;
+initial begin
+    if ($test$plusargs("vcd")) begin
+        $dumpfile("localOscillator.vcd");
+        $dumpvars(0, localOscillator_tb);
+    end
+
+    wait(module_done);
+
+    if (errors==0) begin
+        $display("# PASS");
+        $finish(0);
+    end else begin
+        $display("# FAIL");
+        $stop(0);
+    end
+end
+
+// 100 MHz system clock
+integer cc;
+reg clk = 0;
+initial begin
+    clk = 0;
+    for (cc = 0; cc < 40000; cc = cc+1) begin
+        clk = 1; #5;
+        clk = 0; #5;
+    end
+end
+
+// 250 MHz ADC clock
+integer adc_cc;
+reg adc_clk = 0;
+initial begin
+    adc_clk = 0;
+    for (adc_cc = 0; adc_cc < 100000; adc_cc = adc_cc+1) begin
+        adc_clk = 1; #2;
+        adc_clk = 0; #2;
+    end
+end
+
+//
+// CSR
+//
+
+csrTestMaster # (
+    .CSR_DATA_BUS_WIDTH(CSR_DATA_BUS_WIDTH),
+    .CSR_STROBE_BUS_WIDTH(CSR_STROBE_BUS_WIDTH)
+) CSR0 (
+    .clk(clk)
+);
+
+wire [CSR_DATA_BUS_WIDTH-1:0] GPIO_IN[0:CSR_STROBE_BUS_WIDTH-1];
+wire [CSR_STROBE_BUS_WIDTH-1:0] GPIO_STROBES = CSR0.csr_stb_o;
+wire [CSR_DATA_BUS_WIDTH-1:0] GPIO_OUT = CSR0.csr_data_o;
+
+genvar i;
+generate for(i = 0; i < CSR_STROBE_BUS_WIDTH; i = i + 1) begin
+    assign CSR0.csr_data_i[(i+1)*CSR_DATA_BUS_WIDTH-1:i*CSR_DATA_BUS_WIDTH] = GPIO_IN[i];
+end
+endgenerate
+
+//
+// Local oscillator
+//
+
+wire [31:0] loCSR;
+assign GPIO_IN[LO_REG_OFFSET_CSR] = loCSR;
+
+wire [OUTPUT_WIDTH-1:0] rfCos, rfSin, plCos, plSin, phCos, phSin;
+wire tbtLoadAccumulator, tbtLatchAccumulator, mtLoadAndLatch, loSynced;
+
+localOscillator #(
+    .OUTPUT_WIDTH(OUTPUT_WIDTH),
+    .GPIO_LO_RF_ROW_CAPACITY(GPIO_LO_RF_ROW_CAPACITY),
+    .GPIO_LO_PT_ROW_CAPACITY(GPIO_LO_PT_ROW_CAPACITY)
+  )
+  DUT(
+    .clk(adc_clk),
+    .adcSyncMarker(1'b0),
+    .singleStart(1'b0),
+    .sysClk(clk),
+    .sysAddressStrobe(GPIO_STROBES[LO_REG_OFFSET_ADDRESS]),
+    .sysGpioStrobe(GPIO_STROBES[LO_REG_OFFSET_CSR]),
+    .sysGpioData(GPIO_OUT),
+    .sysGpioCsr(loCSR),
+    .tbtLoadAccumulator(tbtLoadAccumulator),
+    .tbtLatchAccumulator(tbtLatchAccumulator),
+    .mtLoadAndLatch(mtLoadAndLatch),
+    .loSynced(loSynced),
+    .rfCos(rfCos),
+    .rfSin(rfSin),
+    .plCos(plCos),
+    .plSin(plSin),
+    .phCos(phCos),
+    .phSin(phSin)
+);
+
+//
+// Table lengths by table number
+//
+integer rfRows[0:1];
+integer ptRows[0:1];
+initial begin
+    rfRows[0] = 10;
+    ptRows[0] = 40;
+    rfRows[1] = 8;
+    ptRows[1] = 32;
+end
+
+//
+// Write a table bank using address auto-increment
+//
+task writeBank;
+    input [31:0] bank;
+    input integer id;
+    input integer rows;
+    integer r;
+    begin
+        CSR0.write32(LO_REG_OFFSET_ADDRESS, 0);
+        @(posedge clk);
+        for (r = 0 ; r < rows ; r = r + 1) begin
+            // cos then sin
+            CSR0.write32(LO_REG_OFFSET_CSR, bank | (id << TABLE_ID_SHIFT) | r);
+            @(posedge clk);
+            CSR0.write32(LO_REG_OFFSET_CSR, bank | (id << TABLE_ID_SHIFT) | r);
+            @(posedge clk);
+        end
+    end
+endtask
+
+//
+// Stage a complete set of tables then swap them in
+//
+reg [31:0] csr;
+task loadTables;
+    input integer id;
+    input [31:0] runBit;
+    begin
+        writeBank(LO_W_CSR_BANK_RF, id, rfRows[id]);
+        writeBank(LO_W_CSR_BANK_PL, id, ptRows[id]);
+        writeBank(LO_W_CSR_BANK_PH, id, ptRows[id]);
+        CSR0.write32(LO_REG_OFFSET_CSR, LO_W_CSR_BANK_NONE | runBit |
+                                        LO_W_CSR_RF_SWAP | LO_W_CSR_PT_SWAP);
+        @(posedge clk);
+        csr = LO_R_CSR_RF_SWAP_PENDING | LO_R_CSR_PT_SWAP_PENDING;
+        while (csr & (LO_R_CSR_RF_SWAP_PENDING | LO_R_CSR_PT_SWAP_PENDING)) begin
+            CSR0.read32(LO_REG_OFFSET_CSR, csr);
+            @(posedge clk);
+        end
+    end
+endtask
+
+integer rfSwapCount = 0, ptSwapCount = 0;
+integer rfId, rfRow, ptId, ptRow;
+reg rfTracking = 0, ptTracking = 0;
+
+// stimulus
+initial begin
+    wait(CSR0.ready);
+    @(posedge clk);
+
+    // Initial tables, loaded while stopped
+    loadTables(0, 0);
+    CSR0.write32(LO_REG_OFFSET_CSR, LO_W_CSR_BANK_NONE | LO_W_CSR_RUN);
+    @(posedge clk);
+    repeat(500) @(posedge clk);
+
+    // Replace tables while running, then put the originals back
+    loadTables(1, LO_W_CSR_RUN);
+    repeat(500) @(posedge clk);
+    loadTables(0, LO_W_CSR_RUN);
+    repeat(500) @(posedge clk);
+
+    if (rfSwapCount != 2) begin
+        $display("RF swapped %d times while running, expected 2", rfSwapCount);
+        errors = errors + 1;
+    end
+    if (ptSwapCount != 2) begin
+        $display("PT swapped %d times while running, expected 2", ptSwapCount);
+        errors = errors + 1;
+    end
+    module_done = 1;
+end
+
+//
+// Check output sequences
+// While running each sample must be the next row of the same table, or
+// row zero of any table immediately after the last row of a table.
+//
+always @(posedge adc_clk) begin
+    if (DUT.run) begin
+        if ((rfCos !== rfSin) || (plCos !== plSin)
+                              || (phCos !== phSin)
+                              || (plCos !== phCos)) begin
+            if (errors < 10)
+                $display("Mismatched outputs %x %x %x %x %x %x",
+                                      rfCos, rfSin, plCos, plSin, phCos, phSin);
+            errors = errors + 1;
+        end
+        if (rfTracking) begin
+            if (((rfCos >> TABLE_ID_SHIFT) == rfId)
+             && ((rfCos & ROW_MASK) == (rfRow + 1))) begin
+                rfRow = rfRow + 1;
+            end
+            else if (((rfCos & ROW_MASK) == 0) && (rfRow == (rfRows[rfId] - 1))) begin
+                if ((rfCos >> TABLE_ID_SHIFT) != rfId) rfSwapCount = rfSwapCount + 1;
+                rfId = rfCos >> TABLE_ID_SHIFT;
+                rfRow = 0;
+            end
+            else begin
+                if (errors < 10)
+                    $display("RF glitch: table %d row %d followed by %x",
+                                                         rfId, rfRow, rfCos);
+                errors = errors + 1;
+                rfId = rfCos >> TABLE_ID_SHIFT;
+                rfRow = rfCos & ROW_MASK;
+            end
+        end
+        else if (rfCos === 1) begin
+            rfTracking = 1;
+            rfId = 0;
+            rfRow = 1;
+        end
+        if (ptTracking) begin
+            if (((plCos >> TABLE_ID_SHIFT) == ptId)
+             && ((plCos & ROW_MASK) == (ptRow + 1))) begin
+                ptRow = ptRow + 1;
+            end
+            else if (((plCos & ROW_MASK) == 0) && (ptRow == (ptRows[ptId] - 1))) begin
+                if ((plCos >> TABLE_ID_SHIFT) != ptId) ptSwapCount = ptSwapCount + 1;
+                ptId = plCos >> TABLE_ID_SHIFT;
+                ptRow = 0;
+            end
+            else begin
+                if (errors < 10)
+                    $display("PT glitch: table %d row %d followed by %x",
+                                                         ptId, ptRow, plCos);
+                errors = errors + 1;
+                ptId = plCos >> TABLE_ID_SHIFT;
+                ptRow = plCos & ROW_MASK;
+            end
+        end
+        else if (plCos === 1) begin
+            ptTracking = 1;
+            ptId = 0;
+            ptRow = 1;
+        end
+    end
+end
+
+endmodule
@@ -9,6 +9,7 @@ TEST_BENCH = \
 	adcProcessing_tb \
 	genericDPRAM_tb \
 	genericDACStreamer_tb \
+	localOscillator_tb \
 	genericSPI_tb
 
 TGT_ := $(TEST_BENCH)
@@ -0,0 +1,31 @@
+//
+// Latch slow acquisition values into a contiguous block of registers.
+// The snapshot is taken once every SA toggle has changed so that the
+// processor reads values from a single SA update, no matter how long
+// it takes to read them.  The sequence number increments after each
+// snapshot so the processor can detect an update during its read.
+//
+module saSnapshot #(
+    parameter TOGGLE_COUNT = 2,
+    parameter WORD_COUNT   = 64) (
+    input                              clk,
+    input           [TOGGLE_COUNT-1:0] saToggles,
+    input       [(WORD_COUNT*32)-1:0]  values,
+    output reg                  [31:0] sequence = 0,
+    output reg  [(WORD_COUNT*32)-1:0]  snapshot = 0);
+
+reg [TOGGLE_COUNT-1:0] saMatch = 0, saPending = 0;
+
+always @(posedge clk) begin
+    saMatch <= saToggles;
+    if (saPending == {TOGGLE_COUNT{1'b1}}) begin
+        saPending <= saToggles ^ saMatch;
+        snapshot <= values;
+        sequence <= sequence + 1;
+    end
+    else begin
+        saPending <= saPending | (saToggles ^ saMatch);
+    end
+end
+
+endmodule
@@ -810,7 +810,7 @@ for (dsbpm = 0 ; dsbpm < CFG_DSBPM_COUNT ; dsbpm = dsbpm + 1) begin : dram_recor
       adcWaveformRecorder(
         .sysClk(sysClk),
         .writeData(GPIO_OUT),
-        .regStrobes(GPIO_STROBES[GPIO_IDX_ADC_RECORDER_BASE+(dsbpm*GPIO_IDX_RECORDER_PER_DSBPM)+:5]),
+        .regStrobes(GPIO_STROBES[GPIO_IDX_ADC_RECORDER_BASE+(dsbpm*GPIO_IDX_RECORDER_PER_DSBPM)+:7]),
         .csr(adcWfrCSR),
         .pretrigCount(adcWfrPretrigCount),
         .acqCount(adcWfrAcqCount),
@@ -884,7 +884,7 @@ for (dsbpm = 0 ; dsbpm < CFG_DSBPM_COUNT ; dsbpm = dsbpm + 1) begin : dram_recor
       tbtWaveformRecorder(
         .sysClk(sysClk),
         .writeData(GPIO_OUT),
-        .regStrobes(GPIO_STROBES[GPIO_IDX_TBT_RECORDER_BASE+(dsbpm*GPIO_IDX_RECORDER_PER_DSBPM)+:5]),
+        .regStrobes(GPIO_STROBES[GPIO_IDX_TBT_RECORDER_BASE+(dsbpm*GPIO_IDX_RECORDER_PER_DSBPM)+:7]),
         .csr(tbtWfrCSR),
         .pretrigCount(tbtWfrPretrigCount),
         .acqCount(tbtWfrAcqCount),
@@ -942,7 +942,7 @@ for (dsbpm = 0 ; dsbpm < CFG_DSBPM_COUNT ; dsbpm = dsbpm + 1) begin : dram_recor
       faWaveformRecorder(
         .sysClk(sysClk),
         .writeData(GPIO_OUT),
-        .regStrobes(GPIO_STROBES[GPIO_IDX_FA_RECORDER_BASE+(dsbpm*GPIO_IDX_RECORDER_PER_DSBPM)+:5]),
+        .regStrobes(GPIO_STROBES[GPIO_IDX_FA_RECORDER_BASE+(dsbpm*GPIO_IDX_RECORDER_PER_DSBPM)+:7]),
         .csr(faWfrCSR),
         .pretrigCount(faWfrPretrigCount),
         .acqCount(faWfrAcqCount),
@@ -1000,7 +1000,7 @@ for (dsbpm = 0 ; dsbpm < CFG_DSBPM_COUNT ; dsbpm = dsbpm + 1) begin : dram_recor
       plWaveformRecorder(
         .sysClk(sysClk),
         .writeData(GPIO_OUT),
-        .regStrobes(GPIO_STROBES[GPIO_IDX_PL_RECORDER_BASE+(dsbpm*GPIO_IDX_RECORDER_PER_DSBPM)+:5]),
+        .regStrobes(GPIO_STROBES[GPIO_IDX_PL_RECORDER_BASE+(dsbpm*GPIO_IDX_RECORDER_PER_DSBPM)+:7]),
         .csr(plWfrCSR),
         .pretrigCount(plWfrPretrigCount),
         .acqCount(plWfrAcqCount),
@@ -1058,7 +1058,7 @@ for (dsbpm = 0 ; dsbpm < CFG_DSBPM_COUNT ; dsbpm = dsbpm + 1) begin : dram_recor
       phWaveformRecorder(
         .sysClk(sysClk),
         .writeData(GPIO_OUT),
-        .regStrobes(GPIO_STROBES[GPIO_IDX_PH_RECORDER_BASE+(dsbpm*GPIO_IDX_RECORDER_PER_DSBPM)+:5]),
+        .regStrobes(GPIO_STROBES[GPIO_IDX_PH_RECORDER_BASE+(dsbpm*GPIO_IDX_RECORDER_PER_DSBPM)+:7]),
         .csr(phWfrCSR),
         .pretrigCount(phWfrPretrigCount),
         .acqCount(phWfrAcqCount),
@@ -1103,6 +1103,7 @@ for (dsbpm = 0 ; dsbpm < CFG_DSBPM_COUNT ; dsbpm = dsbpm + 1) begin : dram_recor
     //
     wire [31:0] tbtPosWfrCSR, tbtPosWfrPretrigCount, tbtPosWfrAcqCount, tbtPosWfrAcqAddrMSB, tbtPosWfrAcqAddrLSB;
     wire [63:0] tbtPosWfrWhenTriggered;
+    wire [31:0] tbtPosWfrWriteCount;
     assign GPIO_IN[GPIO_IDX_TBT_POS_RECORDER_BASE+(dsbpm*GPIO_IDX_RECORDER_PER_DSBPM)+0] = tbtPosWfrCSR;
     assign GPIO_IN[GPIO_IDX_TBT_POS_RECORDER_BASE+(dsbpm*GPIO_IDX_RECORDER_PER_DSBPM)+1] = tbtPosWfrPretrigCount;
     assign GPIO_IN[GPIO_IDX_TBT_POS_RECORDER_BASE+(dsbpm*GPIO_IDX_RECORDER_PER_DSBPM)+2] = tbtPosWfrAcqCount;
@@ -1110,6 +1111,7 @@ for (dsbpm = 0 ; dsbpm < CFG_DSBPM_COUNT ; dsbpm = dsbpm + 1) begin : dram_recor
     assign GPIO_IN[GPIO_IDX_TBT_POS_RECORDER_BASE+(dsbpm*GPIO_IDX_RECORDER_PER_DSBPM)+4] = tbtPosWfrAcqAddrMSB;
     assign GPIO_IN[GPIO_IDX_TBT_POS_RECORDER_BASE+(dsbpm*GPIO_IDX_RECORDER_PER_DSBPM)+5] = tbtPosWfrWhenTriggered[63:32];
     assign GPIO_IN[GPIO_IDX_TBT_POS_RECORDER_BASE+(dsbpm*GPIO_IDX_RECORDER_PER_DSBPM)+6] = tbtPosWfrWhenTriggered[31:0];
+    assign GPIO_IN[GPIO_IDX_TBT_POS_RECORDER_BASE+(dsbpm*GPIO_IDX_RECORDER_PER_DSBPM)+7] = tbtPosWfrWriteCount;
 
     genericWaveformRecorder #(
         .ACQ_CAPACITY(CFG_RECORDER_TBT_POS_SAMPLE_CAPACITY),
@@ -1120,13 +1122,14 @@ for (dsbpm = 0 ; dsbpm < CFG_DSBPM_COUNT ; dsbpm = dsbpm + 1) begin : dram_recor
       tbtPosWaveformRecorder(
         .sysClk(sysClk),
         .writeData(GPIO_OUT),
-        .regStrobes(GPIO_STROBES[GPIO_IDX_TBT_POS_RECORDER_BASE+(dsbpm*GPIO_IDX_RECORDER_PER_DSBPM)+:5]),
+        .regStrobes(GPIO_STROBES[GPIO_IDX_TBT_POS_RECORDER_BASE+(dsbpm*GPIO_IDX_RECORDER_PER_DSBPM)+:7]),
         .csr(tbtPosWfrCSR),
         .pretrigCount(tbtPosWfrPretrigCount),
         .acqCount(tbtPosWfrAcqCount),
         .acqAddressMSB(tbtPosWfrAcqAddrMSB),
         .acqAddressLSB(tbtPosWfrAcqAddrLSB),
         .whenTriggered(tbtPosWfrWhenTriggered),
+        .writeCount(tbtPosWfrWriteCount),
 
         .clk(sysClk),
         .data({
@@ -1158,6 +1161,7 @@ for (dsbpm = 0 ; dsbpm < CFG_DSBPM_COUNT ; dsbpm = dsbpm + 1) begin : dram_recor
 
     wire [31:0] faPosWfrCSR, faPosWfrPretrigCount, faPosWfrAcqCount, faPosWfrAcqAddrMSB, faPosWfrAcqAddrLSB;
     wire [63:0] faPosWfrWhenTriggered;
+    wire [31:0] faPosWfrWriteCount;
     assign GPIO_IN[GPIO_IDX_FA_POS_RECORDER_BASE+(dsbpm*GPIO_IDX_RECORDER_PER_DSBPM)+0] = faPosWfrCSR;
     assign GPIO_IN[GPIO_IDX_FA_POS_RECORDER_BASE+(dsbpm*GPIO_IDX_RECORDER_PER_DSBPM)+1] = faPosWfrPretrigCount;
     assign GPIO_IN[GPIO_IDX_FA_POS_RECORDER_BASE+(dsbpm*GPIO_IDX_RECORDER_PER_DSBPM)+2] = faPosWfrAcqCount;
@@ -1165,6 +1169,7 @@ for (dsbpm = 0 ; dsbpm < CFG_DSBPM_COUNT ; dsbpm = dsbpm + 1) begin : dram_recor
     assign GPIO_IN[GPIO_IDX_FA_POS_RECORDER_BASE+(dsbpm*GPIO_IDX_RECORDER_PER_DSBPM)+4] = faPosWfrAcqAddrMSB;
     assign GPIO_IN[GPIO_IDX_FA_POS_RECORDER_BASE+(dsbpm*GPIO_IDX_RECORDER_PER_DSBPM)+5] = faPosWfrWhenTriggered[63:32];
     assign GPIO_IN[GPIO_IDX_FA_POS_RECORDER_BASE+(dsbpm*GPIO_IDX_RECORDER_PER_DSBPM)+6] = faPosWfrWhenTriggered[31:0];
+    assign GPIO_IN[GPIO_IDX_FA_POS_RECORDER_BASE+(dsbpm*GPIO_IDX_RECORDER_PER_DSBPM)+7] = faPosWfrWriteCount;
 
     genericWaveformRecorder #(
         .ACQ_CAPACITY(CFG_RECORDER_FA_POS_SAMPLE_CAPACITY),
@@ -1175,13 +1180,14 @@ for (dsbpm = 0 ; dsbpm < CFG_DSBPM_COUNT ; dsbpm = dsbpm + 1) begin : dram_recor
       faPosWaveformRecorder(
         .sysClk(sysClk),
         .writeData(GPIO_OUT),
-        .regStrobes(GPIO_STROBES[GPIO_IDX_FA_POS_RECORDER_BASE+(dsbpm*GPIO_IDX_RECORDER_PER_DSBPM)+:5]),
+        .regStrobes(GPIO_STROBES[GPIO_IDX_FA_POS_RECORDER_BASE+(dsbpm*GPIO_IDX_RECORDER_PER_DSBPM)+:7]),
         .csr(faPosWfrCSR),
         .pretrigCount(faPosWfrPretrigCount),
         .acqCount(faPosWfrAcqCount),
         .acqAddressMSB(faPosWfrAcqAddrMSB),
         .acqAddressLSB(faPosWfrAcqAddrLSB),
         .whenTriggered(faPosWfrWhenTriggered),
+        .writeCount(faPosWfrWriteCount),
 
         .clk(sysClk),
         .data({
@@ -2682,6 +2688,116 @@ assign FMC_PMOD5_5 = 0;
 assign FMC_PMOD5_6 = 0;
 assign FMC_PMOD5_7 = 0;
 
+//
+// Slow acquisition snapshot
+// Word 0 is the sequence number, words 1 and 2 the SA time stamp,
+// followed by CFG_SA_SNAPSHOT_WORDS_PER_DSBPM words for each DSBPM.
+// Keep in sync with publisher.c.
+//
+localparam SA_SNAPSHOT_HEADER_WORDS = 2;
+localparam SA_SNAPSHOT_WORD_COUNT = SA_SNAPSHOT_HEADER_WORDS +
+                            (CFG_DSBPM_COUNT * CFG_SA_SNAPSHOT_WORDS_PER_DSBPM);
+
+function integer saSnapshotSource;
+    input integer word;
+    begin
+        case (word)
+        0:  saSnapshotSource = GPIO_IDX_POSITION_CALC_SA_X;
+        1:  saSnapshotSource = GPIO_IDX_POSITION_CALC_SA_Y;
+        2:  saSnapshotSource = GPIO_IDX_POSITION_CALC_SA_Q;
+        3:  saSnapshotSource = GPIO_IDX_POSITION_CALC_SA_S;
+        4:  saSnapshotSource = GPIO_IDX_RMS_X_WIDE;
+        5:  saSnapshotSource = GPIO_IDX_RMS_Y_WIDE;
+        6:  saSnapshotSource = GPIO_IDX_RMS_X_NARROW;
+        7:  saSnapshotSource = GPIO_IDX_RMS_Y_NARROW;
+        8:  saSnapshotSource = GPIO_IDX_LOSS_OF_BEAM_TRIGGER;
+        9:  saSnapshotSource = GPIO_IDX_PRELIM_STATUS;
+        10: saSnapshotSource = GPIO_IDX_CLOCK_STATUS;
+        11, 12, 13, 14:
+            saSnapshotSource = GPIO_IDX_PRELIM_RF_MAG_0 + word - 11;
+        15, 16, 17, 18:
+            saSnapshotSource = GPIO_IDX_PRELIM_PT_LO_MAG_0 + word - 15;
+        19, 20, 21, 22:
+            saSnapshotSource = GPIO_IDX_PRELIM_PT_HI_MAG_0 + word - 19;
+        23, 24, 25, 26:
+            saSnapshotSource = GPIO_IDX_ADC_GAIN_FACTOR_0 + word - 23;
+        27, 28, 29, 30:
+            saSnapshotSource = GPIO_IDX_RF_GAIN_FACTOR_0 + word - 27;
+        31, 32, 33, 34:
+            saSnapshotSource = GPIO_IDX_PL_GAIN_FACTOR_0 + word - 31;
+        35, 36, 37, 38:
+            saSnapshotSource = GPIO_IDX_PH_GAIN_FACTOR_0 + word - 35;
+        default: saSnapshotSource = -1;
+        endcase
+    end
+endfunction
+
+wire [(SA_SNAPSHOT_WORD_COUNT*32)-1:0] saSnapshotValues, saSnapshot;
+wire                   [CFG_DSBPM_COUNT-1:0] saSnapshotToggles;
+assign saSnapshotValues[0+:32] = GPIO_IN[GPIO_IDX_SA_TIMESTAMP_SEC];
+assign saSnapshotValues[32+:32] = GPIO_IN[GPIO_IDX_SA_TIMESTAMP_FRACTION];
+generate
+for (dsbpm = 0 ; dsbpm < CFG_DSBPM_COUNT ; dsbpm = dsbpm + 1) begin : sa_snapshot
+    assign saSnapshotToggles[dsbpm] = positionCalcSaToggle[dsbpm];
+    for (i = 0 ; i < CFG_SA_SNAPSHOT_WORDS_PER_DSBPM ; i = i + 1) begin : word
+        localparam integer w = SA_SNAPSHOT_HEADER_WORDS +
+                                    (dsbpm * CFG_SA_SNAPSHOT_WORDS_PER_DSBPM) + i;
+        if (saSnapshotSource(i) < 0) begin
+            assign saSnapshotValues[w*32+:32] = 0;
+        end
+        else begin
+            assign saSnapshotValues[w*32+:32] =
+                        GPIO_IN[saSnapshotSource(i) + dsbpm*GPIO_IDX_PER_DSBPM];
+        end
+    end
+end
+for (i = 0 ; i < SA_SNAPSHOT_WORD_COUNT ; i = i + 1) begin : sa_snapshot_readout
+    assign GPIO_IN[GPIO_IDX_SA_SNAPSHOT_BASE + 1 + i] = saSnapshot[i*32+:32];
+end
+endgenerate
+
+saSnapshot #(.TOGGLE_COUNT(CFG_DSBPM_COUNT),
+             .WORD_COUNT(SA_SNAPSHOT_WORD_COUNT))
+  saSnapshotBank (
+    .clk(sysClk),
+    .saToggles(saSnapshotToggles),
+    .values(saSnapshotValues),
+    .sequence(GPIO_IN[GPIO_IDX_SA_SNAPSHOT_BASE]),
+    .snapshot(saSnapshot));
+
+//
+// Fast acquisition position stream
+// Each row is the time stamp followed by X, Y, Q and S for each DSBPM.
+//
+localparam FA_STREAM_WORD_COUNT = 2 + (CFG_DSBPM_COUNT * 4);
+wire [(FA_STREAM_WORD_COUNT*32)-1:0] faStreamValues, faStreamData;
+wire                   [CFG_DSBPM_COUNT-1:0] faStreamToggles;
+assign faStreamValues[0+:64] = { sysTimestamp[31:0], sysTimestamp[63:32] };
+generate
+for (dsbpm = 0 ; dsbpm < CFG_DSBPM_COUNT ; dsbpm = dsbpm + 1) begin : fa_stream
+    assign faStreamToggles[dsbpm] = positionCalcFaToggle[dsbpm];
+    assign faStreamValues[(2+(dsbpm*4))*32+:128] = { positionCalcFaS[dsbpm],
+                                                     positionCalcFaQ[dsbpm],
+                                                     positionCalcFaY[dsbpm],
+                                                     positionCalcFaX[dsbpm] };
+end
+for (i = 0 ; i < FA_STREAM_WORD_COUNT ; i = i + 1) begin : fa_stream_readout
+    assign GPIO_IN[GPIO_IDX_FA_STREAM_DATA_BASE + i] = faStreamData[i*32+:32];
+end
+endgenerate
+
+faStream #(.TOGGLE_COUNT(CFG_DSBPM_COUNT),
+           .WORD_COUNT(FA_STREAM_WORD_COUNT),
+           .ADDR_WIDTH($clog2(CFG_FA_STREAM_ROW_CAPACITY)))
+  faStream (
+    .sysClk(sysClk),
+    .sysCsrStrobe(GPIO_STROBES[GPIO_IDX_FA_STREAM_CSR]),
+    .sysGpioOut(GPIO_OUT),
+    .sysCsr(GPIO_IN[GPIO_IDX_FA_STREAM_CSR]),
+    .sysData(faStreamData),
+    .sysFaToggles(faStreamToggles),
+    .sysValues(faStreamValues));
+
 //
 // FOFB communication
 //
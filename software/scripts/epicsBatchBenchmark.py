@@ -0,0 +1,94 @@
+#
+# Compare the time taken to send a list of commands to a DSBPM one
+# command per packet and as batch packets.
+# By default the commands are harmless firmware build date reads.
+# A command with an argument (-c and -a) is sent with the same argument
+# every time, so choose one whose setting can safely be repeated, for
+# example restoring an attenuator to its present value.
+#
+import argparse
+import socket
+import struct
+import sys
+import time
+
+DSBPM_PROTOCOL_UDP_PORT = 50005
+DSBPM_PROTOCOL_MAGIC = 0xD06F9B91
+DSBPM_PROTOCOL_ARG_CAPACITY = 350
+DSBPM_PROTOCOL_CMD_HI_BATCH = 0x7000
+DSBPM_PROTOCOL_BATCH_ITEM_FAILED = 0x80000000
+DSBPM_PROTOCOL_CMD_LONGIN_IDX_FIRMWARE_BUILD_DATE = 0x0000
+
+parser = argparse.ArgumentParser(description='Compare single and batched DSBPM command rates.', formatter_class=argparse.ArgumentDefaultsHelpFormatter)
+parser.add_argument('address', help='DSBPM IPv4 address.')
+parser.add_argument('-n', '--count', default=64, type=int, help='Commands in the list.')
+parser.add_argument('-c', '--command', default=DSBPM_PROTOCOL_CMD_LONGIN_IDX_FIRMWARE_BUILD_DATE, type=lambda x: int(x, 0), help='Command code.')
+parser.add_argument('-a', '--arg', type=lambda x: int(x, 0), help='Command argument.')
+parser.add_argument('-r', '--repeat', default=10, type=int, help='Times to send the list.')
+parser.add_argument('-t', '--timeout', default=0.1, type=float, help='Seconds to wait before retransmitting.')
+args = parser.parse_args()
+
+sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+dest = (args.address, DSBPM_PROTOCOL_UDP_PORT)
+nonce = int(time.time())
+retries = 0
+
+def transact(command, cmdArgs):
+    global nonce, retries
+    nonce = (nonce + 1) & 0xFFFFFFFF
+    pk = struct.pack('<III%dI' % len(cmdArgs), DSBPM_PROTOCOL_MAGIC, nonce, command, *cmdArgs)
+    sock.settimeout(args.timeout)
+    for attempt in range(10):
+        sock.sendto(pk, dest)
+        try:
+            while True:
+                reply = sock.recv(2000)
+                magic, replyNonce, replyCommand = struct.unpack_from('<III', reply)
+                if magic == DSBPM_PROTOCOL_MAGIC and replyNonce == nonce:
+                    return struct.unpack_from('<%dI' % ((len(reply) - 12) // 4), reply, 12)
+        except socket.timeout:
+            retries += 1
+    sys.exit('No reply to command 0x%X' % command)
+
+cmdArgs = [] if args.arg is None else [args.arg]
+itemWords = 1 + len(cmdArgs)
+perBatch = DSBPM_PROTOCOL_ARG_CAPACITY // max(itemWords, 1)
+if args.arg is None:
+    # Each read returns one argument so leave room in the reply
+    perBatch = DSBPM_PROTOCOL_ARG_CAPACITY // 2
+
+def single():
+    for i in range(args.count):
+        transact(args.command, cmdArgs)
+    return args.count
+
+def batched():
+    packets = 0
+    for first in range(0, args.count, perBatch):
+        n = min(perBatch, args.count - first)
+        items = []
+        for i in range(n):
+            items += [(len(cmdArgs) << 16) | args.command] + cmdArgs
+        reply = transact(DSBPM_PROTOCOL_CMD_HI_BATCH, items)
+        i = done = 0
+        while i < len(reply):
+            if reply[i] & DSBPM_PROTOCOL_BATCH_ITEM_FAILED:
+                sys.exit('Command 0x%X failed in batch' % args.command)
+            i += 1 + ((reply[i] >> 16) & 0x3FFF)
+            done += 1
+        if done != n:
+            sys.exit('Batch executed %d of %d commands' % (done, n))
+        packets += 1
+    return packets
+
+for name, method in (('single', single), ('batched', batched)):
+    best = None
+    retries = 0
+    for r in range(args.repeat):
+        then = time.time()
+        packets = method()
+        elapsed = time.time() - then
+        if best is None or elapsed < best:
+            best = elapsed
+    print('%-8s %4d commands in %3d packets, best %8.3f ms, %d retries' % (
+            name, args.count, packets, best * 1e3, retries))
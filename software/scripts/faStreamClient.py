@@ -0,0 +1,103 @@
+#
+# Minimal fast acquisition position stream receiver.
+# Subscribes to the FA stream, receives for a while and reports packet
+# and sample rates, lost packets, samples lost in the DSBPM, and packet
+# arrival jitter.  Optionally writes the samples to a CSV file.
+#
+import argparse
+import socket
+import struct
+import sys
+import time
+
+DSBPM_PROTOCOL_FA_STREAM_UDP_PORT = 50007
+DSBPM_PROTOCOL_MAGIC_FA_STREAM = 0xD06F9798
+DSBPM_PROTOCOL_FA_STREAM_SAMPLE_CAPACITY = 32
+DSBPM_PROTOCOL_DSP_COUNT = 2
+
+REQUEST_FORMAT = '<II'
+HEADER_FORMAT = '<IIIII'
+SAMPLE_FORMAT = '<II' + 'iiii' * DSBPM_PROTOCOL_DSP_COUNT
+RENEW_INTERVAL = 2.0
+
+parser = argparse.ArgumentParser(description='Receive the DSBPM FA position stream.', formatter_class=argparse.ArgumentDefaultsHelpFormatter)
+parser.add_argument('address', help='DSBPM IPv4 address.')
+parser.add_argument('-k', '--samplesPerPacket', default=10, type=int, help='Samples per packet (1 to %d).' % DSBPM_PROTOCOL_FA_STREAM_SAMPLE_CAPACITY)
+parser.add_argument('-d', '--duration', default=10.0, type=float, help='Seconds to receive.')
+parser.add_argument('-o', '--output', help='Write samples to this CSV file.')
+args = parser.parse_args()
+
+sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 8*1024*1024)
+sock.bind(('', 0))
+sock.settimeout(0.5)
+dest = (args.address, DSBPM_PROTOCOL_FA_STREAM_UDP_PORT)
+
+def request(samplesPerPacket):
+    sock.sendto(struct.pack(REQUEST_FORMAT, DSBPM_PROTOCOL_MAGIC_FA_STREAM, samplesPerPacket), dest)
+
+headerSize = struct.calcsize(HEADER_FORMAT)
+sampleSize = struct.calcsize(SAMPLE_FORMAT)
+out = open(args.output, 'w') if args.output else None
+if out:
+    names = ['sample', 'seconds', 'fraction']
+    for b in range(DSBPM_PROTOCOL_DSP_COUNT):
+        names += ['x%d' % b, 'y%d' % b, 'q%d' % b, 's%d' % b]
+    out.write(','.join(names) + '\n')
+
+packets = samples = lostPackets = badPackets = 0
+firstLost = lastLost = None
+expectedSequence = None
+gaps = []
+then = previousArrival = None
+renewed = 0
+start = time.time()
+try:
+    while time.time() - start < args.duration:
+        now = time.time()
+        if now - renewed > RENEW_INTERVAL:
+            request(args.samplesPerPacket)
+            renewed = now
+        try:
+            pk = sock.recv(2000)
+        except socket.timeout:
+            continue
+        arrival = time.time()
+        if len(pk) < headerSize:
+            badPackets += 1
+            continue
+        magic, sequence, sampleNumber, lost, count = struct.unpack(HEADER_FORMAT, pk[:headerSize])
+        if (magic != DSBPM_PROTOCOL_MAGIC_FA_STREAM) or (len(pk) != headerSize + count * sampleSize):
+            badPackets += 1
+            continue
+        if then is None:
+            then = arrival
+            firstLost = lost
+        else:
+            gaps.append(arrival - previousArrival)
+        previousArrival = arrival
+        if expectedSequence is not None and sequence != expectedSequence:
+            lostPackets += (sequence - expectedSequence) & 0xFFFFFFFF
+        expectedSequence = (sequence + 1) & 0xFFFFFFFF
+        lastLost = lost
+        packets += 1
+        samples += count
+        if out:
+            for i in range(count):
+                s = struct.unpack_from(SAMPLE_FORMAT, pk, headerSize + i * sampleSize)
+                out.write('%d,%s\n' % (sampleNumber + i, ','.join(str(v) for v in s)))
+finally:
+    request(0)
+    if out:
+        out.close()
+
+if packets < 2:
+    sys.exit('Received %d packets' % packets)
+elapsed = previousArrival - then
+gaps.sort()
+print('%d packets, %d samples in %.3f s' % (packets, samples, elapsed))
+print('%.1f packets/s, %.1f samples/s' % ((packets - 1) / elapsed, samples / elapsed))
+print('%d packets lost in transit, %d samples lost in DSBPM, %d bad packets' % (
+        lostPackets, (lastLost - firstLost) & 0xFFFFFFFF, badPackets))
+print('Packet interval median %.3f ms, 99%% %.3f ms, max %.3f ms' % (
+        gaps[len(gaps) // 2] * 1e3, gaps[(len(gaps) * 99) // 100] * 1e3, gaps[-1] * 1e3))
@@ -13,9 +13,12 @@ proc gen_vitis_platform {platform_name xsa_file} {
     bsp setlib -name lwip211
 
     # LwIP overrides
-    bsp config mem_size 1048576
+    bsp config mem_size 4194304
     bsp config pbuf_pool_size 4096
+    bsp config pbuf_pool_bufsize 9700
+    bsp config temac_use_jumbo_frames true
     bsp config memp_n_udp_pcb 32
+    bsp config memp_n_pbuf 256
     bsp config n_rx_descriptors 128
     bsp config n_tx_descriptors 128
     bsp config lwip_dhcp true
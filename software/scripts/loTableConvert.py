@@ -0,0 +1,88 @@
+#
+# Convert DSBPM local oscillator tables between the ASCII (rfTable.csv,
+# ptTable.csv) and binary (rfTable.bin, ptTable.bin) formats.
+# Direction is chosen by the input file name extension.
+# Binary layout must match struct loTableBinaryHeader in
+# software/src/localOscillator.c.
+#
+import argparse
+import os
+import struct
+import sys
+import zlib
+
+LO_TABLE_BINARY_MAGIC = 0x4254414C
+LO_TABLE_BINARY_VERSION = 1
+HEADER_FORMAT = '<IHHII'
+SCALE_FACTOR = float(0x1FFFF)
+
+def scale(x):
+    i = int(abs(x) * SCALE_FACTOR + 0.5)
+    return -i if x < 0 else i
+
+def readAscii(name):
+    rows = []
+    with open(name) as f:
+        for lineNumber, line in enumerate(f, 1):
+            line = line.strip()
+            if not line:
+                continue
+            values = [float(v) for v in line.split(',')]
+            if any(not (-1.0 <= v <= 1.0) for v in values):
+                sys.exit('%s:%d: Value out of range' % (name, lineNumber))
+            if rows and len(values) != len(rows[0]):
+                sys.exit('%s:%d: Wrong number of columns' % (name, lineNumber))
+            rows.append([scale(v) for v in values])
+    return rows
+
+def writeBinary(name, rows):
+    columnCount = len(rows[0])
+    payload = b''.join(struct.pack('<%di' % columnCount, *r) for r in rows)
+    with open(name, 'wb') as f:
+        f.write(struct.pack(HEADER_FORMAT, LO_TABLE_BINARY_MAGIC,
+                            LO_TABLE_BINARY_VERSION, columnCount, len(rows),
+                            zlib.crc32(payload) & 0xFFFFFFFF))
+        f.write(payload)
+
+def readBinary(name):
+    with open(name, 'rb') as f:
+        data = f.read()
+    headerSize = struct.calcsize(HEADER_FORMAT)
+    if len(data) < headerSize:
+        sys.exit('File too short')
+    magic, version, columnCount, rowCount, crc = struct.unpack_from(HEADER_FORMAT, data)
+    if magic != LO_TABLE_BINARY_MAGIC:
+        sys.exit('Bad magic number 0x%08X' % magic)
+    if version != LO_TABLE_BINARY_VERSION:
+        sys.exit('Unsupported version %d' % version)
+    payload = data[headerSize:]
+    if len(payload) != rowCount * columnCount * 4:
+        sys.exit('File size does not match row count')
+    if (zlib.crc32(payload) & 0xFFFFFFFF) != crc:
+        sys.exit('CRC mismatch')
+    return [list(struct.unpack_from('<%di' % columnCount, payload, r * columnCount * 4)) for r in range(rowCount)]
+
+def writeAscii(name, rows):
+    with open(name, 'w') as f:
+        for r in rows:
+            f.write(','.join('%9.6f' % (v / SCALE_FACTOR) for v in r) + '\n')
+
+parser = argparse.ArgumentParser(description='Convert DSBPM local oscillator tables between ASCII and binary formats.')
+parser.add_argument('input', help='Input table (.csv or .bin).')
+parser.add_argument('output', nargs='?', help='Output table. Default is input with extension swapped.')
+args = parser.parse_args()
+
+base, ext = os.path.splitext(args.input)
+if ext.lower() == '.csv':
+    output = args.output or base + '.bin'
+    rows = readAscii(args.input)
+    if not rows:
+        sys.exit('Empty table')
+    writeBinary(output, rows)
+elif ext.lower() == '.bin':
+    output = args.output or base + '.csv'
+    rows = readBinary(args.input)
+    writeAscii(output, rows)
+else:
+    sys.exit('Input must be .csv or .bin')
+print('%d rows written to %s' % (len(rows), output))
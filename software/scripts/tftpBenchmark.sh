@@ -0,0 +1,92 @@
+#!/bin/sh
+
+#
+# Time TFTP transfers of a boot image with and without option negotiation.
+# Uses stock clients:
+#   tftp (tftp-hpa)  -- plain RFC 1350, 512 byte blocks, lock-step
+#   curl             -- blksize
+#   atftp            -- blksize and windowsize
+# Reads are always done.  Writes replace the boot image in flash so
+# are done only when '-w' is given -- use a real BOOT.bin of about
+# 30 MB for a representative measurement.
+#
+
+IP="${DSBPM_IP_ADDRESS=131.243.196.245}"
+SRC="BOOT.bin"
+WRITE=""
+BLKSIZE=1468
+WINDOWSIZE=16
+
+for i
+do
+    case "$i" in
+        -w)    WRITE="yes" ;;
+        *.bin) SRC="$i" ;;
+        *)     IP="$i" ;;
+    esac
+done
+
+set -e
+test -r "$SRC"
+SIZE=`wc -c <"$SRC"`
+CHK="tftpBenchmark$$.bin"
+trap 'rm -f "$CHK"' EXIT
+
+timed() {
+    label="$1"
+    shift
+    start=`date +%s.%N`
+    "$@" >/dev/null
+    end=`date +%s.%N`
+    echo "$label" "$start" "$end" "$SIZE" |
+        awk '{ t = $3 - $2; printf "%-40s %7.2f s %7.2f MB/s\n", $1, t, $4 / t / 1e6 }'
+}
+
+check() {
+    if cmp -s "$SRC" "$CHK"
+    then
+        :
+    else
+        echo "Readback does not match $SRC!"
+        exit 1
+    fi
+}
+
+if [ -n "$WRITE" ]
+then
+    timed "put:RFC1350" tftp -m binary "$IP" -c put "$SRC" BOOT.BIN
+    sleep 5
+fi
+timed "get:RFC1350" tftp -m binary "$IP" -c get BOOT.BIN "$CHK"
+check
+
+if command -v curl >/dev/null
+then
+    if [ -n "$WRITE" ]
+    then
+        timed "put:blksize=$BLKSIZE" curl -s --tftp-blksize "$BLKSIZE" \
+                                          -T "$SRC" "tftp://$IP/BOOT.BIN"
+        sleep 5
+    fi
+    timed "get:blksize=$BLKSIZE" curl -s --tftp-blksize "$BLKSIZE" \
+                                      -o "$CHK" "tftp://$IP/BOOT.BIN"
+    check
+fi
+
+if command -v atftp >/dev/null
+then
+    if [ -n "$WRITE" ]
+    then
+        timed "put:blksize=$BLKSIZE,windowsize=$WINDOWSIZE" \
+            atftp --option "blksize $BLKSIZE" \
+                  --option "windowsize $WINDOWSIZE" \
+                  -p -l "$SRC" -r BOOT.BIN "$IP"
+        sleep 5
+    fi
+    timed "get:blksize=$BLKSIZE,windowsize=$WINDOWSIZE" \
+        atftp --option "blksize $BLKSIZE" \
+              --option "windowsize $WINDOWSIZE" \
+              --option "tsize 0" \
+              -g -r BOOT.BIN -l "$CHK" "$IP"
+    check
+fi
@@ -0,0 +1,84 @@
+#
+# Render a DSBPM debug event trace.
+# Fetch the trace with TFTP, for example:
+#     tftp -m binary <dsbpm> -c get TRACE.bin
+# Event numbers must match enum traceEvent in software/src/trace.h.
+#
+import argparse
+import struct
+import sys
+
+TRACE_FILE_MAGIC = 0x54524331
+HEADER_FORMAT = '<III'
+ENTRY_FORMAT = '<IIIII'
+
+def recorder(v):
+    return '%d:%d' % ((v >> 8) & 0xFF, v & 0xFF)
+
+def ipv4(v):
+    return '%d.%d.%d.%d' % ((v >> 24) & 0xFF, (v >> 16) & 0xFF, (v >> 8) & 0xFF, v & 0xFF)
+
+def hexWord(v):
+    return '0x%08X' % v
+
+PACKET_TYPES = { 0: 'payload', 1: 'compressed', 2: 'header' }
+
+def packetType(v):
+    return PACKET_TYPES.get(v, str(v))
+
+# Name and (label, formatter) for each argument
+EVENTS = {
+     1: ('EPICS_RX',           (('length', int), ('from', ipv4), ('port', int))),
+     2: ('EPICS_BAD_SIZE',     (('length', int),)),
+     3: ('EPICS_COMMAND',      (('command', hexWord), ('args', int), ('arg0', hexWord))),
+     4: ('EPICS_REPLY',        (('size', int),)),
+     5: ('EPICS_BAD_MAGIC',    (('magic', hexWord),)),
+     6: ('WFR_REG_WRITE',      (('recorder', recorder), ('reg', int), ('value', hexWord))),
+     7: ('WFR_NO_PBUF',        (('recorder', recorder), ('packet', packetType))),
+     8: ('WFR_BLOCK',          (('recorder', recorder), ('block', int), ('size', int))),
+     9: ('WFR_STREAM_OVERRUN', (('recorder', recorder), ('discarded', int))),
+    10: ('WFR_COMPLETE',       (('recorder', recorder), ('resent', int))),
+    11: ('WFR_ACK',            (('recorder', recorder), ('block', int))),
+    12: ('WFR_SEGMENT',        (('recorder', recorder), ('segment', int), ('start', int))),
+    13: ('WFR_HEADER',         (('recorder', recorder), ('acqCount', int), ('byteCount', int))),
+    14: ('WFR_FULL',           (('recorder', recorder),)),
+    15: ('WFR_SOFT_TRIGGER',   (('dsbpm', int),)),
+}
+
+parser = argparse.ArgumentParser(description='Render a DSBPM debug event trace.', formatter_class=argparse.ArgumentDefaultsHelpFormatter)
+parser.add_argument('file', help='Trace file fetched from the DSBPM.')
+parser.add_argument('-e', '--event', action='append', help='Show only this event (may be repeated).')
+parser.add_argument('-a', '--absolute', action='store_true', help='Show microseconds since boot rather than since first event.')
+args = parser.parse_args()
+
+with open(args.file, 'rb') as f:
+    data = f.read()
+headerSize = struct.calcsize(HEADER_FORMAT)
+entrySize = struct.calcsize(ENTRY_FORMAT)
+if len(data) < headerSize:
+    sys.exit('File too short')
+magic, count, total = struct.unpack_from(HEADER_FORMAT, data)
+if magic != TRACE_FILE_MAGIC:
+    sys.exit('Bad magic number 0x%08X' % magic)
+if len(data) != headerSize + count * entrySize:
+    sys.exit('File size does not match entry count')
+print('%d events recorded, %d in file' % (total, count))
+
+wanted = set(e.upper() for e in args.event) if args.event else None
+first = previous = None
+for i in range(count):
+    us, event, a0, a1, a2 = struct.unpack_from(ENTRY_FORMAT, data, headerSize + i * entrySize)
+    name, fields = EVENTS.get(event, ('EVENT_%d' % event, ()))
+    if wanted and name not in wanted:
+        continue
+    if first is None:
+        first = previous = us
+    when = us if args.absolute else (us - first) & 0xFFFFFFFF
+    delta = (us - previous) & 0xFFFFFFFF
+    previous = us
+    values = (a0, a1, a2)
+    if fields:
+        text = '  '.join('%s %s' % (label, fmt(v)) for (label, fmt), v in zip(fields, values))
+    else:
+        text = '  '.join(hexWord(v) for v in values)
+    print('%12d %+9d  %-18s %s' % (when, delta, name, text))
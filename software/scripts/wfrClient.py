@@ -0,0 +1,308 @@
+#
+# Minimal waveform recorder client.
+# Arms a recorder, applies a software trigger, reads the waveform back
+# and reports the transfer rate.  Useful for checking the waveform
+# transfer protocol without an IOC.
+# Can also record a position recorder in continuous mode.
+#
+import argparse
+import socket
+import struct
+import sys
+import time
+import wfrCompression
+
+DSBPM_PROTOCOL_UDP_PORT = 50005
+DSBPM_PROTOCOL_PUBLISHER_UDP_PORT = 50006
+
+DSBPM_PROTOCOL_MAGIC = 0xD06F9B91
+DSBPM_PROTOCOL_MAGIC_WAVEFORM_HEADER = 0xD06F9993
+DSBPM_PROTOCOL_MAGIC_WAVEFORM_DATA = 0xD06F9794
+DSBPM_PROTOCOL_MAGIC_WAVEFORM_ACK = 0xD06F9795
+DSBPM_PROTOCOL_MAGIC_WAVEFORM_STREAM = 0xD06F9796
+DSBPM_PROTOCOL_MAGIC_WAVEFORM_COMPRESSED_DATA = 0xD06F9797
+
+DSBPM_PROTOCOL_WAVEFORM_PAYLOAD_CAPACITY = 1440
+DSBPM_PROTOCOL_WAVEFORM_BLOCK_ALIGNMENT = 32
+DSBPM_PROTOCOL_WAVEFORM_ACK_FLAG_WINDOWED = 0x1
+DSBPM_PROTOCOL_WAVEFORM_ACK_FLAG_COMPRESS = 0x2
+DSBPM_PROTOCOL_WAVEFORM_WINDOW_CAPACITY = 32
+DSBPM_PROTOCOL_SUBSCRIBE_FLAG_PRIMARY = 0x1
+DSBPM_PROTOCOL_SUBSCRIBE_FLAG_EXTENDED_HEADER = 0x2
+
+DSBPM_PROTOCOL_CMD_HI_RECORDERS = 0x5000
+DSBPM_PROTOCOL_CMD_RECORDERS_LO_ARM = 0x0000
+DSBPM_PROTOCOL_CMD_RECORDERS_LO_TRIGGER_MASK = 0x0100
+DSBPM_PROTOCOL_CMD_RECORDERS_LO_ACQUISITION_COUNT = 0x0300
+DSBPM_PROTOCOL_CMD_RECORDERS_LO_SOFT_TRIGGER = 0x0500
+DSBPM_PROTOCOL_CMD_RECORDERS_LO_CONTINUOUS_MODE = 0x0800
+DSBPM_PROTOCOL_CMD_RECORDERS_LO_SEGMENT_COUNT = 0x0900
+
+CFG_NUM_RECORDERS = 7
+CFG_DSBPM_COUNT = 2
+
+HEADER_FORMAT = '<IIIH2xIIIII'
+HEADER_BLOCK_CAPACITY_FORMAT = '<IIIH2xIIIIII'
+HEADER_SEGMENT_FORMAT = '<IIIH2xIIIIIII'
+SEGMENT_FORMAT = '<II'
+DATA_FORMAT = '<IIIII'
+COMPRESSED_DATA_FORMAT = '<IIIIIHH'
+ACK_LEGACY_FORMAT = '<IIIII'
+ACK_WINDOWED_FORMAT = '<IIIIIIII'
+ACK_FORMAT = '<IIIIIIIII'
+STREAM_FORMAT = '<IIIIIIII'
+
+parser = argparse.ArgumentParser(description='Read back a DSBPM waveform recorder.', formatter_class=argparse.ArgumentDefaultsHelpFormatter)
+parser.add_argument('address', help='DSBPM IPv4 address.')
+parser.add_argument('-b', '--bpm', default=0, type=int, help='DSBPM number.')
+parser.add_argument('-r', '--recorder', default=0, type=int, help='Recorder number (0=ADC, 1=TbT, 2=FA, 3=PL, 4=PH, 5=TbT position, 6=FA position).')
+parser.add_argument('-n', '--count', default=1000000, type=int, help='Acquisition sample count.')
+parser.add_argument('-w', '--window', default=0, type=int, help='Blocks in flight (0 for stop-and-wait transfer).')
+parser.add_argument('-B', '--blockSize', default=0, type=int, help='Bytes per block (0 for protocol default).')
+parser.add_argument('-m', '--benchmark', action='store_true', help='Transfer with 1440, 4000 and 8000 byte blocks and compare rates.')
+parser.add_argument('-c', '--compare', action='store_true', help='Transfer with both stop-and-wait and windowed modes and compare rates.')
+parser.add_argument('-f', '--fofbIndex', default=-1000, type=int, help='FOFB index sent with the subscription request. Use the value the IOC has configured to avoid disturbing it.')
+parser.add_argument('-S', '--segments', default=1, type=int, help='Segments, one per trigger (rounded down to a power of 2).')
+parser.add_argument('-s', '--stream', type=float, help='Record in continuous mode for this many seconds (TbT and FA position recorders only).')
+parser.add_argument('-z', '--compress', action='store_true', help='Request compressed data blocks.')
+parser.add_argument('-o', '--output', help='Write waveform bytes to this file.')
+parser.add_argument('-t', '--timeout', default=0.2, type=float, help='Seconds to wait before repeating an acknowledgement.')
+args = parser.parse_args()
+
+class Recorder:
+    def __init__(self, address):
+        self.address = address
+        self.nonce = int(time.time())
+        self.cmdSock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.cmdSock.settimeout(1.0)
+        self.pubSock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.pubSock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 8*1024*1024)
+        self.pubSock.bind(('', 0))
+
+    def command(self, command, arg):
+        self.nonce += 1
+        pk = struct.pack('<IIII', DSBPM_PROTOCOL_MAGIC, self.nonce, command, arg & 0xFFFFFFFF)
+        for i in range(5):
+            self.cmdSock.sendto(pk, (self.address, DSBPM_PROTOCOL_UDP_PORT))
+            try:
+                reply = self.cmdSock.recv(2000)
+                if struct.unpack_from('<I', reply)[0] == DSBPM_PROTOCOL_MAGIC:
+                    return reply
+            except socket.timeout:
+                pass
+        sys.exit('No reply to command 0x%04X' % command)
+
+    def subscribe(self, fofbIndex):
+        flags = DSBPM_PROTOCOL_SUBSCRIBE_FLAG_PRIMARY | DSBPM_PROTOCOL_SUBSCRIBE_FLAG_EXTENDED_HEADER
+        pk = struct.pack('<%dhI' % CFG_DSBPM_COUNT, *([fofbIndex] * CFG_DSBPM_COUNT + [flags]))
+        self.pubSock.sendto(pk, (self.address, DSBPM_PROTOCOL_PUBLISHER_UDP_PORT))
+
+    def ack(self, bpm, recorder, waveformNumber, block, window, receivedMask = 0, blockSize = 0, compress = False):
+        flags = DSBPM_PROTOCOL_WAVEFORM_ACK_FLAG_WINDOWED if window else 0
+        if compress:
+            flags |= DSBPM_PROTOCOL_WAVEFORM_ACK_FLAG_COMPRESS
+        if blockSize:
+            pk = struct.pack(ACK_FORMAT, DSBPM_PROTOCOL_MAGIC_WAVEFORM_ACK,
+                             bpm, waveformNumber, recorder, block,
+                             flags, window, receivedMask, blockSize)
+        elif flags:
+            pk = struct.pack(ACK_WINDOWED_FORMAT, DSBPM_PROTOCOL_MAGIC_WAVEFORM_ACK,
+                             bpm, waveformNumber, recorder, block,
+                             flags, window, receivedMask)
+        else:
+            pk = struct.pack(ACK_LEGACY_FORMAT, DSBPM_PROTOCOL_MAGIC_WAVEFORM_ACK,
+                             bpm, waveformNumber, recorder, block)
+        self.pubSock.sendto(pk, (self.address, DSBPM_PROTOCOL_PUBLISHER_UDP_PORT))
+
+    def receive(self, timeout):
+        self.pubSock.settimeout(timeout)
+        try:
+            return self.pubSock.recv(65536)
+        except socket.timeout:
+            return None
+
+    def acquire(self, bpm, recorder, count, fofbIndex, segments = 1):
+        idx = (bpm * CFG_NUM_RECORDERS) + recorder
+        self.subscribe(fofbIndex)
+        self.command(DSBPM_PROTOCOL_CMD_HI_RECORDERS |
+                     DSBPM_PROTOCOL_CMD_RECORDERS_LO_SEGMENT_COUNT | idx, segments)
+        self.command(DSBPM_PROTOCOL_CMD_HI_RECORDERS |
+                     DSBPM_PROTOCOL_CMD_RECORDERS_LO_TRIGGER_MASK | idx, 0x01)
+        self.command(DSBPM_PROTOCOL_CMD_HI_RECORDERS |
+                     DSBPM_PROTOCOL_CMD_RECORDERS_LO_ACQUISITION_COUNT | idx, count)
+        self.command(DSBPM_PROTOCOL_CMD_HI_RECORDERS |
+                     DSBPM_PROTOCOL_CMD_RECORDERS_LO_ARM | idx, 1)
+        for i in range(segments):
+            time.sleep(0.5)
+            self.command(DSBPM_PROTOCOL_CMD_HI_RECORDERS |
+                         DSBPM_PROTOCOL_CMD_RECORDERS_LO_SOFT_TRIGGER | bpm, 0)
+        then = time.time()
+        while (time.time() - then) < 30:
+            self.subscribe(fofbIndex)
+            pk = self.receive(1.0)
+            if pk is None or len(pk) < struct.calcsize(HEADER_FORMAT):
+                continue
+            if len(pk) >= struct.calcsize(HEADER_SEGMENT_FORMAT):
+                h = struct.unpack_from(HEADER_SEGMENT_FORMAT, pk)
+            elif len(pk) >= struct.calcsize(HEADER_BLOCK_CAPACITY_FORMAT):
+                h = struct.unpack_from(HEADER_BLOCK_CAPACITY_FORMAT, pk) + (0,)
+            else:
+                h = struct.unpack_from(HEADER_FORMAT, pk) + (DSBPM_PROTOCOL_WAVEFORM_PAYLOAD_CAPACITY, 0)
+            if h[0] == DSBPM_PROTOCOL_MAGIC_WAVEFORM_HEADER and h[1] == bpm and h[3] == recorder:
+                segmentTimes = [struct.unpack_from(SEGMENT_FORMAT, pk,
+                                    struct.calcsize(HEADER_SEGMENT_FORMAT) +
+                                    i * struct.calcsize(SEGMENT_FORMAT))
+                                                        for i in range(h[10])]
+                return { 'waveformNumber': h[2], 'byteCount': h[6],
+                         'bytesPerSample': h[7], 'bytesPerAtom': h[8],
+                         'blockCapacity': h[9], 'segmentTimes': segmentTimes }
+        sys.exit('No waveform header from DSBPM:Recorder %d:%d' % (bpm, recorder))
+
+    def transfer(self, bpm, recorder, header, window, blockSize, timeout, compress = False):
+        """
+        Read back waveform.  Window size of 0 selects stop-and-wait mode.
+        Returns (payload bytes, packets received, acknowledgements sent,
+        bytes on the wire).
+        """
+        wfn = header['waveformNumber']
+        byteCount = header['byteCount']
+        blocks = {}
+        size = blockSize - (blockSize % DSBPM_PROTOCOL_WAVEFORM_BLOCK_ALIGNMENT)
+        if size == 0:
+            size = DSBPM_PROTOCOL_WAVEFORM_PAYLOAD_CAPACITY
+        size = min(size, header['blockCapacity'])
+        blockCount = (byteCount + size - 1) // size
+        cumulative = 0
+        packets = 0
+        acks = 0
+        wireBytes = 0
+        stride = header['bytesPerSample'] // header['bytesPerAtom']
+        ack = lambda block, mask = 0: self.ack(bpm, recorder, wfn, block, window, mask, blockSize, compress)
+        ack(0)
+        acks += 1
+        while cumulative < blockCount:
+            pk = self.receive(timeout)
+            if pk is None:
+                # Stop-and-wait acknowledgements are not idempotent so
+                # rely on the DSBPM to repeat the block.
+                if window:
+                    ack(cumulative, self.receivedMask(blocks, cumulative))
+                    acks += 1
+                continue
+            if len(pk) < struct.calcsize(DATA_FORMAT):
+                continue
+            magic, b, w, r, block = struct.unpack_from(DATA_FORMAT, pk)
+            if magic == DSBPM_PROTOCOL_MAGIC_WAVEFORM_HEADER and not blocks:
+                # Acknowledgement of header was lost
+                ack(0)
+                acks += 1
+                continue
+            if b != bpm or r != recorder or w != wfn:
+                continue
+            if magic == DSBPM_PROTOCOL_MAGIC_WAVEFORM_DATA:
+                payload = pk[struct.calcsize(DATA_FORMAT):]
+            elif magic == DSBPM_PROTOCOL_MAGIC_WAVEFORM_COMPRESSED_DATA:
+                _, _, _, _, _, compressed, originalLength = struct.unpack_from(COMPRESSED_DATA_FORMAT, pk)
+                payload = pk[struct.calcsize(COMPRESSED_DATA_FORMAT):]
+                if compressed:
+                    payload = wfrCompression.decompress(payload, originalLength,
+                                                        header['bytesPerAtom'], stride)
+            else:
+                continue
+            packets += 1
+            wireBytes += len(pk)
+            blocks[block] = payload
+            if window:
+                while cumulative in blocks:
+                    cumulative += 1
+                ack(cumulative, self.receivedMask(blocks, cumulative))
+            else:
+                if block != cumulative:
+                    continue
+                cumulative += 1
+                ack(block)
+            acks += 1
+        data = b''.join(blocks[i] for i in range(blockCount))
+        return data[:byteCount], packets, acks, wireBytes
+
+    def stream(self, bpm, recorder, seconds, fofbIndex):
+        """
+        Receive a continuous stream.
+        Returns (payload bytes, packets received, packets lost, overruns).
+        """
+        idx = (bpm * CFG_NUM_RECORDERS) + recorder
+        self.subscribe(fofbIndex)
+        self.command(DSBPM_PROTOCOL_CMD_HI_RECORDERS |
+                     DSBPM_PROTOCOL_CMD_RECORDERS_LO_ARM | idx, 0)
+        self.command(DSBPM_PROTOCOL_CMD_HI_RECORDERS |
+                     DSBPM_PROTOCOL_CMD_RECORDERS_LO_CONTINUOUS_MODE | idx, 1)
+        self.command(DSBPM_PROTOCOL_CMD_HI_RECORDERS |
+                     DSBPM_PROTOCOL_CMD_RECORDERS_LO_ARM | idx, 1)
+        chunks = []
+        expect = None
+        packets = 0
+        lost = 0
+        overruns = 0
+        then = time.time()
+        lastSubscribe = then
+        while (time.time() - then) < seconds:
+            if (time.time() - lastSubscribe) > 1:
+                self.subscribe(fofbIndex)
+                lastSubscribe = time.time()
+            pk = self.receive(0.1)
+            if pk is None or len(pk) < struct.calcsize(STREAM_FORMAT):
+                continue
+            magic, b, w, r, seq, hi, lo, overruns = struct.unpack_from(STREAM_FORMAT, pk)
+            if magic != DSBPM_PROTOCOL_MAGIC_WAVEFORM_STREAM or b != bpm or r != recorder:
+                continue
+            if expect is not None and seq != expect:
+                lost += (seq - expect) & 0xFFFFFFFF
+            expect = (seq + 1) & 0xFFFFFFFF
+            packets += 1
+            chunks.append(pk[struct.calcsize(STREAM_FORMAT):])
+        self.command(DSBPM_PROTOCOL_CMD_HI_RECORDERS |
+                     DSBPM_PROTOCOL_CMD_RECORDERS_LO_ARM | idx, 0)
+        self.command(DSBPM_PROTOCOL_CMD_HI_RECORDERS |
+                     DSBPM_PROTOCOL_CMD_RECORDERS_LO_CONTINUOUS_MODE | idx, 0)
+        return b''.join(chunks), packets, lost, overruns
+
+    @staticmethod
+    def receivedMask(blocks, cumulative):
+        mask = 0
+        for i in range(DSBPM_PROTOCOL_WAVEFORM_WINDOW_CAPACITY):
+            if (cumulative + 1 + i) in blocks:
+                mask |= 1 << i
+        return mask
+
+def run(rec, window, blockSize):
+    header = rec.acquire(args.bpm, args.recorder, args.count, args.fofbIndex, args.segments)
+    for i, (seconds, fraction) in enumerate(header['segmentTimes']):
+        print('Segment %2d triggered at %d:%010d' % (i, seconds, fraction))
+    then = time.time()
+    data, packets, acks, wireBytes = rec.transfer(args.bpm, args.recorder, header, window, blockSize, args.timeout, args.compress)
+    elapsed = time.time() - then
+    mode = 'windowed (%d)' % window if window else 'stop-and-wait'
+    if blockSize:
+        mode += ' %d' % blockSize
+    if args.compress:
+        mode += ' z%.2f' % (len(data) / wireBytes)
+    print('%-22s %10d bytes %8d packets %8d acks %8.3f s %9.0f packets/s %8.3f MB/s' % (mode,
+            len(data), packets, acks, elapsed, packets / elapsed, len(data) / elapsed / 1.0e6))
+    return data
+
+rec = Recorder(args.address)
+if args.stream:
+    data, packets, lost, overruns = rec.stream(args.bpm, args.recorder, args.stream, args.fofbIndex)
+    print('%10d bytes %8d packets %6d lost %6d overruns %8.3f MB/s' % (len(data),
+            packets, lost, overruns, len(data) / args.stream / 1.0e6))
+elif args.benchmark:
+    for blockSize in (1440, 4000, 8000):
+        data = run(rec, args.window if args.window else DSBPM_PROTOCOL_WAVEFORM_WINDOW_CAPACITY, blockSize)
+elif args.compare:
+    run(rec, 0, args.blockSize)
+    data = run(rec, args.window if args.window else DSBPM_PROTOCOL_WAVEFORM_WINDOW_CAPACITY, args.blockSize)
+else:
+    data = run(rec, args.window, args.blockSize)
+if args.output:
+    with open(args.output, 'wb') as f:
+        f.write(data)
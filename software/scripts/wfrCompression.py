@@ -0,0 +1,102 @@
+#
+# Reference implementation of the waveform block compression
+# performed by the DSBPM (software/src/waveformCompress.c).
+# Run as a script to report compression ratio and encode/decode
+# rates for a waveform capture such as one written by 'wfrClient.py -o'.
+#
+import argparse
+import sys
+import time
+
+WFC_GROUP_SIZE = 32
+
+def _atoms(data, bytesPerAtom):
+    return [int.from_bytes(data[i:i+bytesPerAtom], 'little')
+                                    for i in range(0, len(data), bytesPerAtom)]
+
+def compress(data, bytesPerAtom, stride):
+    """
+    Return compressed block, or None if it would not be smaller.
+    """
+    if bytesPerAtom not in (2, 4) or stride == 0 or len(data) % bytesPerAtom:
+        return None
+    bits = 8 * bytesPerAtom
+    mask = (1 << bits) - 1
+    atoms = _atoms(data, bytesPerAtom)
+    out = bytearray()
+    for i in range(0, len(atoms), WFC_GROUP_SIZE):
+        zz = []
+        for j in range(i, min(i + WFC_GROUP_SIZE, len(atoms))):
+            v = atoms[j]
+            if j >= stride:
+                v = (v - atoms[j - stride]) & mask
+            if v & (1 << (bits - 1)):
+                v -= 1 << bits
+            zz.append(((v << 1) ^ (v >> (bits - 1))) & mask)
+        width = 0
+        for v in zz:
+            width = max(width, v.bit_length())
+        out.append(width)
+        acc = 0
+        for n, v in enumerate(zz):
+            acc |= v << (n * width)
+        out += acc.to_bytes((len(zz) * width + 7) // 8, 'little')
+        if len(out) >= len(data):
+            return None
+    return bytes(out)
+
+def decompress(data, originalLength, bytesPerAtom, stride):
+    bits = 8 * bytesPerAtom
+    mask = (1 << bits) - 1
+    count = originalLength // bytesPerAtom
+    atoms = []
+    i = 0
+    while len(atoms) < count:
+        n = min(WFC_GROUP_SIZE, count - len(atoms))
+        width = data[i]
+        i += 1
+        nBytes = (n * width + 7) // 8
+        acc = int.from_bytes(data[i:i+nBytes], 'little')
+        i += nBytes
+        for j in range(n):
+            zz = (acc >> (j * width)) & ((1 << width) - 1)
+            v = (zz >> 1) ^ -(zz & 1)
+            k = len(atoms)
+            if k >= stride:
+                v += atoms[k - stride]
+            atoms.append(v & mask)
+    return b''.join(a.to_bytes(bytesPerAtom, 'little') for a in atoms)
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Measure waveform compression of a capture file.', formatter_class=argparse.ArgumentDefaultsHelpFormatter)
+    parser.add_argument('file', help='Raw waveform bytes.')
+    parser.add_argument('-a', '--bytesPerAtom', default=2, type=int, help='Bytes per atom (2 for ADC, 4 for others).')
+    parser.add_argument('-s', '--bytesPerSample', default=16, type=int, help='Bytes per sample.')
+    parser.add_argument('-B', '--blockSize', default=1440, type=int, help='Bytes per block.')
+    args = parser.parse_args()
+
+    with open(args.file, 'rb') as f:
+        raw = f.read()
+    stride = args.bytesPerSample // args.bytesPerAtom
+    inBytes = outBytes = 0
+    encodeTime = decodeTime = 0
+    for offset in range(0, len(raw), args.blockSize):
+        block = raw[offset:offset+args.blockSize]
+        then = time.time()
+        c = compress(block, args.bytesPerAtom, stride)
+        encodeTime += time.time() - then
+        if c is None:
+            outBytes += len(block)
+        else:
+            then = time.time()
+            d = decompress(c, len(block), args.bytesPerAtom, stride)
+            decodeTime += time.time() - then
+            if d != block:
+                sys.exit('Block at offset %d does not decompress correctly' % offset)
+            outBytes += len(c)
+        inBytes += len(block)
+    if outBytes == 0:
+        sys.exit('Empty file')
+    print('%d bytes in, %d bytes out, ratio %.2f' % (inBytes, outBytes, inBytes / outBytes))
+    print('Reference encode %.3f MB/s, decode %.3f MB/s' % (
+            inBytes / max(encodeTime, 1e-9) / 1.0e6, inBytes / max(decodeTime, 1e-9) / 1.0e6))
@@ -8,6 +8,7 @@
 #include <lwip/inet.h>
 #include <lwip/udp.h>
 #include <xparameters.h>
+#include <xscugic.h>
 #include <xuartps_hw.h>
 #include "ami.h"
 #include "rpb.h"
@@ -16,20 +17,26 @@
 #include "display.h"
 #include "evr.h"
 #include "eyescan.h"
+#include "faStream.h"
 #include "ffs.h"
 #include "frequencyMonitor.h"
 #include "gpio.h"
 #include "iic.h"
 #include "mgt.h"
 #include "mmcm.h"
+#include "netRx.h"
+#include "publisher.h"
 #include "rfdc.h"
 #include "rfclk.h"
+#include "scheduler.h"
 #include "st7789v.h"
 #include "sysmon.h"
 #include "sysref.h"
 #include "systemParameters.h"
+#include "trace.h"
 #include "user_mgt_refclk.h"
 #include "util.h"
+#include "waveformRecorder.h"
 #include "fanCtl.h"
 #include "serdes.h"
 
@@ -73,6 +80,94 @@ udpConsoleDrain(void)
     udpConsole.outIndex = 0;
 }
 
+/*
+ * Serial console transmit ring.
+ * Characters are queued by the main loop and moved to the UART transmit
+ * FIFO by the FIFO empty interrupt, so printing costs no more than a copy.
+ * Characters that arrive when the ring is full are dropped and counted.
+ * Output is synchronous until consoleStartBufferedOutput is called so
+ * that startup messages appear before a possible hang, and can be made
+ * synchronous again for fatal error reports.
+ */
+#if STDOUT_BASEADDRESS != XPAR_XUARTPS_0_BASEADDR
+# error "Console transmit interrupt assumes standard output is UART 0"
+#endif
+#define TX_RING_SIZE    8192
+static struct txRing {
+    char                  buf[TX_RING_SIZE];
+    volatile unsigned int head;
+    volatile unsigned int tail;
+    int                   isBuffered;
+    unsigned int          dropped;
+} txRing;
+
+static void
+txInterruptHandler(void *arg)
+{
+    unsigned int tail = txRing.tail;
+
+    XUartPs_WriteReg(STDOUT_BASEADDRESS, XUARTPS_ISR_OFFSET,
+                                                        XUARTPS_IXR_TXEMPTY);
+    while ((tail != txRing.head)
+        && !(XUartPs_ReadReg(STDOUT_BASEADDRESS, XUARTPS_SR_OFFSET) &
+                                                        XUARTPS_SR_TXFULL)) {
+        XUartPs_WriteReg(STDOUT_BASEADDRESS, XUARTPS_FIFO_OFFSET,
+                                          txRing.buf[tail % TX_RING_SIZE]);
+        tail++;
+    }
+    txRing.tail = tail;
+    if (tail == txRing.head)
+        XUartPs_WriteReg(STDOUT_BASEADDRESS, XUARTPS_IDR_OFFSET,
+                                                        XUARTPS_IXR_TXEMPTY);
+}
+
+static void
+uartPutc(char c)
+{
+    unsigned int head = txRing.head;
+
+    if (!txRing.isBuffered) {
+        XUartPs_SendByte(STDOUT_BASEADDRESS, c);
+        return;
+    }
+    if ((head - txRing.tail) >= TX_RING_SIZE) {
+        txRing.dropped++;
+        return;
+    }
+    txRing.buf[head % TX_RING_SIZE] = c;
+    txRing.head = head + 1;
+    XUartPs_WriteReg(STDOUT_BASEADDRESS, XUARTPS_IER_OFFSET,
+                                                        XUARTPS_IXR_TXEMPTY);
+}
+
+void
+consoleStartBufferedOutput(void)
+{
+    XScuGic_RegisterHandler(XPAR_SCUGIC_0_CPU_BASEADDR, XPAR_XUARTPS_0_INTR,
+                                            txInterruptHandler, NULL);
+    XScuGic_EnableIntr(XPAR_SCUGIC_0_DIST_BASEADDR, XPAR_XUARTPS_0_INTR);
+    txRing.isBuffered = 1;
+}
+
+/*
+ * Send queued characters then switch to busy-wait output.
+ */
+void
+consoleSynchronousOutput(void)
+{
+    if (!txRing.isBuffered)
+        return;
+    XScuGic_DisableIntr(XPAR_SCUGIC_0_DIST_BASEADDR, XPAR_XUARTPS_0_INTR);
+    XUartPs_WriteReg(STDOUT_BASEADDRESS, XUARTPS_IDR_OFFSET,
+                                                        XUARTPS_IXR_TXEMPTY);
+    txRing.isBuffered = 0;
+    while (txRing.tail != txRing.head) {
+        XUartPs_SendByte(STDOUT_BASEADDRESS,
+                                   txRing.buf[txRing.tail % TX_RING_SIZE]);
+        txRing.tail++;
+    }
+}
+
 /*
  * Convert <newline> to <carriage return><newline> so
  * we can use normal looking printf format strings.
@@ -93,7 +188,7 @@ outbyte(char8 c)
 
     if ((c == '\n') && !wasReturn) outbyte('\r');
     wasReturn = (c == '\r');
-    XUartPs_SendByte(STDOUT_BASEADDRESS, c);
+    uartPutc(c);
     if (isStartup && (startIdx < STARTBUF_SIZE))
         startBuf[startIdx++] = c;
     if (udpConsole.fromPort) {
@@ -396,6 +491,9 @@ static int
 cmdSTATS(int argc, char **argv)
 {
     stats_display();
+    printf("Console: %u characters queued, %u dropped\n",
+                                        txRing.head - txRing.tail, txRing.dropped);
+    txRing.dropped = 0;
     return 0;
 }
 
@@ -620,15 +718,21 @@ static struct commandInfo commandTable[] = {
   { "DIR",    ffsShow,  "Show micro SD cards files"          },
   { "debug",  cmdDEBUG, "Set debug flags"                    },
   { "evr",    cmdEVR,   "Show EVR configuration"             },
+  { "fas",    faStreamCommand,"Show FA position stream status"},
   { "fmon"  , cmdFMON,  "Show clock frequencies"             },
   { "log",    cmdLOG,   "Replay startup console output"      },
   { "mac",    cmdMAC,   "Set Ethernet MAC address"           },
   { "net",    cmdNET,   "Set network parameters"             },
+  { "netrx",  netRxCommand,"Show network receive queue statistics"},
+  { "pub",    publisherCommand,"Show subscribers and SA fetch times"},
   { "reg",    cmdREG,   "Show GPIO register(s)"              },
+  { "sched",  schedulerCommand,"Show main loop task timing"},
   { "stats",  cmdSTATS, "Show network statistics"            },
   { "tlog",   cmdTLOG,  "Timing system event logger"         },
+  { "trace",  traceCommand,"Show debug event trace"          },
   { "userMGT",cmdUMGT,  "User MGT reference clock adjustment"},
   { "values", cmdSYSMON,"Show system monitor values"         },
+  { "wfr",    wfrCommand,"Waveform recorder packet statistics"},
   { "amiValues", cmdAMIMON, "Show AMI monitor values"        },
   { "rpbValues", cmdRPBMON, "Show RPB monitor values"        },
   { "fanValues", cmdFanMON, "Show Fan monitor values"        },
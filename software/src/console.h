@@ -6,5 +6,7 @@
 #define _SHELL_H_
 
 void consoleCheck(void);
+void consoleStartBufferedOutput(void);
+void consoleSynchronousOutput(void);
 
 #endif
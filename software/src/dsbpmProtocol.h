@@ -15,8 +15,11 @@
 
 #define DSBPM_PROTOCOL_UDP_PORT                 50005
 #define DSBPM_PROTOCOL_PUBLISHER_UDP_PORT       50006
+#define DSBPM_PROTOCOL_FA_STREAM_UDP_PORT       50007
 
 #define DSBPM_PROTOCOL_WAVEFORM_PAYLOAD_CAPACITY  1440
+#define DSBPM_PROTOCOL_WAVEFORM_BLOCK_ALIGNMENT   32
+#define DSBPM_PROTOCOL_WAVEFORM_WINDOW_CAPACITY   32
 #define DSBPM_PROTOCOL_RECORDER_COUNT             7
 
 // echo "DSBPM_PROTOCOL_MAGIC" | md5sum | cut -b1-8 | tac -rs .. | echo $(tr -d '\n')
@@ -34,6 +37,15 @@
 #define DSBPM_PROTOCOL_MAGIC_WAVEFORM_ACK       0xD06F9795
 #define DSBPM_PROTOCOL_MAGIC_SWAPPED_WAVEFORM_ACK \
                                                 0x95976FD0
+#define DSBPM_PROTOCOL_MAGIC_WAVEFORM_STREAM    0xD06F9796
+#define DSBPM_PROTOCOL_MAGIC_SWAPPED_WAVEFORM_STREAM \
+                                                0x96976FD0
+#define DSBPM_PROTOCOL_MAGIC_WAVEFORM_COMPRESSED_DATA \
+                                                0xD06F9797
+#define DSBPM_PROTOCOL_MAGIC_SWAPPED_WAVEFORM_COMPRESSED_DATA \
+                                                0x97976FD0
+#define DSBPM_PROTOCOL_MAGIC_FA_STREAM          0xD06F9798
+#define DSBPM_PROTOCOL_MAGIC_SWAPPED_FA_STREAM  0x98976FD0
 
 #define DSBPM_PROTOCOL_ARG_CAPACITY    350
 #define DSBPM_PROTOCOL_FOFB_CAPACITY   512
@@ -48,6 +60,32 @@ struct dsbpmPacket {
     epicsUInt32    args[DSBPM_PROTOCOL_ARG_CAPACITY];
 };
 
+/*
+ * Subscription request, sent to the publisher port at least once per
+ * lease period (60 seconds).
+ * The legacy request is the fofbIndex array alone.  It comes from the
+ * IOC, which receives waveforms as well as slow acquisition packets and
+ * sets the FOFB indices.  Other clients send the full request and, unless
+ * they set DSBPM_PROTOCOL_SUBSCRIBE_FLAG_PRIMARY, receive slow acquisition
+ * packets only and leave the FOFB indices unchanged.
+ * The waveform destination receives the full waveform header only if it
+ * sets DSBPM_PROTOCOL_SUBSCRIBE_FLAG_EXTENDED_HEADER.  Otherwise the header
+ * is the DSBPM_PROTOCOL_WAVEFORM_HEADER_LEGACY_SIZE bytes sent by older
+ * firmware.
+ * Only one subscriber at a time receives waveforms.  The first primary
+ * subscriber to arrive when there is none takes the role, as does a
+ * subscriber that sends a waveform acknowledgement then.  It keeps the
+ * role until its subscription lapses.
+ */
+struct dsbpmSubscription {
+    epicsInt16  fofbIndex[DSBPM_PROTOCOL_DSP_COUNT];
+    epicsUInt32 flags;
+};
+#define DSBPM_PROTOCOL_SUBSCRIBE_LEGACY_SIZE    \
+                                (DSBPM_PROTOCOL_DSP_COUNT * sizeof(epicsInt16))
+#define DSBPM_PROTOCOL_SUBSCRIBE_FLAG_PRIMARY   0x1
+#define DSBPM_PROTOCOL_SUBSCRIBE_FLAG_EXTENDED_HEADER 0x2
+
 /*
  * Slow acquisition (typically 10 Hz) monitoring
  */
@@ -94,18 +132,63 @@ struct dsbpmSlowAcquisition {
  * unsolicited.  It then sends each block when requested.
  * The header is retransmitted if a block request does not arrive in a
  * reasonable interval.
+ *
+ * Acknowledgements that are DSBPM_PROTOCOL_WAVEFORM_ACK_LEGACY_SIZE bytes
+ * long, or that do not have DSBPM_PROTOCOL_WAVEFORM_ACK_FLAG_WINDOWED set,
+ * request a single block (stop-and-wait transfer).
+ * A windowed acknowledgement allows up to windowSize blocks in flight.
+ * Its blockNumber is cumulative -- all preceding blocks have arrived -- and
+ * bit N of receivedMask is set if block blockNumber+1+N has arrived.
+ * Blocks missing below the highest received block are retransmitted.
+ *
+ * Blocks are DSBPM_PROTOCOL_WAVEFORM_PAYLOAD_CAPACITY bytes unless the
+ * acknowledgement of the header requests a different blockSize.  The
+ * request is rounded down to a multiple of
+ * DSBPM_PROTOCOL_WAVEFORM_BLOCK_ALIGNMENT and limited to the header
+ * blockCapacity, which the DSBPM derives from its interface MTU.
+ *
+ * An acknowledgement of the header with DSBPM_PROTOCOL_WAVEFORM_ACK_FLAG_COMPRESS
+ * set requests compressed blocks.  These are sent as dsbpmWaveformCompressedData
+ * packets so that clients unaware of compression never see them.  Each block
+ * is compressed independently (see waveformCompress.h) and flagged as such.
+ * Blocks that would not shrink are sent uncompressed.  originalLength is the
+ * number of waveform bytes the block represents.
+ *
+ * A segmented acquisition consists of segmentCount equal-length segments,
+ * one per trigger, sent back to back as a single waveform.  The header
+ * holds the trigger time of each segment.  Only the first segmentCount
+ * entries of the segment table are sent.  Unsegmented acquisitions have
+ * a segmentCount of 0.
+ *
+ * Recorders selected for post-mortem readout are also triggered by loss
+ * of beam.  An acquisition that ends after a loss of beam is sent ahead of
+ * all other waveform traffic.  The header lossOfBeamStatus holds the
+ * loss-of-beam trigger status at the end of the acquisition, with the
+ * POST_MORTEM bit set for post-mortem transfers.  The field occupies what
+ * was previously structure padding and is 0 from older firmware.
  */
+#define DSBPM_PROTOCOL_WAVEFORM_SEGMENT_CAPACITY 64
+#define DSBPM_PROTOCOL_WAVEFORM_POST_MORTEM      0x8000
+struct dsbpmWaveformSegment {
+    epicsUInt32 seconds;
+    epicsUInt32 fraction;
+};
 struct dsbpmWaveformHeader {
     epicsUInt32 magic;
     epicsUInt32 dsbpmNumber;
     epicsUInt32 waveformNumber;
     epicsUInt16 recorderNumber;
+    epicsUInt16 lossOfBeamStatus;
     epicsUInt32 seconds;
     epicsUInt32 fraction;
     epicsUInt32 byteCount;
     epicsUInt32 bytesPerSample;
     epicsUInt32 bytesPerAtom;
+    epicsUInt32 blockCapacity;
+    epicsUInt32 segmentCount;
+    struct dsbpmWaveformSegment segments[DSBPM_PROTOCOL_WAVEFORM_SEGMENT_CAPACITY];
 };
+#define DSBPM_PROTOCOL_WAVEFORM_HEADER_LEGACY_SIZE (9 * sizeof(epicsUInt32))
 struct dsbpmWaveformData {
     epicsUInt32 magic;
     epicsUInt32 dsbpmNumber;
@@ -114,12 +197,86 @@ struct dsbpmWaveformData {
     epicsUInt32 blockNumber;
     unsigned char payload[DSBPM_PROTOCOL_WAVEFORM_PAYLOAD_CAPACITY];
 };
+struct dsbpmWaveformCompressedData {
+    epicsUInt32 magic;
+    epicsUInt32 dsbpmNumber;
+    epicsUInt32 waveformNumber;
+    epicsUInt32 recorderNumber;
+    epicsUInt32 blockNumber;
+    epicsUInt16 compressed;
+    epicsUInt16 originalLength;
+    unsigned char payload[DSBPM_PROTOCOL_WAVEFORM_PAYLOAD_CAPACITY];
+};
 struct dsbpmWaveformAck {
     epicsUInt32 magic;
     epicsUInt32 dsbpmNumber;
     epicsUInt32 waveformNumber;
     epicsUInt32 recorderNumber;
     epicsUInt32 blockNumber;
+    epicsUInt32 flags;
+    epicsUInt32 windowSize;
+    epicsUInt32 receivedMask;
+    epicsUInt32 blockSize;
+};
+#define DSBPM_PROTOCOL_WAVEFORM_ACK_LEGACY_SIZE   (5 * sizeof(epicsUInt32))
+#define DSBPM_PROTOCOL_WAVEFORM_ACK_WINDOWED_SIZE (8 * sizeof(epicsUInt32))
+#define DSBPM_PROTOCOL_WAVEFORM_ACK_FLAG_WINDOWED 0x1
+#define DSBPM_PROTOCOL_WAVEFORM_ACK_FLAG_COMPRESS 0x2
+
+/*
+ * Continuous streaming
+ * A recorder armed in continuous mode ignores triggers and keeps writing
+ * its ring buffer.  New data are sent as they arrive with no header and
+ * no acknowledgements.  The sequence number increments with every packet
+ * so the receiver can detect loss.  The byte offset is the position of
+ * the first payload byte in the stream since the recorder was armed.
+ * The overrun count increments whenever the recorder laps the reader and
+ * data are discarded, in which case the byte offset skips ahead.
+ */
+struct dsbpmWaveformStream {
+    epicsUInt32 magic;
+    epicsUInt32 dsbpmNumber;
+    epicsUInt32 waveformNumber;
+    epicsUInt32 recorderNumber;
+    epicsUInt32 sequenceNumber;
+    epicsUInt32 byteOffsetHi;
+    epicsUInt32 byteOffsetLo;
+    epicsUInt32 overrunCount;
+    unsigned char payload[DSBPM_PROTOCOL_WAVEFORM_PAYLOAD_CAPACITY];
+};
+
+/*
+ * Fast acquisition (typically 10 kHz) position stream
+ * A client subscribes by sending a dsbpmFaStreamRequest to the FA stream
+ * port and must renew the request every few seconds.  A request with
+ * samplesPerPacket of zero cancels the subscription.  Each packet holds
+ * sampleCount consecutive samples.  The sequence number increments with
+ * every packet.  The sample number is that of the first sample in the
+ * packet and skips ahead when samples are lost, in which case the lost
+ * sample count increases too.
+ */
+#define DSBPM_PROTOCOL_FA_STREAM_SAMPLE_CAPACITY    32
+struct dsbpmFaStreamRequest {
+    epicsUInt32 magic;
+    epicsUInt32 samplesPerPacket;
+};
+struct dsbpmFaStreamSample {
+    epicsUInt32 seconds;
+    epicsUInt32 fraction;
+    struct {
+        epicsInt32 x;
+        epicsInt32 y;
+        epicsInt32 q;
+        epicsInt32 s;
+    } position[DSBPM_PROTOCOL_DSP_COUNT];
+};
+struct dsbpmFaStream {
+    epicsUInt32 magic;
+    epicsUInt32 sequenceNumber;
+    epicsUInt32 sampleNumber;
+    epicsUInt32 lostSampleCount;
+    epicsUInt32 sampleCount;
+    struct dsbpmFaStreamSample samples[DSBPM_PROTOCOL_FA_STREAM_SAMPLE_CAPACITY];
 };
 
 #define DSBPM_PROTOCOL_SIZE_TO_ARG_COUNT(s) (DSBPM_PROTOCOL_ARG_CAPACITY - \
@@ -194,6 +351,11 @@ struct dsbpmWaveformAck {
 # define DSBPM_PROTOCOL_CMD_RECORDERS_LO_ACQUISITION_COUNT   0x0300
 # define DSBPM_PROTOCOL_CMD_RECORDERS_LO_ACQUISITION_MODE    0x0400
 # define DSBPM_PROTOCOL_CMD_RECORDERS_LO_SOFT_TRIGGER        0x0500
+# define DSBPM_PROTOCOL_CMD_RECORDERS_LO_TX_PRIORITY         0x0600
+# define DSBPM_PROTOCOL_CMD_RECORDERS_LO_QUEUE_DEPTH         0x0700
+# define DSBPM_PROTOCOL_CMD_RECORDERS_LO_CONTINUOUS_MODE     0x0800
+# define DSBPM_PROTOCOL_CMD_RECORDERS_LO_SEGMENT_COUNT       0x0900
+# define DSBPM_PROTOCOL_CMD_RECORDERS_LO_POST_MORTEM         0x0A00
 
 #define DSBPM_PROTOCOL_CMD_HI_OCTET         0x6000
 # define DSBPM_PROTOCOL_CMD_OCTET_IDX_NAME           0x00
@@ -203,4 +365,60 @@ struct dsbpmWaveformAck {
 # define DSBPM_PROTOCOL_CMD_OCTET_IDX_ACTIVE         0x04
 # define DSBPM_PROTOCOL_CMD_OCTET_IDX_CFG_MODE       0x05
 
+/*
+ * Bulk access to the general purpose I/O registers.
+ * READ:       args are first index and count, reply is count values.
+ * READ_LIST:  args are indices, reply is one value per index.
+ * WRITE:      args are first index then values for consecutive registers.
+ * WRITE_LIST: args are (index, value) pairs.
+ * Writes are restricted to an allowlist of calibration and threshold
+ * registers.  A request with any index that is out of range, or that is
+ * not allowed for writing, is rejected as a whole.
+ */
+#define DSBPM_PROTOCOL_CMD_HI_REGISTER      0x8000
+# define DSBPM_PROTOCOL_CMD_REGISTER_LO_READ         0x0000
+# define DSBPM_PROTOCOL_CMD_REGISTER_LO_READ_LIST    0x0080
+# define DSBPM_PROTOCOL_CMD_REGISTER_LO_WRITE        0x0100
+# define DSBPM_PROTOCOL_CMD_REGISTER_LO_WRITE_LIST   0x0180
+
+/*
+ * A batch packet carries a list of commands, each a header word followed
+ * by the command arguments.  The header holds the command and its argument
+ * count.  Commands are executed in order and the reply holds, for each
+ * command, a header with the reply argument count followed by the reply
+ * arguments.  A command that is not accepted has the FAILED bit set in its
+ * reply header and no reply arguments.  Reply arguments that do not fit in
+ * the reply packet are dropped and the TRUNCATED bit is set.  Commands
+ * after the reply packet fills are not executed, so the reply may have
+ * fewer entries than the batch.  A batch that is malformed is ignored as
+ * a whole.  Batches can not be nested.
+ */
+#define DSBPM_PROTOCOL_CMD_HI_BATCH         0x7000
+# define DSBPM_PROTOCOL_BATCH_ITEM(command,argCount) \
+                                        (((argCount) << 16) | (command))
+# define DSBPM_PROTOCOL_BATCH_ITEM_COMMAND(h)    ((h) & 0xFFFF)
+# define DSBPM_PROTOCOL_BATCH_ITEM_ARG_COUNT(h)  (((h) >> 16) & 0x3FFF)
+# define DSBPM_PROTOCOL_BATCH_ITEM_FAILED        0x80000000
+# define DSBPM_PROTOCOL_BATCH_ITEM_TRUNCATED     0x40000000
+
+/*
+ * Main loop task timing.
+ * STATS reply:
+ *   (task count << 16) | histogram bin count
+ *   processor cycle counter rate (Hz)
+ *   loop budget (us)
+ *   worst offender task index (0xFFFFFFFF if none), task cycles,
+ *   loop pass cycles and microseconds since boot
+ *   loop pass statistics followed by statistics for each task
+ * Each set of statistics is run count, minimum, mean and maximum cycles,
+ * budget overrun count, maximum lateness (us) and the histogram.
+ * Histogram bin 0 counts runs under 1 us, bin i runs under 4^i us and
+ * the last bin all longer runs.
+ * Statistics are cleared after being read.
+ * NAME reply is the NUL-terminated name of task idx.
+ */
+#define DSBPM_PROTOCOL_CMD_HI_SCHEDULER     0x9000
+# define DSBPM_PROTOCOL_CMD_SCHEDULER_LO_STATS       0x0000
+# define DSBPM_PROTOCOL_CMD_SCHEDULER_LO_NAME        0x0080
+
 #endif /* _DS_BPM_PROTOCOL_ */
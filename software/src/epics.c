@@ -16,9 +16,11 @@
 #include "gpio.h"
 #include "mgt.h"
 #include "rfclk.h"
+#include "scheduler.h"
 #include "softwareBuildDate.h"
 #include "sysmon.h"
 #include "sysmon2.h"
+#include "trace.h"
 #include "util.h"
 
 int
@@ -103,6 +105,90 @@ crankRebootStateMachine(int value)
         i = 0;
     }
 }
+/*
+ * Registers that may be written by bulk register commands
+ */
+static const struct {
+    uint16_t first;
+    uint16_t last;
+} writableRegisters[] = {
+    { GPIO_IDX_AUTOTRIM_THRESHOLD,     GPIO_IDX_AUTOTRIM_THRESHOLD     },
+    { GPIO_IDX_ADC_GAIN_FACTOR_0,      GPIO_IDX_ADC_GAIN_FACTOR_3      },
+    { GPIO_IDX_LOSS_OF_BEAM_THRSH,     GPIO_IDX_LOSS_OF_BEAM_THRSH     },
+    { GPIO_IDX_RF_GAIN_FACTOR_0,       GPIO_IDX_PH_GAIN_FACTOR_3       },
+};
+
+static int
+isWritableRegister(uint32_t idx)
+{
+    int i;
+
+    if ((idx < GPIO_IDX_LOTABLE_ADDRESS)
+     || (idx >= (GPIO_IDX_LOTABLE_ADDRESS + (CFG_DSBPM_COUNT * GPIO_IDX_PER_DSBPM))))
+        return 0;
+    idx = GPIO_IDX_LOTABLE_ADDRESS +
+                        ((idx - GPIO_IDX_LOTABLE_ADDRESS) % GPIO_IDX_PER_DSBPM);
+    for (i = 0 ; i < sizeof writableRegisters / sizeof writableRegisters[0] ; i++) {
+        if ((idx >= writableRegisters[i].first)
+         && (idx <= writableRegisters[i].last))
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * Bulk register access
+ */
+static int
+registerCommand(int commandArgCount, struct dsbpmPacket *cmdp,
+                                     struct dsbpmPacket *replyp)
+{
+    int i;
+    uint32_t first, n;
+
+    switch (cmdp->command & DSBPM_PROTOCOL_CMD_MASK_LO) {
+    case DSBPM_PROTOCOL_CMD_REGISTER_LO_READ:
+        if (commandArgCount != 2) return -1;
+        first = cmdp->args[0];
+        n = cmdp->args[1];
+        if ((n > DSBPM_PROTOCOL_ARG_CAPACITY)
+         || (first >= GPIO_IDX_COUNT)
+         || (n > (GPIO_IDX_COUNT - first))) return -1;
+        for (i = 0 ; i < n ; i++)
+            replyp->args[i] = GPIO_READ(first + i);
+        return n;
+
+    case DSBPM_PROTOCOL_CMD_REGISTER_LO_READ_LIST:
+        for (i = 0 ; i < commandArgCount ; i++) {
+            if (cmdp->args[i] >= GPIO_IDX_COUNT) return -1;
+        }
+        for (i = 0 ; i < commandArgCount ; i++)
+            replyp->args[i] = GPIO_READ(cmdp->args[i]);
+        return commandArgCount;
+
+    case DSBPM_PROTOCOL_CMD_REGISTER_LO_WRITE:
+        if (commandArgCount < 1) return -1;
+        first = cmdp->args[0];
+        for (i = 1 ; i < commandArgCount ; i++) {
+            if (!isWritableRegister(first + i - 1)) return -1;
+        }
+        for (i = 1 ; i < commandArgCount ; i++)
+            GPIO_WRITE(first + i - 1, cmdp->args[i]);
+        return 0;
+
+    case DSBPM_PROTOCOL_CMD_REGISTER_LO_WRITE_LIST:
+        if ((commandArgCount % 2) != 0) return -1;
+        for (i = 0 ; i < commandArgCount ; i += 2) {
+            if (!isWritableRegister(cmdp->args[i])) return -1;
+        }
+        for (i = 0 ; i < commandArgCount ; i += 2)
+            GPIO_WRITE(cmdp->args[i], cmdp->args[i+1]);
+        return 0;
+
+    default: return -1;
+    }
+}
+
 /*
  * Process command common to all applictions
  */
@@ -216,6 +302,25 @@ epicsCommonCommand(int commandArgCount, struct dsbpmPacket *cmdp,
         }
         break;
 
+    case DSBPM_PROTOCOL_CMD_HI_REGISTER:
+        replyArgCount = registerCommand(commandArgCount, cmdp, replyp);
+        break;
+
+    case DSBPM_PROTOCOL_CMD_HI_SCHEDULER:
+        if (commandArgCount != 0) return -1;
+        switch (lo) {
+        case DSBPM_PROTOCOL_CMD_SCHEDULER_LO_STATS:
+            replyArgCount = schedulerFetch(replyp->args);
+            break;
+
+        case DSBPM_PROTOCOL_CMD_SCHEDULER_LO_NAME:
+            replyArgCount = schedulerFetchName(idx, replyp->args);
+            break;
+
+        default: return -1;
+        }
+        break;
+
     case DSBPM_PROTOCOL_CMD_HI_OCTET:
         if (commandArgCount != 0) return -1;
         switch (idx) {
@@ -258,6 +363,78 @@ epicsCommonCommand(int commandArgCount, struct dsbpmPacket *cmdp,
     return replyArgCount;
 }
 
+/*
+ * Process a single command
+ */
+static int
+epicsCommand(int commandArgCount, struct dsbpmPacket *cmdp,
+                                  struct dsbpmPacket *replyp)
+{
+    int replyArgCount;
+
+    if ((replyArgCount = epicsApplicationCommand(commandArgCount,
+                                                      cmdp, replyp)) < 0) {
+        replyArgCount = epicsCommonCommand(commandArgCount, cmdp, replyp);
+    }
+    return replyArgCount;
+}
+
+/*
+ * Process a list of commands
+ */
+static int
+epicsBatchCommand(int commandArgCount, struct dsbpmPacket *cmdp,
+                                       struct dsbpmPacket *replyp)
+{
+    int i, n;
+    int replyArgCount = 0;
+    static struct dsbpmPacket itemCommand, itemReply;
+
+    /*
+     * Reject the whole batch unless every item is well formed
+     */
+    for (i = 0 ; i < commandArgCount ; i += n + 1) {
+        uint32_t h = cmdp->args[i];
+        n = DSBPM_PROTOCOL_BATCH_ITEM_ARG_COUNT(h);
+        if (((DSBPM_PROTOCOL_BATCH_ITEM_COMMAND(h) & DSBPM_PROTOCOL_CMD_MASK_HI)
+                                                == DSBPM_PROTOCOL_CMD_HI_BATCH)
+         || ((i + 1 + n) > commandArgCount)) {
+            return -1;
+        }
+    }
+    memcpy(&itemCommand, cmdp, DSBPM_PROTOCOL_ARG_COUNT_TO_SIZE(0));
+    for (i = 0 ; i < commandArgCount ; i += n + 1) {
+        uint32_t h = cmdp->args[i];
+        int itemReplyArgCount;
+        if (replyArgCount == DSBPM_PROTOCOL_ARG_CAPACITY) {
+            break;
+        }
+        n = DSBPM_PROTOCOL_BATCH_ITEM_ARG_COUNT(h);
+        itemCommand.command = DSBPM_PROTOCOL_BATCH_ITEM_COMMAND(h);
+        memcpy(itemCommand.args, &cmdp->args[i+1], n * sizeof(uint32_t));
+        memcpy(&itemReply, &itemCommand, DSBPM_PROTOCOL_ARG_COUNT_TO_SIZE(0));
+        itemReplyArgCount = epicsCommand(n, &itemCommand, &itemReply);
+        if (itemReplyArgCount < 0) {
+            replyp->args[replyArgCount++] = DSBPM_PROTOCOL_BATCH_ITEM_FAILED |
+                                                  itemCommand.command;
+        }
+        else {
+            uint32_t flags = 0;
+            int room = DSBPM_PROTOCOL_ARG_CAPACITY - replyArgCount - 1;
+            if (itemReplyArgCount > room) {
+                itemReplyArgCount = room;
+                flags = DSBPM_PROTOCOL_BATCH_ITEM_TRUNCATED;
+            }
+            replyp->args[replyArgCount++] = flags |
+                   DSBPM_PROTOCOL_BATCH_ITEM(itemCommand.command, itemReplyArgCount);
+            memcpy(&replyp->args[replyArgCount], itemReply.args,
+                                        itemReplyArgCount * sizeof(uint32_t));
+            replyArgCount += itemReplyArgCount;
+        }
+    }
+    return replyArgCount;
+}
+
 /*
  * Handle commands from IOC
  */
@@ -272,14 +449,7 @@ epics_callback(void *arg, struct udp_pcb *pcb, struct pbuf *p,
     static int replySize;
     static uint32_t lastNonce;
 
-    if (debugFlags & DEBUGFLAG_EPICS) {
-        printf("epics_callback: %d from %d.%d.%d.%d:%d\n", p->len,
-                                                    (int)((addr >> 24) & 0xFF),
-                                                    (int)((addr >> 16) & 0xFF),
-                                                    (int)((addr >>  8) & 0xFF),
-                                                    (int)((addr      ) & 0xFF),
-                                                    fromPort);
-    }
+    TRACE(DEBUGFLAG_EPICS, TRACE_EV_EPICS_RX, p->len, addr, fromPort);
 
     /*
      * Ignore weird-sized packets
@@ -287,10 +457,8 @@ epics_callback(void *arg, struct udp_pcb *pcb, struct pbuf *p,
     if ((p->len < DSBPM_PROTOCOL_ARG_COUNT_TO_SIZE(0))
      || (p->len > sizeof command)
      || ((p->len % sizeof(uint32_t)) != 0)) {
+        TRACE(DEBUGFLAG_EPICS, TRACE_EV_EPICS_BAD_SIZE, p->len, 0, 0);
         pbuf_free(p);
-        if (debugFlags & DEBUGFLAG_EPICS) {
-            printf("Unreasonable packet size\n");
-        }
         return;
     }
     commandArgCount = DSBPM_PROTOCOL_SIZE_TO_ARG_COUNT(p->len);
@@ -312,17 +480,21 @@ epics_callback(void *arg, struct udp_pcb *pcb, struct pbuf *p,
         bswap32(&command.magic, p->len / sizeof(int32_t));
     }
     if (command.magic == DSBPM_PROTOCOL_MAGIC) {
-        if (debugFlags & DEBUGFLAG_EPICS) {
-            printf("Command:%X args:%d  %x\n", (unsigned int)command.command,
-                               commandArgCount, (unsigned int)command.args[0]);
-        }
+        TRACE(DEBUGFLAG_EPICS, TRACE_EV_EPICS_COMMAND, command.command,
+                                          commandArgCount, command.args[0]);
         if (command.nonce != lastNonce) {
             int replyArgCount;
             memcpy(&reply, &command, DSBPM_PROTOCOL_ARG_COUNT_TO_SIZE(0));
-            if (((replyArgCount = epicsApplicationCommand(commandArgCount,
-                                                      &command, &reply)) < 0)
-             && ((replyArgCount = epicsCommonCommand(commandArgCount,
-                                                      &command, &reply)) < 0)) {
+            if ((command.command & DSBPM_PROTOCOL_CMD_MASK_HI) ==
+                                                DSBPM_PROTOCOL_CMD_HI_BATCH) {
+                replyArgCount = epicsBatchCommand(commandArgCount,
+                                                      &command, &reply);
+            }
+            else {
+                replyArgCount = epicsCommand(commandArgCount,
+                                                      &command, &reply);
+            }
+            if (replyArgCount < 0) {
                 return;
             }
             lastNonce = command.nonce;
@@ -331,15 +503,11 @@ epics_callback(void *arg, struct udp_pcb *pcb, struct pbuf *p,
                 bswap32(&reply.magic, replySize / sizeof(int32_t));
             }
         }
-        if (debugFlags & DEBUGFLAG_EPICS) {
-            printf("Reply:%d\n", replySize);
-        }
+        TRACE(DEBUGFLAG_EPICS, TRACE_EV_EPICS_REPLY, replySize, 0, 0);
         sendReply(pcb, &reply, replySize, fromAddr, fromPort);
     }
     else {
-        if (debugFlags & DEBUGFLAG_EPICS) {
-            printf("Bad magic number 0x%08X\n", command.magic);
-        }
+        TRACE(DEBUGFLAG_EPICS, TRACE_EV_EPICS_BAD_MAGIC, command.magic, 0, 0);
     }
 }
 
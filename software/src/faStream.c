@@ -0,0 +1,190 @@
+/*
+ * Stream fast acquisition positions
+ */
+#include <stdio.h>
+#include <string.h>
+#include <lwip/udp.h>
+#include "dsbpmProtocol.h"
+#include "faStream.h"
+#include "gpio.h"
+#include "serdes.h"
+#include "util.h"
+
+#define CSR_RUN                 0x80000000
+#define CSR_ADDR_WIDTH_MASK     0x0F000000
+#define CSR_ADDR_WIDTH_SHIFT    24
+#define CSR_ROW_COUNT_MASK      0x00FFFFFF
+
+#define ROW_WORD_COUNT  (2 + (CFG_DSBPM_COUNT * 4))
+
+/*
+ * Skip ahead when the reader falls this close to being overwritten
+ */
+#define OVERRUN_MARGIN  16
+
+/*
+ * Limit main loop time spent sending packets
+ */
+#define PACKETS_PER_CRANK   8
+
+#define SUBSCRIPTION_LEASE_US   (10 * 1000000)
+
+static struct udp_pcb *pcb;
+static struct faStreamSubscriber {
+    ip_addr_t    addr;
+    u16_t        port;
+    uint32_t     usAtRenewal;
+    unsigned int samplesPerPacket;
+    uint32_t     rowCount;
+    uint32_t     sequenceNumber;
+    uint32_t     sampleNumber;
+    uint32_t     lostSampleCount;
+    unsigned int dropCount;
+} subscriber;
+
+static uint32_t
+rowCount(void)
+{
+    return GPIO_READ(GPIO_IDX_FA_STREAM_CSR) & CSR_ROW_COUNT_MASK;
+}
+
+static void
+readRow(uint32_t row, struct dsbpmFaStreamSample *sample)
+{
+    int i;
+    uint32_t *dst = (uint32_t *)sample;
+
+    GPIO_WRITE(GPIO_IDX_FA_STREAM_CSR,
+                        CSR_RUN | (row % CFG_FA_STREAM_ROW_CAPACITY));
+    for (i = 0 ; i < ROW_WORD_COUNT ; i++)
+        dst[i] = GPIO_READ(GPIO_IDX_FA_STREAM_DATA_BASE + i);
+}
+
+static void
+faStreamCallback(void *arg, struct udp_pcb *pcb, struct pbuf *p,
+                 const ip_addr_t *fromAddr, u16_t fromPort)
+{
+    struct dsbpmFaStreamRequest req;
+
+    if (p->len == sizeof req) {
+        memcpy(&req, p->payload, sizeof req);
+        if (req.magic == DSBPM_PROTOCOL_MAGIC_FA_STREAM) {
+            if (req.samplesPerPacket == 0) {
+                if ((subscriber.port == fromPort)
+                 && ip_addr_cmp(&subscriber.addr, fromAddr))
+                    subscriber.port = 0;
+            }
+            else {
+                if ((subscriber.port != fromPort)
+                 || !ip_addr_cmp(&subscriber.addr, fromAddr)) {
+                    if (debugFlags & DEBUGFLAG_PUBLISHER)
+                        printf("FA stream to %s:%d\n",
+                                             formatIP(fromAddr, 0), fromPort);
+                    memset(&subscriber, 0, sizeof subscriber);
+                    ip_addr_copy(subscriber.addr, *fromAddr);
+                    subscriber.port = fromPort;
+                    subscriber.rowCount = rowCount();
+                }
+                if (req.samplesPerPacket > DSBPM_PROTOCOL_FA_STREAM_SAMPLE_CAPACITY)
+                    req.samplesPerPacket = DSBPM_PROTOCOL_FA_STREAM_SAMPLE_CAPACITY;
+                subscriber.samplesPerPacket = req.samplesPerPacket;
+                subscriber.usAtRenewal = MICROSECONDS_SINCE_BOOT();
+            }
+        }
+    }
+    pbuf_free(p);
+}
+
+void
+faStreamInit(void)
+{
+    int err;
+
+    GPIO_WRITE(GPIO_IDX_FA_STREAM_CSR, CSR_RUN);
+    pcb = udp_new();
+    if (pcb == NULL) {
+        fatal("Can't create FA stream pcb\n");
+        return;
+    }
+    err = udp_bind(pcb, IP_ADDR_ANY, DSBPM_PROTOCOL_FA_STREAM_UDP_PORT);
+    if (err != ERR_OK) {
+        fatal("Can't bind to FA stream port, error:%d", err);
+        return;
+    }
+    udp_recv(pcb, faStreamCallback, NULL);
+}
+
+/*
+ * Send complete packets
+ */
+void
+faStreamCrank(void)
+{
+    int i, budget;
+    uint32_t available;
+    struct pbuf *p;
+    struct dsbpmFaStream *pk;
+    unsigned int n = subscriber.samplesPerPacket;
+
+    if (subscriber.port == 0)
+        return;
+    if ((MICROSECONDS_SINCE_BOOT() - subscriber.usAtRenewal) >
+                                                     SUBSCRIPTION_LEASE_US) {
+        if (debugFlags & DEBUGFLAG_PUBLISHER)
+            printf("FA stream subscription from %s:%d expired\n",
+                                formatIP(&subscriber.addr, 0), subscriber.port);
+        subscriber.port = 0;
+        return;
+    }
+    for (budget = PACKETS_PER_CRANK ; budget > 0 ; budget--) {
+        available = (rowCount() - subscriber.rowCount) & CSR_ROW_COUNT_MASK;
+        if (available > (CFG_FA_STREAM_ROW_CAPACITY - OVERRUN_MARGIN)) {
+            uint32_t skip = available - (CFG_FA_STREAM_ROW_CAPACITY / 2);
+            subscriber.rowCount += skip;
+            subscriber.sampleNumber += skip;
+            subscriber.lostSampleCount += skip;
+            available -= skip;
+        }
+        if (available < n)
+            return;
+        p = pbuf_alloc(PBUF_TRANSPORT, sizeof *pk -
+                  ((DSBPM_PROTOCOL_FA_STREAM_SAMPLE_CAPACITY - n) *
+                                sizeof(struct dsbpmFaStreamSample)), PBUF_RAM);
+        if (p == NULL) {
+            subscriber.dropCount++;
+            return;
+        }
+        pk = (struct dsbpmFaStream *)p->payload;
+        pk->magic = DSBPM_PROTOCOL_MAGIC_FA_STREAM;
+        pk->sequenceNumber = subscriber.sequenceNumber++;
+        pk->sampleNumber = subscriber.sampleNumber;
+        pk->lostSampleCount = subscriber.lostSampleCount;
+        pk->sampleCount = n;
+        for (i = 0 ; i < n ; i++)
+            readRow(subscriber.rowCount++, &pk->samples[i]);
+        subscriber.sampleNumber += n;
+        if (udp_sendto(pcb, p, &subscriber.addr, subscriber.port) != ERR_OK)
+            subscriber.dropCount++;
+        pbuf_free(p);
+    }
+}
+
+int
+faStreamCommand(int argc, char **argv)
+{
+    uint32_t csr = GPIO_READ(GPIO_IDX_FA_STREAM_CSR);
+
+    printf("FA stream %s, %d rows, row count %u\n",
+                            csr & CSR_RUN ? "running" : "stopped",
+                            1 << ((csr & CSR_ADDR_WIDTH_MASK) >> CSR_ADDR_WIDTH_SHIFT),
+                            (unsigned int)(csr & CSR_ROW_COUNT_MASK));
+    if (subscriber.port)
+        printf("%15s:%-5d %2u samples/packet %10u sent %8u lost samples "
+                                                        "%8u dropped packets\n",
+                              formatIP(&subscriber.addr, 0), subscriber.port,
+                              subscriber.samplesPerPacket,
+                              (unsigned int)subscriber.sequenceNumber,
+                              (unsigned int)subscriber.lostSampleCount,
+                              subscriber.dropCount);
+    return 0;
+}
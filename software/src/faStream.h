@@ -0,0 +1,12 @@
+/*
+ * Stream fast acquisition positions
+ */
+
+#ifndef _FA_STREAM_H_
+#define _FA_STREAM_H_
+
+void faStreamInit(void);
+void faStreamCrank(void);
+int faStreamCommand(int argc, char **argv);
+
+#endif
@@ -32,6 +32,15 @@
 #define NOBANK_RUN_BIT         0x1
 #define NOBANK_SINGLE_PASS_BIT 0x2
 #define NOBANK_DSP_USE_RMS_BIT 0x4
+#define NOBANK_RF_SWAP_BIT     0x100
+#define NOBANK_PT_SWAP_BIT     0x200
+#define NOBANK_RF_SWAP_PENDING 0x1000
+#define NOBANK_PT_SWAP_PENDING 0x2000
+
+/*
+ * Bank swaps take place at the end of a table pass
+ */
+#define SWAP_TIMEOUT_US     100000
 /* Synchronous demodulation synchronization status */
 #define NOBANK_SD_STATUS_SHIFT 4
 #define NOBANK_SD_STATUS_MASK  (0x3 << NOBANK_SD_STATUS_SHIFT)
@@ -82,6 +91,25 @@
 
 #define MAX_TABLE_BUF_SIZE      ((4*9 + 3 + 1)*CFG_LO_PT_ROW_CAPACITY+1)
 
+/*
+ * Binary table file
+ * Header followed by rowCount rows of columnCount little-endian
+ * 32 bit values, scaled as written to the FPGA.  The CRC is the
+ * IEEE 802.3 CRC-32 (as used by zlib) of the row values.
+ * Loads with a single read into the staging buffer and no parsing.
+ */
+#define LO_TABLE_BINARY_MAGIC   0x4254414C  /* "LATB" */
+#define LO_TABLE_BINARY_VERSION 1
+#define RF_TABLE_BINARY_TEMP_NAME "rfTable.tmp"
+#define PT_TABLE_BINARY_TEMP_NAME "ptTable.tmp"
+struct loTableBinaryHeader {
+    uint32_t    magic;
+    uint16_t    version;
+    uint16_t    columnCount;
+    uint32_t    rowCount;
+    uint32_t    crc32;
+};
+
 static int32_t rfTable[RF_TABLE_BUF_SIZE];
 static int32_t ptTable[PT_TABLE_BUF_SIZE];
 
@@ -104,19 +132,53 @@ checkSum(const int32_t *ip, int rowCount, int colCount)
     return sum;
 }
 
+/*
+ * Form CRC-32 of binary table
+ */
+static uint32_t
+crc32(const void *buf, size_t n)
+{
+    static uint32_t crcTable[256];
+    const unsigned char *cp = buf;
+    uint32_t crc = 0xFFFFFFFF;
+
+    if (crcTable[1] == 0) {
+        int i, b;
+        for (i = 0 ; i < 256 ; i++) {
+            uint32_t c = i;
+            for (b = 0 ; b < 8 ; b++) {
+                c = (c & 1) ? (c >> 1) ^ 0xEDB88320 : (c >> 1);
+            }
+            crcTable[i] = c;
+        }
+    }
+    while (n--) {
+        crc = crcTable[(crc ^ *cp++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
 /*
  * Write to local osciallator RAM
+ * The FPGA advances the write address after each value so a bank
+ * is loaded by writing its start address once and then streaming
+ * the (cos, sin) pairs for each row in turn.
  */
 static void
-writeTable(unsigned int bpm, int bankIndex, int row, int isSin, int value)
+writeTable(unsigned int bpm, int bankIndex, const int32_t *src, int rowCount,
+           int colCount)
 {
-    uint32_t address = (row << 1) | (isSin != 0);
-    uint32_t csr = (bankIndex << BANKSELECT_SHIFT) | (value & VALUE_MASK);
+    int r;
+    uint32_t bank = bankIndex << BANKSELECT_SHIFT;
 
     if (bpm >= CFG_DSBPM_COUNT) return;
 
-    GPIO_WRITE(REG(GPIO_IDX_LOTABLE_ADDRESS, bpm), address);
-    GPIO_WRITE(REG(GPIO_IDX_LOTABLE_CSR, bpm), csr);
+    GPIO_WRITE(REG(GPIO_IDX_LOTABLE_ADDRESS, bpm), 0);
+    for (r = 0 ; r < rowCount ; r++) {
+        GPIO_WRITE(REG(GPIO_IDX_LOTABLE_CSR, bpm), bank | (src[0] & VALUE_MASK));
+        GPIO_WRITE(REG(GPIO_IDX_LOTABLE_CSR, bpm), bank | (src[1] & VALUE_MASK));
+        src += colCount;
+    }
 }
 
 /*
@@ -390,54 +452,126 @@ isLocalOscRun(unsigned int bpm)
 }
 
 /*
- * Commit table to FPGA
+ * Wait for previous bank swap to complete
  */
-static void
-localOscWrite(unsigned int bpm, int32_t *dst, const int32_t *src, int capacity,
-        int isPt)
+static int
+localOscSwapWait(unsigned int bpm, int isPt)
 {
-    int r, c, rowCount;
+    uint32_t usAtStart = MICROSECONDS_SINCE_BOOT();
+
+    while (localOscSwapPending(bpm, isPt)) {
+        if ((MICROSECONDS_SINCE_BOOT() - usAtStart) > SWAP_TIMEOUT_US) {
+            printf("LocalOsc: %s table %u bank swap timed out\n",
+                                                    isPt ? "PT" : "RF", bpm);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Write table to FPGA shadow bank
+ */
+static int
+localOscStageTable(unsigned int bpm, const int32_t *src, int capacity, int isPt)
+{
+    int rowCount;
     size_t hdrSizeWords = 2; // Row count and checksum
     int colCount = isPt ? 4 : 2;
-    // FIXME...
-    static int goodTables[CFG_DSBPM_COUNT] = { 0 };
+    uint32_t usAtStart;
 
     rowCount = src[0];
-    if ((rowCount >= 29)
-     && (rowCount < capacity)
-     && (src[1] == checkSum(src, rowCount, colCount))) {
-        goodTables[bpm]++;
-        if (dst) {
-            memcpy(dst, src, hdrSizeWords*sizeof(*src));
-            dst+=hdrSizeWords;
-        }
-        src+=hdrSizeWords;
-
-        for (r = 0 ; r < rowCount ; r++) {
-            for (c = 0 ; c < colCount ; c++) {
-                int bankIndex;
-                if (isPt) {
-                    if (c < 2)
-                        bankIndex = BANKINDEX_PT_LO;
-                    else
-                        bankIndex = BANKINDEX_PT_HI;
-                }
-                else {
-                    bankIndex = BANKINDEX_RF;
-                }
-                writeTable(bpm, bankIndex, r, c & 0x1, *src);
+    if ((rowCount < 29)
+     || (rowCount >= capacity)
+     || (src[1] != checkSum(src, rowCount, colCount))) {
+        printf("LocalOsc: CORRUPT LOCAL OSCILLATOR TABLE\n");
+        return -1;
+    }
+    if (localOscSwapWait(bpm, isPt) < 0) {
+        return -1;
+    }
+    usAtStart = MICROSECONDS_SINCE_BOOT();
+    src+=hdrSizeWords;
 
-                if(dst) *dst++ = *src;
-                src++;
-            }
-        }
+    if (isPt) {
+        writeTable(bpm, BANKINDEX_PT_LO, src, rowCount, colCount);
+        writeTable(bpm, BANKINDEX_PT_HI, src + 2, rowCount, colCount);
     }
     else {
-        printf("LocalOsc: CORRUPT LOCAL OSCILLATOR TABLE\n");
+        writeTable(bpm, BANKINDEX_RF, src, rowCount, colCount);
+    }
+    if (debugFlags & DEBUGFLAG_LOCAL_OSC_SHOW)
+        printf("LocalOsc: %s table %u commit %u us\n", isPt ? "PT" : "RF",
+                bpm, (unsigned int)(MICROSECONDS_SINCE_BOOT() - usAtStart));
+    return 0;
+}
+
+/*
+ * Stage then commit
+ * The table in use by the demodulators is never modified so
+ * tables can be replaced while the local oscillators are running.
+ */
+int
+localOscStage(unsigned int bpm, int isPt)
+{
+    int32_t *src = isPt ? ptTable : rfTable;
+    int capacity = isPt ? CFG_LO_PT_ROW_CAPACITY : CFG_LO_RF_ROW_CAPACITY;
+
+    if (bpm >= CFG_DSBPM_COUNT) return -1;
+
+    return localOscStageTable(bpm, src, capacity, isPt);
+}
+
+/*
+ * Make shadow bank active at end of current table pass
+ */
+void
+localOscSwap(unsigned int bpm, int isPt)
+{
+    uint32_t bit = isPt ? NOBANK_PT_SWAP_BIT : NOBANK_RF_SWAP_BIT;
+
+    if (bpm >= CFG_DSBPM_COUNT) return;
+
+    writeCSR(bpm, bit, bit);
+}
+
+int
+localOscSwapPending(unsigned int bpm, int isPt)
+{
+    uint32_t bit = isPt ? NOBANK_PT_SWAP_PENDING : NOBANK_RF_SWAP_PENDING;
+
+    if (bpm >= CFG_DSBPM_COUNT) return 0;
+
+    return (GPIO_READ(REG(GPIO_IDX_LOTABLE_CSR, bpm)) & bit) != 0;
+}
+
+/*
+ * Commit table to FPGA
+ */
+static void
+localOscWrite(unsigned int bpm, const int32_t *src, int capacity, int isPt)
+{
+    // FIXME...
+    static int goodTables[CFG_DSBPM_COUNT] = { 0 };
+
+    if (bpm >= CFG_DSBPM_COUNT) return;
+
+    if (localOscStageTable(bpm, src, capacity, isPt) == 0) {
+        goodTables[bpm]++;
+        localOscSwap(bpm, isPt);
+
+        /*
+         * The FA CIC shift must match the pilot tone table in use, so
+         * change it only once the new table has been swapped in.  A
+         * swap that times out will still happen, so set it regardless.
+         */
+        if (isPt) {
+            localOscSwapWait(bpm, isPt);
+            optimizeCicShift(bpm, src[0]);
+        }
     }
 
     if (goodTables[bpm] == 2) localOscRun(bpm);
-    if (isPt) optimizeCicShift(bpm, rowCount);
 }
 
 
@@ -451,7 +585,7 @@ localOscCommit(unsigned int bpm, int isPt)
     int32_t *src = isPt ? ptTable : rfTable;
     int capacity = isPt ? CFG_LO_PT_ROW_CAPACITY : CFG_LO_RF_ROW_CAPACITY;
 
-    localOscWrite(bpm, NULL, src, capacity, isPt);
+    localOscWrite(bpm, src, capacity, isPt);
 }
 
 void
@@ -532,7 +666,7 @@ void localOscillatorInit(unsigned int bpm)
 /*
  * EEPROM I/O
  */
-static unsigned char tableBuf[MAX_TABLE_BUF_SIZE];
+static unsigned char tableBuf[MAX_TABLE_BUF_SIZE] __attribute__((aligned(8)));
 
 int
 localOscillatorFetchEEPROM(int isPt)
@@ -620,6 +754,12 @@ localOscillatorStashEEPROM(int isPt)
     nWrite = localOscSetTable((unsigned char *)tableBuf, nRead, isPt);
     f_close(&fil);
 
+    /*
+     * Keep binary copy up to date for fast loading at startup
+     */
+    if ((nWrite > 0) && (localOscillatorFetchBinaryEEPROM(isPt) < 0)) {
+        printf("LocalOsc: %s local oscillator binary file write failed\n", isPt? "PT" : "RF");
+    }
     return nWrite;
 }
 
@@ -634,3 +774,215 @@ localOscillatorStashPtEEPROM(void)
 {
     return localOscillatorStashEEPROM(1);
 }
+
+/*
+ * Copy Local Oscillator table to binary file
+ * Write a temporary file and rename it over the old one only once it
+ * is complete.  On failure remove the old binary file too, since it no
+ * longer matches the ASCII file, so startup falls back to the latter.
+ */
+int
+localOscillatorFetchBinaryEEPROM(int isPt)
+{
+    const char *name = isPt ? "/"PT_TABLE_BINARY_NAME : "/"RF_TABLE_BINARY_NAME;
+    const char *tmpName = isPt ? "/"PT_TABLE_BINARY_TEMP_NAME :
+                                 "/"RF_TABLE_BINARY_TEMP_NAME;
+    int colCount = isPt ? 4 : 2;
+    int capacity = isPt ? CFG_LO_PT_ROW_CAPACITY : CFG_LO_RF_ROW_CAPACITY;
+    int32_t *table = isPt ? ptTable : rfTable;
+    struct loTableBinaryHeader header;
+    UINT nBytes, nWritten;
+    FRESULT fr;
+    FIL fil;
+
+    if ((table[0] <= 0) || (table[0] >= capacity)) {
+        printf("LocalOsc: %s local oscillator table empty\n", isPt? "PT" : "RF");
+        f_unlink(name);
+        return -1;
+    }
+    nBytes = table[0] * colCount * sizeof(*table);
+    header.magic = LO_TABLE_BINARY_MAGIC;
+    header.version = LO_TABLE_BINARY_VERSION;
+    header.columnCount = colCount;
+    header.rowCount = table[0];
+    header.crc32 = crc32(&table[2], nBytes);
+
+    fr = f_open(&fil, tmpName, FA_WRITE | FA_CREATE_ALWAYS);
+    if (fr != FR_OK) {
+        f_unlink(name);
+        return -1;
+    }
+    fr = f_write(&fil, &header, sizeof header, &nWritten);
+    if ((fr == FR_OK) && (nWritten == sizeof header)) {
+        fr = f_write(&fil, &table[2], nBytes, &nWritten);
+        if ((fr == FR_OK) && (nWritten != nBytes)) {
+            fr = FR_DISK_ERR;
+        }
+    }
+    else if (fr == FR_OK) {
+        fr = FR_DISK_ERR;
+    }
+    if (f_close(&fil) != FR_OK) {
+        fr = FR_DISK_ERR;
+    }
+    if (fr == FR_OK) {
+        /*
+         * FatFs will not rename over an existing file
+         */
+        fr = f_unlink(name);
+        if ((fr == FR_OK) || (fr == FR_NO_FILE)) {
+            fr = f_rename(tmpName, name);
+        }
+    }
+    if (fr != FR_OK) {
+        f_unlink(tmpName);
+        f_unlink(name);
+        return -1;
+    }
+    return sizeof header + nBytes;
+}
+
+int
+localOscillatorFetchRfBinaryEEPROM(void)
+{
+    return localOscillatorFetchBinaryEEPROM(0);
+}
+
+int
+localOscillatorFetchPtBinaryEEPROM(void)
+{
+    return localOscillatorFetchBinaryEEPROM(1);
+}
+
+/*
+ * Copy binary file to Local Oscillator table
+ * The file is read into the staging buffer and checked completely
+ * before any of it is copied to the table, so a bad file leaves the
+ * table unchanged.
+ */
+static int
+stashBinary(int isPt)
+{
+    const char *name = isPt ? "/"PT_TABLE_BINARY_NAME : "/"RF_TABLE_BINARY_NAME;
+    int colCount = isPt ? 4 : 2;
+    int capacity = isPt ? CFG_LO_PT_ROW_CAPACITY : CFG_LO_RF_ROW_CAPACITY;
+    int32_t *table = isPt ? ptTable : rfTable;
+    int32_t *rows = (int32_t *)tableBuf;
+    struct loTableBinaryHeader header;
+    UINT i, nBytes, nRead;
+    FRESULT fr;
+    FIL fil;
+
+    fr = f_open(&fil, name, FA_READ);
+    if (fr != FR_OK) {
+        return -1;
+    }
+    fr = f_read(&fil, &header, sizeof header, &nRead);
+    if ((fr != FR_OK) || (nRead != sizeof header)
+     || (header.magic != LO_TABLE_BINARY_MAGIC)
+     || (header.version != LO_TABLE_BINARY_VERSION)
+     || (header.columnCount != colCount)
+     || (header.rowCount < 29)
+     || (header.rowCount >= capacity)) {
+        printf("LocalOsc: %s local oscillator binary file has bad header\n", isPt? "PT" : "RF");
+        f_close(&fil);
+        return -1;
+    }
+    nBytes = header.rowCount * colCount * sizeof(*table);
+    fr = f_read(&fil, rows, nBytes, &nRead);
+    f_close(&fil);
+    if ((fr != FR_OK) || (nRead != nBytes)
+     || (crc32(rows, nBytes) != header.crc32)) {
+        printf("LocalOsc: %s local oscillator binary file corrupt\n", isPt? "PT" : "RF");
+        return -1;
+    }
+
+    /*
+     * Same limits as ASCII file values
+     */
+    for (i = 0 ; i < header.rowCount * colCount ; i++) {
+        if ((rows[i] > 0x1FFFF) || (rows[i] < -0x1FFFF)) {
+            printf("LocalOsc: %s local oscillator binary file value out of range at row %u\n",
+                                     isPt? "PT" : "RF", (unsigned int)(i / colCount) + 1);
+            return -1;
+        }
+    }
+    memcpy(&table[2], rows, nBytes);
+    table[0] = header.rowCount;
+    table[1] = checkSum(&table[0], header.rowCount, colCount);
+    return sizeof header + nBytes;
+}
+
+static void
+showLoadTime(int isPt, const char *format, uint32_t usAtStart)
+{
+    printf("LocalOsc: %s local oscillator %s table loaded in %u us\n",
+                                isPt? "PT" : "RF", format,
+                                (unsigned int)(MICROSECONDS_SINCE_BOOT() - usAtStart));
+}
+
+/*
+ * Binary file upload
+ * Report a bad file to the client rather than quietly loading the
+ * ASCII file in its place.
+ */
+int
+localOscillatorStashBinaryEEPROM(int isPt)
+{
+    uint32_t usAtStart = MICROSECONDS_SINCE_BOOT();
+    int n;
+
+    n = stashBinary(isPt);
+    if (n > 0) {
+        showLoadTime(isPt, "binary", usAtStart);
+    }
+    return n;
+}
+
+int
+localOscillatorStashRfBinaryEEPROM(void)
+{
+    return localOscillatorStashBinaryEEPROM(0);
+}
+
+int
+localOscillatorStashPtBinaryEEPROM(void)
+{
+    return localOscillatorStashBinaryEEPROM(1);
+}
+
+/*
+ * Startup readback
+ * Load table from binary file if possible, otherwise from the ASCII
+ * file.  The latter also rewrites the binary file, so later startups
+ * take the fast path.
+ */
+int
+localOscillatorReadbackBinaryEEPROM(int isPt)
+{
+    uint32_t usAtStart = MICROSECONDS_SINCE_BOOT();
+    int n;
+
+    n = stashBinary(isPt);
+    if (n > 0) {
+        showLoadTime(isPt, "binary", usAtStart);
+        return n;
+    }
+    n = localOscillatorStashEEPROM(isPt);
+    if (n > 0) {
+        showLoadTime(isPt, "ASCII", usAtStart);
+    }
+    return n;
+}
+
+int
+localOscillatorReadbackRfBinaryEEPROM(void)
+{
+    return localOscillatorReadbackBinaryEEPROM(0);
+}
+
+int
+localOscillatorReadbackPtBinaryEEPROM(void)
+{
+    return localOscillatorReadbackBinaryEEPROM(1);
+}
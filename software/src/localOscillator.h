@@ -7,6 +7,8 @@
 
 #define RF_TABLE_EEPROM_NAME "rfTable.csv"
 #define PT_TABLE_EEPROM_NAME "ptTable.csv"
+#define RF_TABLE_BINARY_NAME "rfTable.bin"
+#define PT_TABLE_BINARY_NAME "ptTable.bin"
 
 int localOscGetRfTable(unsigned char *buf, int capacity);
 int localOscSetRfTable(unsigned char *buf, int size);
@@ -16,6 +18,9 @@ void localOscRfCommit(unsigned int bpm);
 void localOscPtCommit(unsigned int bpm);
 void localOscRfCommitAll(void);
 void localOscPtCommitAll(void);
+int localOscStage(unsigned int bpm, int isPt);
+void localOscSwap(unsigned int bpm, int isPt);
+int localOscSwapPending(unsigned int bpm, int isPt);
 int localOscGetDspAlgorithm(unsigned int bpm);
 void localOscSetDspAlgorithm(unsigned int bpm, int useRMS);
 int localOscGetSdSyncStatus(unsigned int bpm);
@@ -32,5 +37,14 @@ int localOscillatorFetchPtEEPROM(void);
 int localOscillatorStashEEPROM(int isPt);
 int localOscillatorStashRfEEPROM(void);
 int localOscillatorStashPtEEPROM(void);
+int localOscillatorFetchBinaryEEPROM(int isPt);
+int localOscillatorFetchRfBinaryEEPROM(void);
+int localOscillatorFetchPtBinaryEEPROM(void);
+int localOscillatorStashBinaryEEPROM(int isPt);
+int localOscillatorStashRfBinaryEEPROM(void);
+int localOscillatorStashPtBinaryEEPROM(void);
+int localOscillatorReadbackBinaryEEPROM(int isPt);
+int localOscillatorReadbackRfBinaryEEPROM(void);
+int localOscillatorReadbackPtBinaryEEPROM(void);
 
 #endif
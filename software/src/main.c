@@ -14,6 +14,7 @@
 #include "epics.h"
 #include "evr.h"
 #include "evrSROC.h"
+#include "faStream.h"
 #include "eyescan.h"
 #include "ffs.h"
 #include "gpio.h"
@@ -21,6 +22,7 @@
 #include "idtClk.h"
 #include "mgt.h"
 #include "mmcm.h"
+#include "netRx.h"
 #include "platform.h"
 #include "rfdc.h"
 #include "rfclk.h"
@@ -37,6 +39,7 @@
 #include "autotrim.h"
 #include "acqSync.h"
 #include "publisher.h"
+#include "scheduler.h"
 #include "positionCalc.h"
 #include "waveformRecorder.h"
 #include "cellComm.h"
@@ -78,6 +81,12 @@ static void sfpChk(void)
     }
 }
 
+static void
+mgtAlignCrank(void)
+{
+    mgtCrankRxAligner();
+}
+
 #if LWIP_DHCP==1
 extern volatile int dhcp_timoutcntr;
 err_t dhcp_start(struct netif *netif);
@@ -208,6 +217,7 @@ main(void)
     }
     netif_set_default(&netif);
     netif_set_up(&netif);
+    netRxInit(&netif);
 
     /*
      * Try to request IP from DHCP. Could fail if timeout.
@@ -244,6 +254,7 @@ main(void)
     epicsInit();
     tftpInit();
     publisherInit();
+    faStreamInit();
     acqSyncInit();
     evrSROCInit();
 
@@ -262,18 +273,25 @@ main(void)
     if (displayGetMode() == DISPLAY_MODE_STARTUP) {
         displaySetMode(DISPLAY_MODE_PAGES);
     }
-    for (;;) {
-        checkForReset();
-        mgtCrankRxAligner();
-        cellCommCrank();
-        amiCrank();
-        rpbCrank();
-        xemacif_input(&netif);
-        publisherCheck();
-        consoleCheck();
-        ffsCheck();
-        displayUpdate();
-    }
+    /*
+     * Network reception, the packet producers and the MGT and cell
+     * communication state machines, which have microsecond timeouts,
+     * run on every pass.  Everything else runs in priority order.
+     * Periods and budgets are in microseconds.
+     */
+    schedulerAddTask("network",   netRxCrank,         0,      0,   500);
+    schedulerAddTask("publisher", publisherCheck,     0,      0,   100);
+    schedulerAddTask("faStream",  faStreamCrank,      0,      0,   200);
+    schedulerAddTask("mgtAlign",  mgtAlignCrank,      0,      0,    50);
+    schedulerAddTask("cellComm",  cellCommCrank,      0,      0,    50);
+    schedulerAddTask("reset",     checkForReset,      1,  10000,    20);
+    schedulerAddTask("console",   consoleCheck,       2,   1000,  1000);
+    schedulerAddTask("ami",       amiCrank,           3,  10000,  5000);
+    schedulerAddTask("rpb",       rpbCrank,           3,  10000,  5000);
+    schedulerAddTask("display",   displayUpdate,      4,  20000, 10000);
+    schedulerAddTask("ffs",       ffsCheck,           5, 100000, 20000);
+    consoleStartBufferedOutput();
+    schedulerRun();
 
     /* Never reached */
     cleanup_platform();
@@ -0,0 +1,90 @@
+/*
+ * Network reception
+ *
+ * The GEM receive interrupt handler moves each received frame into a
+ * pbuf and appends it to the adapter receive queue.  The queue is a
+ * single producer (interrupt handler), single consumer (main loop)
+ * ring so frames are not lost while the main loop is busy, but the
+ * adapter hands only one frame to lwIP per call.  Drain the queue in
+ * bounded batches so that a backlog built up during a slow task is
+ * cleared promptly, and keep statistics on queue depth and drops.
+ */
+#include <stdio.h>
+#include <lwip/stats.h>
+#include <netif/xadapter.h>
+#include <netif/xemacpsif.h>
+#include <netif/xpqueue.h>
+#include <xemacps_hw.h>
+#include <xparameters.h>
+#include "netRx.h"
+#include "util.h"
+
+/*
+ * Limit main loop time spent processing received packets
+ */
+#define PACKETS_PER_CRANK   32
+
+static struct netif *rxNetif;
+static pq_queue_t *recvQueue;
+
+static struct netRxStats {
+    unsigned int cranks;
+    unsigned int packets;
+    unsigned int fullCranks;
+    unsigned int maxDepth;
+    unsigned int rxOverruns;
+    unsigned int rxResourceErrors;
+} stats;
+
+void
+netRxInit(struct netif *netif)
+{
+    struct xemac_s *xemac = netif->state;
+    xemacpsif_s *xemacpsif = xemac->state;
+
+    rxNetif = netif;
+    recvQueue = xemacpsif->recv_q;
+}
+
+void
+netRxCrank(void)
+{
+    int n = 0;
+    unsigned int depth = pq_qlength(recvQueue);
+
+    if (depth > stats.maxDepth)
+        stats.maxDepth = depth;
+    while ((n < PACKETS_PER_CRANK) && xemacif_input(rxNetif))
+        n++;
+    stats.cranks++;
+    stats.packets += n;
+    if (n == PACKETS_PER_CRANK)
+        stats.fullCranks++;
+}
+
+int
+netRxCommand(int argc, char **argv)
+{
+    unsigned int drops = 0;
+
+    /* Hardware counters clear on read */
+    stats.rxOverruns += XEmacPs_ReadReg(XPAR_XEMACPS_0_BASEADDR,
+                                        XEMACPS_RXORCNT_OFFSET);
+    stats.rxResourceErrors += XEmacPs_ReadReg(XPAR_XEMACPS_0_BASEADDR,
+                                              XEMACPS_RXRESERRCNT_OFFSET);
+#if LINK_STATS
+    drops = lwip_stats.link.drop;
+#endif
+    printf("Receive queue depth %d, max %u, capacity %d\n",
+                          pq_qlength(recvQueue), stats.maxDepth, PQ_QUEUE_SIZE);
+    printf("%u packets in %u cranks, %u cranks hit the %d packet limit\n",
+                  stats.packets, stats.cranks, stats.fullCranks,
+                  PACKETS_PER_CRANK);
+    printf("GEM receive overruns %u, no descriptor %u, link drops %u\n",
+                  stats.rxOverruns, stats.rxResourceErrors, drops);
+    stats.cranks = 0;
+    stats.packets = 0;
+    stats.fullCranks = 0;
+    stats.maxDepth = 0;
+    return 0;
+}
@@ -0,0 +1,14 @@
+/*
+ * Network reception
+ */
+
+#ifndef _NET_RX_H_
+#define _NET_RX_H_
+
+#include <lwip/netif.h>
+
+void netRxInit(struct netif *netif);
+void netRxCrank(void);
+int netRxCommand(int argc, char **argv);
+
+#endif
@@ -78,18 +78,22 @@ checkSum(const int32_t *ip, int rowCount, int colCount)
 }
 
 /*
- * Write to local osciallator RAM
+ * Write to DAC table RAM
+ * The FPGA advances the write address after each value so the table
+ * is loaded by writing its start address once and then streaming
+ * the (I, Q) pairs for each row in turn.
  */
 static void
-writeTable(unsigned int bpm, int bankIndex, int row, int isSin, int value)
+writeTable(unsigned int bpm, int bankIndex, const int32_t *src, int count)
 {
-    uint32_t address = (row << 1) | (isSin != 0);
-    uint32_t csr = (bankIndex << BANKSELECT_SHIFT) | (value & VALUE_MASK);
+    uint32_t bank = bankIndex << BANKSELECT_SHIFT;
 
     if (bpm >= CFG_DSBPM_COUNT) return;
 
-    GPIO_WRITE(REG(GPIO_IDX_DACTABLE_ADDRESS, bpm), address);
-    GPIO_WRITE(REG(GPIO_IDX_DACTABLE_CSR, bpm), csr);
+    GPIO_WRITE(REG(GPIO_IDX_DACTABLE_ADDRESS, bpm), 0);
+    while (count--) {
+        GPIO_WRITE(REG(GPIO_IDX_DACTABLE_CSR, bpm), bank | (*src++ & VALUE_MASK));
+    }
 }
 
 /*
@@ -247,7 +251,7 @@ isPtGenRun(unsigned int bpm)
 static void
 ptGenWrite(unsigned int bpm, int32_t *dst, const int32_t *src, int capacity)
 {
-    int r, c, rowCount;
+    int rowCount;
     size_t hdrSizeWords = 2; // Row count and checksum
     int colCount = 2;
 
@@ -255,20 +259,16 @@ ptGenWrite(unsigned int bpm, int32_t *dst, const int32_t *src, int capacity)
     if ((rowCount >= 29)
      && (rowCount < capacity)
      && (src[1] == checkSum(src, rowCount, colCount))) {
+        uint32_t usAtStart = MICROSECONDS_SINCE_BOOT();
         if (dst) {
-            memcpy(dst, src, hdrSizeWords*sizeof(*src));
-            dst+=hdrSizeWords;
+            memcpy(dst, src, (hdrSizeWords + rowCount*colCount)*sizeof(*src));
         }
         src+=hdrSizeWords;
 
-        for (r = 0 ; r < rowCount ; r++) {
-            for (c = 0 ; c < colCount ; c++) {
-                writeTable(bpm, BANKINDEX_PT_GEN, r, c & 0x1, *src);
-
-                if(dst) *dst++ = *src;
-                src++;
-            }
-        }
+        writeTable(bpm, BANKINDEX_PT_GEN, src, rowCount*colCount);
+        if (debugFlags & DEBUGFLAG_LOCAL_OSC_SHOW)
+            printf("PtGen: table %u commit %u us\n", bpm,
+                    (unsigned int)(MICROSECONDS_SINCE_BOOT() - usAtStart));
     }
     else {
         printf("PtGen: CORRUPT PT GENERATION TABLE\n");
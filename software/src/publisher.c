@@ -2,8 +2,10 @@
  * Publish monitor values
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <lwip/udp.h>
+#include <xtime_l.h>
 #include "autotrim.h"
 #include "afe.h"
 #include "ami.h"
@@ -20,38 +22,252 @@
 #include "rfdc.h"
 #include "waveformRecorder.h"
 #include "bpmComm.h"
+#include "serdes.h"
 
 #define MAX_ADC_CHANNELS_PER_CHAIN (DSBPM_PROTOCOL_ADC_COUNT/CFG_DSBPM_COUNT)
 #define MAX_DAC_CHANNELS_PER_CHAIN (DSBPM_PROTOCOL_DAC_COUNT/CFG_DSBPM_COUNT)
 
+/*
+ * Limit main loop time spent sending waveform packets
+ */
+#define WAVEFORM_BYTES_PER_CHECK    (64 * 1024)
+
 #define REG(base,chan)  ((base) + (GPIO_IDX_PER_DSBPM * (chan)))
 
+/*
+ * Slow acquisition packets go to every subscriber and, optionally, to
+ * a multicast group.  A subscription lapses unless renewed within the
+ * lease period.  Waveforms go to a single primary subscriber, chosen
+ * as described with struct dsbpmSubscription, which also sets the FOFB
+ * indices.
+ */
+#define SUBSCRIBER_CAPACITY     4
+#define SUBSCRIPTION_LEASE_US   (60 * 1000000)
+
+struct subscriber {
+    ip_addr_t    addr;
+    u16_t        port;
+    uint32_t     usAtRenewal;
+    int          extendedHeader;
+    unsigned int sendCount;
+    unsigned int dropCount;
+};
+static struct subscriber subscribers[SUBSCRIBER_CAPACITY];
+static struct subscriber multicastGroup;
+static struct subscriber *waveformSubscriber;
+
 static struct udp_pcb *pcb;
-static ip_addr_t  subscriberAddr;
-static u16_t      subscriberPort;
 
 /*
- * Send values to subscriber
+ * Slow acquisition values are normally taken from the snapshot that the
+ * gateware latches once per SA update.  Reading the individual registers
+ * instead is retained for timing comparison.  Word offsets must match
+ * the snapshot layout in the top level gateware.
+ */
+#define SA_SNAPSHOT_SEQUENCE        0
+#define SA_SNAPSHOT_SECONDS         1
+#define SA_SNAPSHOT_FRACTION        2
+#define SA_SNAPSHOT_DSBPM_BASE      3
+#define SA_SNAPSHOT_X               0
+#define SA_SNAPSHOT_Y               1
+#define SA_SNAPSHOT_Q               2
+#define SA_SNAPSHOT_S               3
+#define SA_SNAPSHOT_RMS_X_WIDE      4
+#define SA_SNAPSHOT_RMS_Y_WIDE      5
+#define SA_SNAPSHOT_RMS_X_NARROW    6
+#define SA_SNAPSHOT_RMS_Y_NARROW    7
+#define SA_SNAPSHOT_LOSS_OF_BEAM    8
+#define SA_SNAPSHOT_PRELIM_STATUS   9
+#define SA_SNAPSHOT_CLOCK_STATUS    10
+#define SA_SNAPSHOT_RF_MAG_0        11
+#define SA_SNAPSHOT_PT_LO_MAG_0     15
+#define SA_SNAPSHOT_PT_HI_MAG_0     19
+#define SA_SNAPSHOT_ADC_GAIN_0      23
+#define SA_SNAPSHOT_RF_GAIN_0       27
+#define SA_SNAPSHOT_PL_GAIN_0       31
+#define SA_SNAPSHOT_PH_GAIN_0       35
+#define SA_SNAPSHOT_WORD_COUNT      (SA_SNAPSHOT_DSBPM_BASE + \
+                          (CFG_DSBPM_COUNT * CFG_SA_SNAPSHOT_WORDS_PER_DSBPM))
+#define SNAP(snap,chan,word) \
+        ((snap)[SA_SNAPSHOT_DSBPM_BASE+((chan)*CFG_SA_SNAPSHOT_WORDS_PER_DSBPM)+(word)])
+
+static int saFromRegisters;
+static struct saFetchStats {
+    unsigned int count;
+    unsigned int retries;
+    XTime        ticks;
+    XTime        maxTicks;
+} saFetchStats[2];
+
+/*
+ * Find an active subscription
+ */
+static struct subscriber *
+findSubscriber(const ip_addr_t *addr, u16_t port)
+{
+    struct subscriber *sp;
+
+    for (sp = subscribers ; sp < &subscribers[SUBSCRIBER_CAPACITY] ; sp++) {
+        if ((sp->port == port) && ip_addr_cmp(&sp->addr, addr))
+            return sp;
+    }
+    return NULL;
+}
+
+static int
+haveSubscribers(void)
+{
+    struct subscriber *sp;
+
+    for (sp = subscribers ; sp < &subscribers[SUBSCRIBER_CAPACITY] ; sp++) {
+        if (sp->port)
+            return 1;
+    }
+    return multicastGroup.port != 0;
+}
+
+/*
+ * Add or renew a subscription
+ * A primary subscriber takes the waveform destination if it is free.
+ */
+static struct subscriber *
+subscribe(const ip_addr_t *addr, u16_t port, int isPrimary, int extendedHeader)
+{
+    uint32_t now = MICROSECONDS_SINCE_BOOT();
+    struct subscriber *sp, *oldest = NULL, *unused = NULL;
+
+    for (sp = subscribers ; sp < &subscribers[SUBSCRIBER_CAPACITY] ; sp++) {
+        if (sp->port == 0) {
+            if (unused == NULL) unused = sp;
+        }
+        else if ((sp->port == port) && ip_addr_cmp(&sp->addr, addr)) {
+            break;
+        }
+        else if ((sp != waveformSubscriber)
+              && ((oldest == NULL)
+               || ((now - sp->usAtRenewal) > (now - oldest->usAtRenewal)))) {
+            oldest = sp;
+        }
+    }
+    if (sp == &subscribers[SUBSCRIBER_CAPACITY]) {
+        sp = unused ? unused : oldest;
+        memset(sp, 0, sizeof *sp);
+        ip_addr_copy(sp->addr, *addr);
+        sp->port = port;
+    }
+    sp->usAtRenewal = now;
+    sp->extendedHeader = extendedHeader;
+    if (isPrimary && (waveformSubscriber == NULL)) {
+        waveformSubscriber = sp;
+    }
+    return sp;
+}
+
+/*
+ * Drop subscriptions that have not been renewed
  */
 static void
-publishSlowAcquisition(unsigned int saSeconds, unsigned int saFraction)
+expireSubscriptions(void)
+{
+    uint32_t now = MICROSECONDS_SINCE_BOOT();
+    struct subscriber *sp;
+
+    for (sp = subscribers ; sp < &subscribers[SUBSCRIBER_CAPACITY] ; sp++) {
+        if (sp->port
+         && ((now - sp->usAtRenewal) > SUBSCRIPTION_LEASE_US)) {
+            if (debugFlags & DEBUGFLAG_PUBLISHER)
+                printf("Subscription from %s:%d expired\n",
+                                        formatIP(&sp->addr, 0), sp->port);
+            sp->port = 0;
+            if (sp == waveformSubscriber)
+                waveformSubscriber = NULL;
+        }
+    }
+}
+
+/*
+ * Send a copy of a packet.
+ * udp_sendto() modifies the pbuf so each destination needs its own.
+ */
+static void
+sendCopy(struct pbuf *p, struct subscriber *sp)
+{
+    struct pbuf *q = pbuf_clone(PBUF_TRANSPORT, PBUF_RAM, p);
+
+    if ((q != NULL) && (udp_sendto(pcb, q, &sp->addr, sp->port) == ERR_OK))
+        sp->sendCount++;
+    else
+        sp->dropCount++;
+    if (q)
+        pbuf_free(q);
+}
+
+/*
+ * Copy the snapshot, retrying if it changed while being read.
+ * Return the number of retries.
+ */
+static int
+readSnapshot(uint32_t *snap)
+{
+    int i, pass;
+
+    for (pass = 0 ; pass < 3 ; pass++) {
+        for (i = 0 ; i < SA_SNAPSHOT_WORD_COUNT ; i++)
+            snap[i] = GPIO_READ(GPIO_IDX_SA_SNAPSHOT_BASE + i);
+        if (GPIO_READ(GPIO_IDX_SA_SNAPSHOT_BASE + SA_SNAPSHOT_SEQUENCE) ==
+                                                   snap[SA_SNAPSHOT_SEQUENCE])
+            break;
+    }
+    return pass;
+}
+
+/*
+ * Fill in values from the snapshot
+ */
+static void
+fetchSnapshot(struct dsbpmSlowAcquisition *pk, struct saFetchStats *sp)
 {
     int i;
-    int adcChannel, dacChannel, chainNumber;
-    struct pbuf *p;
-    struct dsbpmSlowAcquisition *pk;
-    static epicsUInt32 packetNumber = 1;
-    uint32_t r;
-    p = pbuf_alloc(PBUF_TRANSPORT, sizeof *pk, PBUF_RAM);
-    if (p == NULL) {
-        printf("Can't allocate pbuf for slow data\n");
-        return;
+    int adcChannel, chainNumber;
+    uint32_t snap[SA_SNAPSHOT_WORD_COUNT];
+
+    sp->retries += readSnapshot(snap);
+    for (i = 0 ; i < DSBPM_PROTOCOL_DSP_COUNT ; i++) {
+        chainNumber = i;
+        pk->xPos[i] = SNAP(snap, chainNumber, SA_SNAPSHOT_X);
+        pk->yPos[i] = SNAP(snap, chainNumber, SA_SNAPSHOT_Y);
+        pk->skew[i] = SNAP(snap, chainNumber, SA_SNAPSHOT_Q);
+        pk->buttonSum[i] = SNAP(snap, chainNumber, SA_SNAPSHOT_S);
+        pk->xRMSwide[i] = SNAP(snap, chainNumber, SA_SNAPSHOT_RMS_X_WIDE);
+        pk->yRMSwide[i] = SNAP(snap, chainNumber, SA_SNAPSHOT_RMS_Y_WIDE);
+        pk->xRMSnarrow[i] = SNAP(snap, chainNumber, SA_SNAPSHOT_RMS_X_NARROW);
+        pk->yRMSnarrow[i] = SNAP(snap, chainNumber, SA_SNAPSHOT_RMS_Y_NARROW);
+        pk->lossOfBeamStatus[i] = SNAP(snap, chainNumber, SA_SNAPSHOT_LOSS_OF_BEAM);
+        pk->prelimProcStatus[i] = SNAP(snap, chainNumber, SA_SNAPSHOT_PRELIM_STATUS);
+        pk->clockStatus[i] = SNAP(snap, chainNumber, SA_SNAPSHOT_CLOCK_STATUS);
     }
-    pk = (struct dsbpmSlowAcquisition *)p->payload;
-    pk->packetNumber = packetNumber++;
-    pk->seconds = saSeconds;
-    pk->fraction = saFraction;
-    pk->magic = DSBPM_PROTOCOL_MAGIC_SLOW_ACQUISITION;
+    for (i = 0 ; i < DSBPM_PROTOCOL_ADC_COUNT ; i++) {
+        adcChannel = i % MAX_ADC_CHANNELS_PER_CHAIN;
+        chainNumber = i / MAX_ADC_CHANNELS_PER_CHAIN;
+        pk->rfMag[i] = SNAP(snap, chainNumber, SA_SNAPSHOT_RF_MAG_0 + adcChannel);
+        pk->ptLoMag[i] = SNAP(snap, chainNumber, SA_SNAPSHOT_PT_LO_MAG_0 + adcChannel);
+        pk->ptHiMag[i] = SNAP(snap, chainNumber, SA_SNAPSHOT_PT_HI_MAG_0 + adcChannel);
+        pk->gainFactor[i] = SNAP(snap, chainNumber, SA_SNAPSHOT_ADC_GAIN_0 + adcChannel);
+        pk->calibRFFactor[i] = SNAP(snap, chainNumber, SA_SNAPSHOT_RF_GAIN_0 + adcChannel);
+        pk->calibPLFactor[i] = SNAP(snap, chainNumber, SA_SNAPSHOT_PL_GAIN_0 + adcChannel);
+        pk->calibPHFactor[i] = SNAP(snap, chainNumber, SA_SNAPSHOT_PH_GAIN_0 + adcChannel);
+    }
+}
+
+/*
+ * Fill in values by reading each register
+ */
+static void
+fetchRegisters(struct dsbpmSlowAcquisition *pk)
+{
+    int i;
+    int adcChannel, chainNumber;
+
     for (i = 0 ; i < DSBPM_PROTOCOL_DSP_COUNT ; i++) {
         chainNumber = i;
         pk->xPos[i] = GPIO_READ(REG(GPIO_IDX_POSITION_CALC_SA_X, chainNumber));
@@ -64,13 +280,8 @@ publishSlowAcquisition(unsigned int saSeconds, unsigned int saFraction)
         pk->yRMSnarrow[i] = GPIO_READ(REG(GPIO_IDX_RMS_Y_NARROW, chainNumber));
         pk->lossOfBeamStatus[i] = GPIO_READ(REG(GPIO_IDX_LOSS_OF_BEAM_TRIGGER, chainNumber));
         pk->prelimProcStatus[i] = GPIO_READ(REG(GPIO_IDX_PRELIM_STATUS, chainNumber));
-        pk->recorderStatus[i] = wfrStatus(i);
-        pk->autotrimStatus[i] = autotrimStatus(i);
-        pk->sdSyncStatus[i] = localOscGetSdSyncStatus(i);
-        pk->cellCommStatus[i] = 0;
         pk->clockStatus[i] = GPIO_READ(REG(GPIO_IDX_CLOCK_STATUS, chainNumber));
     }
-    pk->clipStatus = rfADCstatus();
     for (i = 0 ; i < DSBPM_PROTOCOL_ADC_COUNT ; i++) {
         adcChannel = i % MAX_ADC_CHANNELS_PER_CHAIN;
         chainNumber = i / MAX_ADC_CHANNELS_PER_CHAIN;
@@ -88,6 +299,53 @@ publishSlowAcquisition(unsigned int saSeconds, unsigned int saFraction)
                 adcChannel, chainNumber));
         pk->calibPHFactor[i] = GPIO_READ(REG(GPIO_IDX_PH_GAIN_FACTOR_0 +
                 adcChannel, chainNumber));
+    }
+}
+
+/*
+ * Send values to subscribers
+ */
+static void
+publishSlowAcquisition(unsigned int saSeconds, unsigned int saFraction)
+{
+    int i;
+    int adcChannel, dacChannel, chainNumber;
+    struct pbuf *p;
+    struct dsbpmSlowAcquisition *pk;
+    struct saFetchStats *sp = &saFetchStats[saFromRegisters];
+    static epicsUInt32 packetNumber = 1;
+    uint32_t r;
+    XTime then, now;
+    p = pbuf_alloc(PBUF_TRANSPORT, sizeof *pk, PBUF_RAM);
+    if (p == NULL) {
+        printf("Can't allocate pbuf for slow data\n");
+        return;
+    }
+    pk = (struct dsbpmSlowAcquisition *)p->payload;
+    pk->packetNumber = packetNumber++;
+    pk->seconds = saSeconds;
+    pk->fraction = saFraction;
+    pk->magic = DSBPM_PROTOCOL_MAGIC_SLOW_ACQUISITION;
+    XTime_GetTime(&then);
+    if (saFromRegisters)
+        fetchRegisters(pk);
+    else
+        fetchSnapshot(pk, sp);
+    XTime_GetTime(&now);
+    sp->count++;
+    sp->ticks += now - then;
+    if ((now - then) > sp->maxTicks)
+        sp->maxTicks = now - then;
+    for (i = 0 ; i < DSBPM_PROTOCOL_DSP_COUNT ; i++) {
+        pk->recorderStatus[i] = wfrStatus(i);
+        pk->autotrimStatus[i] = autotrimStatus(i);
+        pk->sdSyncStatus[i] = localOscGetSdSyncStatus(i);
+        pk->cellCommStatus[i] = 0;
+    }
+    pk->clipStatus = rfADCstatus();
+    for (i = 0 ; i < DSBPM_PROTOCOL_ADC_COUNT ; i++) {
+        adcChannel = i % MAX_ADC_CHANNELS_PER_CHAIN;
+        chainNumber = i / MAX_ADC_CHANNELS_PER_CHAIN;
         pk->rfADCDSA[i] = rfADCGetDSADSBPM(chainNumber, adcChannel);
         pk->afeAtt[i] = amiAfeAttenGet(chainNumber, adcChannel);
     }
@@ -107,7 +365,12 @@ publishSlowAcquisition(unsigned int saSeconds, unsigned int saFraction)
     r = 0;
     pk->adcPeak[2] = r;
     pk->adcPeak[3] = r >> 16;
-    udp_sendto(pcb, p, &subscriberAddr, subscriberPort);
+    for (i = 0 ; i < SUBSCRIBER_CAPACITY ; i++) {
+        if (subscribers[i].port)
+            sendCopy(p, &subscribers[i]);
+    }
+    if (multicastGroup.port)
+        sendCopy(p, &multicastGroup);
     pbuf_free(p);
 }
 
@@ -118,22 +381,37 @@ void
 publisherCheck(void)
 {
     struct pbuf *p;
+    int budget;
     unsigned int saSeconds;
     unsigned int saFraction;
     static unsigned int previousSaSeconds, previousSaFraction;
+    unsigned int secondsIdx, fractionIdx;
+
+    /*
+     * The snapshot time stamp changes only once all values are latched
+     */
+    if (saFromRegisters) {
+        secondsIdx = GPIO_IDX_SA_TIMESTAMP_SEC;
+        fractionIdx = GPIO_IDX_SA_TIMESTAMP_FRACTION;
+    }
+    else {
+        secondsIdx = GPIO_IDX_SA_SNAPSHOT_BASE + SA_SNAPSHOT_SECONDS;
+        fractionIdx = GPIO_IDX_SA_SNAPSHOT_BASE + SA_SNAPSHOT_FRACTION;
+    }
 
     /*
      * Wait for SA time stamp to stabilize
      */
-    saFraction = GPIO_READ(GPIO_IDX_SA_TIMESTAMP_FRACTION);
+    saFraction = GPIO_READ(fractionIdx);
     for (;;) {
         unsigned int checkFraction;
-        saSeconds = GPIO_READ(GPIO_IDX_SA_TIMESTAMP_SEC);
-        checkFraction = GPIO_READ(GPIO_IDX_SA_TIMESTAMP_FRACTION);
+        saSeconds = GPIO_READ(secondsIdx);
+        checkFraction = GPIO_READ(fractionIdx);
         if (checkFraction == saFraction) break;
         saFraction = checkFraction;
     }
-    if (subscriberPort == 0) {
+    expireSubscriptions();
+    if (!haveSubscribers()) {
         previousSaSeconds = saSeconds;
         previousSaFraction = saFraction;
     }
@@ -164,8 +442,13 @@ publisherCheck(void)
             publishSlowAcquisition(saSeconds, saFraction);
         }
 
-        if ((p = wfrCheckForWork()) != NULL) {
-            udp_sendto(pcb, p, &subscriberAddr, subscriberPort);
+        budget = WAVEFORM_BYTES_PER_CHECK;
+        while (waveformSubscriber
+            && (budget > 0)
+            && ((p = wfrCheckForWork(!waveformSubscriber->extendedHeader)) != NULL)) {
+            budget -= p->tot_len;
+            udp_sendto(pcb, p, &waveformSubscriber->addr,
+                                                waveformSubscriber->port);
             pbuf_free(p);
         }
     }
@@ -209,27 +492,49 @@ publisher_callback(void *arg, struct udp_pcb *pcb, struct pbuf *p,
                                                 (int)((addr      ) & 0xFF),
                                                 fromPort);
     }
-    if (p->len == sizeof fofbIndex) {
-        epicsInt16 newIndex[CFG_DSBPM_COUNT];
-        memcpy(&newIndex, p->payload, sizeof newIndex);
+    if ((p->len == DSBPM_PROTOCOL_SUBSCRIBE_LEGACY_SIZE)
+     || (p->len == sizeof(struct dsbpmSubscription))) {
+        struct dsbpmSubscription req;
+        struct subscriber *sp;
+        int isPrimary;
+        memset(&req, 0, sizeof req);
+        memcpy(&req, p->payload, p->len);
+        isPrimary = (p->len == DSBPM_PROTOCOL_SUBSCRIBE_LEGACY_SIZE)
+                 || (req.flags & DSBPM_PROTOCOL_SUBSCRIBE_FLAG_PRIMARY);
+        sp = subscribe(fromAddr, fromPort, isPrimary,
+                (req.flags & DSBPM_PROTOCOL_SUBSCRIBE_FLAG_EXTENDED_HEADER) != 0);
 
-        for (i = 0; i < CFG_DSBPM_COUNT; ++i) {
-            if (newIndex[i] != fofbIndex[i]) {
-                fofbIndex[i] = newIndex[i];
-                bpmCommSetFOFB(i, fofbIndex[i]);
+        /*
+         * Only the primary subscriber sets the FOFB indices
+         */
+        if (isPrimary && (sp == waveformSubscriber)) {
+            for (i = 0; i < CFG_DSBPM_COUNT; ++i) {
+                if (req.fofbIndex[i] != fofbIndex[i]) {
+                    fofbIndex[i] = req.fofbIndex[i];
+                    bpmCommSetFOFB(i, fofbIndex[i]);
+                }
             }
         }
-        subscriberAddr = *fromAddr;
-        subscriberPort = fromPort;
     }
-    else if (subscriberPort && (p->len == sizeof(struct dsbpmWaveformAck))) {
+    else if ((p->len == DSBPM_PROTOCOL_WAVEFORM_ACK_LEGACY_SIZE)
+          || (p->len == DSBPM_PROTOCOL_WAVEFORM_ACK_WINDOWED_SIZE)
+          || (p->len == sizeof(struct dsbpmWaveformAck))) {
         struct dsbpmWaveformAck dsbpmAck;
         struct pbuf *txPacket;
-        memcpy(&dsbpmAck, p->payload, sizeof dsbpmAck);
-        txPacket = wfrAckPacket(&dsbpmAck);
-        if (txPacket) {
-            udp_sendto(pcb, txPacket, &subscriberAddr, subscriberPort);
-            pbuf_free(txPacket);
+
+        /*
+         * A subscriber acknowledging waveforms claims them if unclaimed
+         */
+        if (waveformSubscriber == NULL)
+            waveformSubscriber = findSubscriber(fromAddr, fromPort);
+        if (waveformSubscriber) {
+            memset(&dsbpmAck, 0, sizeof dsbpmAck);
+            memcpy(&dsbpmAck, p->payload, p->len);
+            txPacket = wfrAckPacket(&dsbpmAck, p->len);
+            if (txPacket) {
+                udp_sendto(pcb, txPacket, fromAddr, fromPort);
+                pbuf_free(txPacket);
+            }
         }
     }
     pbuf_free(p);
@@ -255,3 +560,74 @@ publisherInit(void)
     }
     udp_recv(pcb, publisher_callback, NULL);
 }
+
+/*
+ * Show subscribers and set multicast group
+ */
+int
+publisherCommand(int argc, char **argv)
+{
+    int i;
+    uint32_t now = MICROSECONDS_SINCE_BOOT();
+    struct subscriber *sp;
+    ip_addr_t addr;
+    char *endp;
+    long port = DSBPM_PROTOCOL_PUBLISHER_UDP_PORT;
+
+    if (argc > 1) {
+        if ((argc == 3) && (strcmp(argv[1], "mcast") == 0)
+         && (strcmp(argv[2], "off") == 0)) {
+            multicastGroup.port = 0;
+        }
+        else if ((argc == 3) && (strcmp(argv[1], "sa") == 0)
+              && ((strcmp(argv[2], "snapshot") == 0)
+               || (strcmp(argv[2], "registers") == 0))) {
+            saFromRegisters = (argv[2][0] == 'r');
+        }
+        else if (((argc == 3) || (argc == 4))
+              && (strcmp(argv[1], "mcast") == 0)
+              && (parseIP(argv[2], &addr) > 0)
+              && ip_addr_ismulticast(&addr)
+              && ((argc == 3)
+               || (((port = strtol(argv[3], &endp, 0)) > 0)
+                && (port <= 0xFFFF) && (*endp == '\0')))) {
+            memset(&multicastGroup, 0, sizeof multicastGroup);
+            ip_addr_copy(multicastGroup.addr, addr);
+            multicastGroup.port = port;
+        }
+        else {
+            printf("Usage: %s [mcast off|mcast group [port]|"
+                   "sa snapshot|sa registers]\n", argv[0]);
+            return 1;
+        }
+    }
+    for (i = 0 ; i < 2 ; i++) {
+        struct saFetchStats *fp = &saFetchStats[i];
+        if (fp->count) {
+            printf("SA %9s %7u fetches %5u ns mean %5u ns max",
+                    i ? "registers" : "snapshot", fp->count,
+                    (unsigned int)((fp->ticks * 1000000000) /
+                                           (COUNTS_PER_SECOND * fp->count)),
+                    (unsigned int)((fp->maxTicks * 1000000000) /
+                                                         COUNTS_PER_SECOND));
+            if (i == 0)
+                printf(" %u retries", fp->retries);
+            printf("%s\n", i == saFromRegisters ? " (active)" : "");
+            memset(fp, 0, sizeof *fp);
+        }
+    }
+    for (sp = subscribers ; sp < &subscribers[SUBSCRIBER_CAPACITY] ; sp++) {
+        if (sp->port)
+            printf("%15s:%-5d %5u s %10u sent %8u dropped%s\n",
+                              formatIP(&sp->addr, 0), sp->port,
+                              (unsigned int)((now - sp->usAtRenewal) / 1000000),
+                              sp->sendCount, sp->dropCount,
+                              sp == waveformSubscriber ? " (waveforms)" : "");
+    }
+    if (multicastGroup.port)
+        printf("%15s:%-5d multicast %10u sent %8u dropped\n",
+                              formatIP(&multicastGroup.addr, 0),
+                              multicastGroup.port,
+                              multicastGroup.sendCount, multicastGroup.dropCount);
+    return 0;
+}
@@ -7,5 +7,6 @@
 
 void publisherInit(void);
 void publisherCheck(void);
+int publisherCommand(int argc, char **argv);
 
 #endif
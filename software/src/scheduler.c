@@ -0,0 +1,454 @@
+/*
+ * Cooperative main loop scheduler
+ *
+ * Task run times are measured with the processor cycle counter.
+ * Two independent copies of the statistics are kept, one for the
+ * console and one for the network readback, so that reading one
+ * does not clear the other.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xparameters.h>
+#if defined(__aarch64__)
+# include <xpseudo_asm.h>
+# define CYCLES_PER_SECOND XPAR_CPU_CORTEXA53_0_CPU_CLK_FREQ_HZ
+#else
+# include <xtime_l.h>
+# define CYCLES_PER_SECOND COUNTS_PER_SECOND
+#endif
+#include "gpio.h"
+#include "scheduler.h"
+#include "util.h"
+
+#define TASK_CAPACITY   16
+
+/*
+ * Lateness that raises a background task by one priority level
+ */
+#define SCHEDULER_AGING_US  10000
+
+#define CYCLES_PER_MICROSECOND (CYCLES_PER_SECOND / 1000000)
+
+#define STATS_CONSOLE   0
+#define STATS_NETWORK   1
+#define STATS_COUNT     2
+
+struct timingStats {
+    unsigned int runCount;
+    unsigned int overrunCount;
+    uint32_t     minCycles;
+    uint32_t     maxCycles;
+    uint64_t     totalCycles;
+    uint32_t     maxLateUs;
+    uint32_t     histogram[SCHEDULER_HISTOGRAM_BINS];
+};
+
+struct schedulerTask {
+    const char        *name;
+    void             (*crank)(void);
+    int                priority;
+    uint32_t           periodUs;
+    uint32_t           budgetUs;
+    uint32_t           budgetCycles;
+    uint32_t           usAtLastRun;
+    struct timingStats stats[STATS_COUNT];
+};
+static struct schedulerTask tasks[TASK_CAPACITY];
+static int taskCount;
+
+/*
+ * Interval between foreground passes
+ */
+static uint32_t loopBudgetUs = 2000;
+static struct timingStats loopStats[STATS_COUNT];
+
+/*
+ * Longest pass that exceeded the loop budget and the
+ * task call that took the most time in that pass.
+ */
+struct worstOffender {
+    const char *name;
+    uint32_t    runCycles;
+    uint32_t    loopCycles;
+    uint32_t    usSinceBoot;
+};
+static struct worstOffender worstOffender[STATS_COUNT];
+
+static uint64_t
+cycleCount(void)
+{
+#if defined(__aarch64__)
+    return mfcp(PMCCNTR_EL0);
+#else
+    XTime t;
+    XTime_GetTime(&t);
+    return t;
+#endif
+}
+
+/*
+ * Start the PMU cycle counter.
+ * The application runs at EL3, which is counted only when the filter
+ * M bit equals the P bit, so clear the whole filter to count cycles at
+ * every exception level.
+ * Enable counters, reset the cycle counter and make it 64 bits wide.
+ */
+static void
+cycleCounterInit(void)
+{
+#if defined(__aarch64__)
+    mtcp(PMCCFILTR_EL0, 0);
+    mtcp(PMCR_EL0, mfcp(PMCR_EL0) | 0x45);
+    mtcp(PMCNTENSET_EL0, 0x80000000);
+    isb();
+#endif
+}
+
+static void
+statsReset(struct timingStats *sp)
+{
+    memset(sp, 0, sizeof *sp);
+    sp->minCycles = UINT32_MAX;
+}
+
+/*
+ * Bin 0 counts intervals shorter than 1 microsecond.
+ * Bin i counts intervals of at least 4^(i-1) and less than 4^i
+ * microseconds, with the last bin also counting all longer intervals.
+ */
+static void
+statsUpdate(struct timingStats *sp, uint32_t cycles, uint32_t budgetCycles)
+{
+    uint32_t us = cycles / CYCLES_PER_MICROSECOND;
+    int bin = 0;
+
+    while ((us != 0) && (bin < (SCHEDULER_HISTOGRAM_BINS - 1))) {
+        us >>= 2;
+        bin++;
+    }
+    sp->histogram[bin]++;
+    sp->runCount++;
+    sp->totalCycles += cycles;
+    if (cycles < sp->minCycles)
+        sp->minCycles = cycles;
+    if (cycles > sp->maxCycles)
+        sp->maxCycles = cycles;
+    if (cycles > budgetCycles)
+        sp->overrunCount++;
+}
+
+static uint32_t
+cyclesBetween(uint64_t then, uint64_t now)
+{
+    uint64_t cycles = now - then;
+    return cycles > UINT32_MAX ? UINT32_MAX : cycles;
+}
+
+/*
+ * Keep table sorted by priority, preserving order within a priority
+ */
+void
+schedulerAddTask(const char *name, void (*crank)(void),
+                 int priority, uint32_t periodUs, uint32_t budgetUs)
+{
+    int i;
+    struct schedulerTask *tp;
+
+    if (taskCount >= TASK_CAPACITY) {
+        fatal("Too many scheduler tasks");
+        return;
+    }
+    for (i = taskCount ; (i > 0) && (tasks[i-1].priority > priority) ; i--)
+        tasks[i] = tasks[i-1];
+    tp = &tasks[i];
+    memset(tp, 0, sizeof *tp);
+    tp->name = name;
+    tp->crank = crank;
+    tp->priority = priority;
+    tp->periodUs = periodUs;
+    tp->budgetUs = budgetUs;
+    tp->budgetCycles = budgetUs * CYCLES_PER_MICROSECOND;
+    tp->usAtLastRun = MICROSECONDS_SINCE_BOOT();
+    for (i = 0 ; i < STATS_COUNT ; i++)
+        statsReset(&tp->stats[i]);
+    taskCount++;
+}
+
+static uint32_t
+runTask(struct schedulerTask *tp, uint32_t now)
+{
+    int i;
+    uint32_t late, cycles;
+    uint64_t then;
+
+    late = (now - tp->usAtLastRun) - tp->periodUs;
+    tp->usAtLastRun = now;
+    then = cycleCount();
+    tp->crank();
+    cycles = cyclesBetween(then, cycleCount());
+    for (i = 0 ; i < STATS_COUNT ; i++) {
+        struct timingStats *sp = &tp->stats[i];
+        statsUpdate(sp, cycles, tp->budgetCycles);
+        if ((tp->periodUs != 0) && (late > sp->maxLateUs))
+            sp->maxLateUs = late;
+    }
+    return cycles;
+}
+
+static int
+isDue(const struct schedulerTask *tp, uint32_t now)
+{
+    return (now - tp->usAtLastRun) >= tp->periodUs;
+}
+
+static void
+loopUpdate(uint32_t loopCycles, const struct schedulerTask *offender,
+           uint32_t offenderCycles)
+{
+    int i;
+    uint32_t budgetCycles = loopBudgetUs * CYCLES_PER_MICROSECOND;
+
+    for (i = 0 ; i < STATS_COUNT ; i++) {
+        struct worstOffender *wp = &worstOffender[i];
+        statsUpdate(&loopStats[i], loopCycles, budgetCycles);
+        if ((loopCycles > budgetCycles) && (loopCycles > wp->loopCycles)
+         && (offender != NULL)) {
+            wp->name = offender->name;
+            wp->runCycles = offenderCycles;
+            wp->loopCycles = loopCycles;
+            wp->usSinceBoot = MICROSECONDS_SINCE_BOOT();
+        }
+    }
+}
+
+/*
+ * Priority used to choose between due background tasks.
+ * A task gains one priority level for every SCHEDULER_AGING_US it
+ * is overdue, so a busy higher priority task can delay it but can
+ * not starve it.
+ */
+static int
+effectivePriority(const struct schedulerTask *tp, uint32_t late)
+{
+    uint32_t boost = late / SCHEDULER_AGING_US;
+
+    if (boost >= (uint32_t)(tp->priority - 1))
+        return 1;
+    return tp->priority - boost;
+}
+
+/*
+ * Most urgent background task that is due, or NULL if none is
+ */
+static struct schedulerTask *
+nextBackgroundTask(uint32_t now)
+{
+    struct schedulerTask *tp, *next = NULL;
+    int pri, nextPri = 0;
+    uint32_t late, nextLate = 0;
+
+    for (tp = tasks ; tp < &tasks[taskCount] ; tp++) {
+        if ((tp->priority == SCHEDULER_PRIORITY_FOREGROUND) || !isDue(tp, now))
+            continue;
+        late = (now - tp->usAtLastRun) - tp->periodUs;
+        pri = effectivePriority(tp, late);
+        if ((next == NULL) || (pri < nextPri)
+         || ((pri == nextPri) && (late > nextLate))) {
+            next = tp;
+            nextPri = pri;
+            nextLate = late;
+        }
+    }
+    return next;
+}
+
+void
+schedulerRun(void)
+{
+    int i;
+    struct schedulerTask *tp, *offender = NULL;
+    uint32_t now, cycles, offenderCycles = 0;
+    uint64_t cyclesAtPass;
+
+    cycleCounterInit();
+    for (i = 0 ; i < STATS_COUNT ; i++)
+        statsReset(&loopStats[i]);
+    cyclesAtPass = cycleCount();
+    for (;;) {
+        uint64_t then = cyclesAtPass;
+        uint32_t budgetCycles = loopBudgetUs * CYCLES_PER_MICROSECOND;
+        cyclesAtPass = cycleCount();
+        loopUpdate(cyclesBetween(then, cyclesAtPass), offender, offenderCycles);
+        offender = NULL;
+        offenderCycles = 0;
+        for (tp = tasks ; tp < &tasks[taskCount] ; tp++) {
+            if (tp->priority != SCHEDULER_PRIORITY_FOREGROUND)
+                break;
+            now = MICROSECONDS_SINCE_BOOT();
+            if (isDue(tp, now)) {
+                cycles = runTask(tp, now);
+                if (cycles > offenderCycles) {
+                    offender = tp;
+                    offenderCycles = cycles;
+                }
+            }
+        }
+
+        /*
+         * Always run the most urgent due background task, then keep
+         * running due tasks until the pass reaches the loop budget.
+         */
+        for (i = 0 ; i < taskCount ; i++) {
+            if ((i != 0)
+             && (cyclesBetween(cyclesAtPass, cycleCount()) >= budgetCycles))
+                break;
+            now = MICROSECONDS_SINCE_BOOT();
+            if ((tp = nextBackgroundTask(now)) == NULL)
+                break;
+            cycles = runTask(tp, now);
+            if (cycles > offenderCycles) {
+                offender = tp;
+                offenderCycles = cycles;
+            }
+        }
+    }
+}
+
+static unsigned int
+cyclesToNs(uint64_t cycles)
+{
+    return (cycles * 1000) / (CYCLES_PER_SECOND / 1000000);
+}
+
+static void
+showStats(const char *name, const struct timingStats *sp, int showHistogram)
+{
+    int i;
+
+    if (sp->runCount == 0) {
+        printf("%-13s no runs\n", name);
+        return;
+    }
+    printf("%-13s %9u %9u %9u %9u %8u %6u\n", name, sp->runCount,
+                                cyclesToNs(sp->minCycles),
+                                cyclesToNs(sp->totalCycles / sp->runCount),
+                                cyclesToNs(sp->maxCycles),
+                                sp->overrunCount, (unsigned int)sp->maxLateUs);
+    if (showHistogram) {
+        printf("             ");
+        for (i = 0 ; i < SCHEDULER_HISTOGRAM_BINS ; i++)
+            printf(" %u", (unsigned int)sp->histogram[i]);
+        printf("\n");
+    }
+}
+
+int
+schedulerCommand(int argc, char **argv)
+{
+    int i;
+    int showHistogram = 0;
+    struct schedulerTask *tp;
+    struct worstOffender *wp = &worstOffender[STATS_CONSOLE];
+
+    for (i = 1 ; i < argc ; i++) {
+        if (strcmp(argv[i], "hist") == 0) {
+            showHistogram = 1;
+        }
+        else if ((strcmp(argv[i], "budget") == 0) && (i == (argc - 2))) {
+            char *endp;
+            unsigned long l = strtoul(argv[++i], &endp, 0);
+            if ((*endp != '\0') || (l == 0)) {
+                printf("Bad loop budget\n");
+                return 1;
+            }
+            loopBudgetUs = l;
+        }
+        else {
+            printf("Usage: %s [hist] [budget us]\n", argv[0]);
+            return 1;
+        }
+    }
+    printf("Task          Pri  Period  Budget\n");
+    for (tp = tasks ; tp < &tasks[taskCount] ; tp++) {
+        printf("%-13s %3d %7u %7u\n", tp->name, tp->priority,
+                    (unsigned int)tp->periodUs, (unsigned int)tp->budgetUs);
+    }
+    printf("                   Runs    Min ns   Mean ns    Max ns Overruns Late us\n");
+    showStats("loop", &loopStats[STATS_CONSOLE], showHistogram);
+    statsReset(&loopStats[STATS_CONSOLE]);
+    for (tp = tasks ; tp < &tasks[taskCount] ; tp++) {
+        showStats(tp->name, &tp->stats[STATS_CONSOLE], showHistogram);
+        statsReset(&tp->stats[STATS_CONSOLE]);
+    }
+    if (showHistogram) {
+        printf("Histogram bin 0 is under 1 us, bin i is under 4^i us.\n");
+    }
+    printf("Loop budget %u us.", (unsigned int)loopBudgetUs);
+    if (wp->name) {
+        printf("  Worst pass %u ns at %u us, %s took %u ns.",
+                                      cyclesToNs(wp->loopCycles),
+                                      (unsigned int)wp->usSinceBoot, wp->name,
+                                      cyclesToNs(wp->runCycles));
+    }
+    printf("\n");
+    memset(wp, 0, sizeof *wp);
+    return 0;
+}
+
+/*
+ * Network readback
+ */
+static int
+fetchStats(uint32_t *args, struct timingStats *sp)
+{
+    int i, n = 0;
+
+    args[n++] = sp->runCount;
+    args[n++] = sp->runCount ? sp->minCycles : 0;
+    args[n++] = sp->runCount ? (sp->totalCycles / sp->runCount) : 0;
+    args[n++] = sp->maxCycles;
+    args[n++] = sp->overrunCount;
+    args[n++] = sp->maxLateUs;
+    for (i = 0 ; i < SCHEDULER_HISTOGRAM_BINS ; i++)
+        args[n++] = sp->histogram[i];
+    statsReset(sp);
+    return n;
+}
+
+int
+schedulerFetch(uint32_t *args)
+{
+    int i, n = 0;
+    struct worstOffender *wp = &worstOffender[STATS_NETWORK];
+
+    args[n++] = (taskCount << 16) | SCHEDULER_HISTOGRAM_BINS;
+    args[n++] = CYCLES_PER_SECOND;
+    args[n++] = loopBudgetUs;
+    for (i = 0 ; (wp->name != NULL) && (i < taskCount) ; i++) {
+        if (tasks[i].name == wp->name)
+            break;
+    }
+    args[n++] = wp->name ? i : UINT32_MAX;
+    args[n++] = wp->runCycles;
+    args[n++] = wp->loopCycles;
+    args[n++] = wp->usSinceBoot;
+    memset(wp, 0, sizeof *wp);
+    n += fetchStats(args + n, &loopStats[STATS_NETWORK]);
+    for (i = 0 ; i < taskCount ; i++)
+        n += fetchStats(args + n, &tasks[i].stats[STATS_NETWORK]);
+    return n;
+}
+
+int
+schedulerFetchName(int idx, uint32_t *args)
+{
+    size_t len;
+
+    if ((idx < 0) || (idx >= taskCount))
+        return -1;
+    len = strlen(tasks[idx].name) + 1;
+    memset(args, 0, (len + 3) & ~3);
+    memcpy(args, tasks[idx].name, len);
+    return (len + 3) / 4;
+}
@@ -0,0 +1,30 @@
+/*
+ * Cooperative main loop scheduler
+ *
+ * Foreground tasks (priority 0) run on every pass through the loop.
+ * After them the due background tasks run in priority (lowest number
+ * first) order, with ties going to the task that has waited longest,
+ * until the pass has used the loop budget.  At least one due background
+ * task runs on every pass.  Overdue tasks are promoted one priority level
+ * for every 10 ms they are late, so low priority tasks run late when the
+ * loop is busy but are never starved.
+ * Tasks can not be preempted, so a task that takes longer than its
+ * budget is simply counted as an overrun.
+ */
+
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include <stdint.h>
+
+#define SCHEDULER_PRIORITY_FOREGROUND   0
+#define SCHEDULER_HISTOGRAM_BINS        12
+
+void schedulerAddTask(const char *name, void (*crank)(void),
+                      int priority, uint32_t periodUs, uint32_t budgetUs);
+void schedulerRun(void);
+int schedulerCommand(int argc, char **argv);
+int schedulerFetch(uint32_t *args);
+int schedulerFetchName(int idx, uint32_t *args);
+
+#endif /* _SCHEDULER_H_ */
@@ -3,10 +3,16 @@
  *
  * Strictly speaking TFTP is limited to 32 MB, but this server will transfer
  * larger files with clients that wrap around from block 65535 to block 0.
+ *
+ * The blksize (RFC 2348), windowsize (RFC 7440) and tsize (RFC 2349)
+ * options are negotiated.  Requests without options get plain RFC 1350
+ * lock-step transfers of 512 byte blocks.
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <lwip/netif.h>
 #include <lwip/udp.h>
 #include "localOscillator.h"
 #include "ptGen.h"
@@ -14,6 +20,7 @@
 #include "ffs.h"
 #include "st7789v.h"
 #include "tftp.h"
+#include "trace.h"
 #include "util.h"
 #include "systemParameters.h"
 
@@ -24,9 +31,48 @@
 #define TFTP_OPCODE_DATA  3
 #define TFTP_OPCODE_ACK   4
 #define TFTP_OPCODE_ERROR 5
+#define TFTP_OPCODE_OACK  6
 
 #define TFTP_ERROR_ACCESS_VIOLATION 2
 
+#define TFTP_BLOCKSIZE_DEFAULT  512
+#define TFTP_BLOCKSIZE_MIN      8
+#define TFTP_BLOCKSIZE_MAX      65464   /* RFC 2348 */
+#define TFTP_WINDOWSIZE_MAX     16
+#define TFTP_REQUEST_STRINGS    12      /* Name, mode, and five options */
+
+/*
+ * Received data is staged and written in large sector-aligned chunks.
+ * This lets FatFs transfer whole clusters straight from the staging buffer
+ * rather than doing read-modify-write cycles through its sector buffer.
+ */
+#define TFTP_WRITE_BUFFER_SIZE  (64 * 1024)
+static char writeBuf[TFTP_WRITE_BUFFER_SIZE] __attribute__((aligned(64)));
+
+/*
+ * Transfer state
+ * Block numbers are kept as 32 bit values so that comparisons
+ * work across the wrap from block 65535 to block 0.
+ * For reads lastBlock is the last block acknowledged by the client,
+ * for writes it is the last block received in sequence.
+ */
+static struct transfer {
+    int          fileIndex;
+    FIL          fil;
+    FIL         *fp;
+    int          isRead;
+    unsigned int blockSize;
+    unsigned int windowSize;
+    uint32_t     lastBlock;
+    uint32_t     nextBlock;     /* Read: next block to send */
+    uint32_t     finalBlock;    /* Read: short block, 0 if not yet reached */
+    unsigned int sinceAck;      /* Write: blocks received since last ACK */
+    int          gapAcked;      /* Write: ACK already sent for this gap */
+    unsigned int writeCount;    /* Write: bytes in staging buffer */
+    uint32_t     byteCount;
+    uint32_t     usAtStart;
+} xfer = { .fileIndex = -1 };
+
 struct fileInfo {
     const char *name;
     const char *description;
@@ -34,6 +80,8 @@ struct fileInfo {
     int       (*postReceive)(void);
     void      (*commit)(void);
     void      (*defaults)(void);
+    int         uploadOnly;     /* Not read back at startup */
+    int       (*readback)(void);    /* Startup readback if not postReceive */
 };
 
 static int dummyPreTransmit(void)
@@ -62,11 +110,29 @@ static struct fileInfo fileTable[] = {
    {RF_TABLE_EEPROM_NAME, "Local oscillator table (RF)",
                                                     localOscillatorFetchRfEEPROM,
                                                     localOscillatorStashRfEEPROM,
-                                                    localOscRfCommitAll},
+                                                    localOscRfCommitAll,
+                                                    NULL,
+                                                    1},
    {PT_TABLE_EEPROM_NAME, "Local oscillator table (Pilot Tones)",
                                                     localOscillatorFetchPtEEPROM,
                                                     localOscillatorStashPtEEPROM,
-                                                    localOscPtCommitAll},
+                                                    localOscPtCommitAll,
+                                                    NULL,
+                                                    1},
+   {RF_TABLE_BINARY_NAME, "Local oscillator table (RF, binary)",
+                                                    localOscillatorFetchRfBinaryEEPROM,
+                                                    localOscillatorStashRfBinaryEEPROM,
+                                                    localOscRfCommitAll,
+                                                    NULL,
+                                                    0,
+                                                    localOscillatorReadbackRfBinaryEEPROM},
+   {PT_TABLE_BINARY_NAME, "Local oscillator table (Pilot Tones, binary)",
+                                                    localOscillatorFetchPtBinaryEEPROM,
+                                                    localOscillatorStashPtBinaryEEPROM,
+                                                    localOscPtCommitAll,
+                                                    NULL,
+                                                    0,
+                                                    localOscillatorReadbackPtBinaryEEPROM},
    {LMK04XX_TABLE_EEPROM_NAME, "LMK04XX register table",
                                                     rfClkFetchLMK04xxEEPROM,
                                                     rfClkStashLMK04xxEEPROM,
@@ -86,6 +152,10 @@ static struct fileInfo fileTable[] = {
                                                     ptGenFetchEEPROM,
                                                     ptGenStashEEPROM,
                                                     ptGenCommitAll},
+   {"TRACE.bin", "Debug event trace",
+                                                    traceWriteFile,
+                                                    dummyPostReceive,
+                                                    dummyCommit},
    {"BOOT.bin", "Bitsream + Software image",
                                                     dummyPreTransmit,
                                                     dummyPostReceive,
@@ -141,46 +211,110 @@ replyACK(struct udp_pcb *pcb, const ip_addr_t *fromAddr, u16_t fromPort,
     pbuf_free(p);
 }
 
+/*
+ * Send an option acknowledgement
+ */
+static void
+replyOACK(struct udp_pcb *pcb, const ip_addr_t *fromAddr, u16_t fromPort,
+          const char *options, int optionLength)
+{
+    int l = sizeof (u16_t) + optionLength;
+    struct pbuf *p;
+    u16_t *p16;
+
+    p = pbuf_alloc(PBUF_TRANSPORT, l, PBUF_RAM);
+    if (p == NULL) {
+        printf("Can't allocte TFTP OACK pbuf\n");
+        return;
+    }
+    p16 = (u16_t*)p->payload;
+    *p16++ = htons(TFTP_OPCODE_OACK);
+    memcpy(p16, options, optionLength);
+    udp_sendto(pcb, p, fromAddr, fromPort);
+    pbuf_free(p);
+}
+
+static void endTransfer(void);
+
 /*
  * Send a data packet
+ * Return number of bytes sent or -1 on failure.
+ * A file system error also ends the transfer.
  */
 static int
 sendBlock(struct udp_pcb *pcb, const ip_addr_t *fromAddr, u16_t fromPort,
-                                                             int block, FIL *fp)
+                                                                 uint32_t block)
 {
-    int n;
     unsigned int l;
     struct pbuf *p;
     u16_t *p16;
-    static char cbuf[512];
-    static int lastCount;
+    UINT nRead;
+    FRESULT fr;
+    FSIZE_t offset = (FSIZE_t)(block - 1) * xfer.blockSize;
 
-    if (fp == NULL) {
-        n = lastCount;
+    l = (2 * sizeof(u16_t)) + xfer.blockSize;
+    p = pbuf_alloc(PBUF_TRANSPORT, l, PBUF_RAM);
+    if (p == NULL) {
+        printf("Can't allocte TFTP DATA pbuf\n");
+        return -1;
     }
-    else {
-        UINT nRead;
-        FRESULT fr = f_read(fp, cbuf, sizeof cbuf, &nRead);
+    if (f_tell(xfer.fp) != offset) {
+        fr = f_lseek(xfer.fp, offset);
         if (fr != FR_OK) {
+            pbuf_free(p);
             replyERR(pcb, fromAddr, fromPort, ffsStrerror(fr));
-            return 0;
+            endTransfer();
+            return -1;
         }
-        n = nRead;
-    }
-    lastCount = n;
-    l = (2 * sizeof(u16_t)) + n;
-    p = pbuf_alloc(PBUF_TRANSPORT, l, PBUF_RAM);
-    if (p == NULL) {
-        printf("Can't allocte TFTP DATA pbuf\n");
-        return 0;
     }
     p16 = (u16_t*)p->payload;
+    fr = f_read(xfer.fp, p16 + 2, xfer.blockSize, &nRead);
+    if (fr != FR_OK) {
+        pbuf_free(p);
+        replyERR(pcb, fromAddr, fromPort, ffsStrerror(fr));
+        endTransfer();
+        return -1;
+    }
+    if (nRead < xfer.blockSize) {
+        pbuf_realloc(p, (2 * sizeof(u16_t)) + nRead);
+    }
     *p16++ = htons(TFTP_OPCODE_DATA);
     *p16++ = htons(block);
-    memcpy(p16, cbuf, n);
     udp_sendto(pcb, p, fromAddr, fromPort);
     pbuf_free(p);
-    return n;
+    return nRead;
+}
+
+/*
+ * Send data blocks until the window is full or the end of file is reached
+ */
+static void
+sendWindow(struct udp_pcb *pcb, const ip_addr_t *fromAddr, u16_t fromPort)
+{
+    while ((xfer.nextBlock <= (xfer.lastBlock + xfer.windowSize))
+        && ((xfer.finalBlock == 0) || (xfer.nextBlock <= xfer.finalBlock))) {
+        int n = sendBlock(pcb, fromAddr, fromPort, xfer.nextBlock);
+        if (n < 0) {
+            break;
+        }
+        if (n < xfer.blockSize) {
+            xfer.finalBlock = xfer.nextBlock;
+        }
+        xfer.nextBlock++;
+    }
+}
+
+/*
+ * Close file and forget transfer
+ */
+static void
+endTransfer(void)
+{
+    if (xfer.fp) {
+        f_close(xfer.fp);
+        xfer.fp = NULL;
+    }
+    xfer.fileIndex = -1;
 }
 
 /*
@@ -205,6 +339,333 @@ match(const char *name, const char *table)
     return 1;
 }
 
+/*
+ * Append an acknowledged option
+ */
+static int
+appendOption(char *buf, int l, const char *name, unsigned long value)
+{
+    l += sprintf(buf + l, "%s", name) + 1;
+    l += sprintf(buf + l, "%lu", value) + 1;
+    return l;
+}
+
+/*
+ * Largest block that fits in a single frame
+ */
+static unsigned int
+blockSizeLimit(void)
+{
+    unsigned int limit = TFTP_BLOCKSIZE_DEFAULT;
+    unsigned int overhead = 20 + 8 + (2 * sizeof(u16_t));
+
+    if (netif_default && (netif_default->mtu > (overhead + limit))) {
+        limit = netif_default->mtu - overhead;
+        if (limit > TFTP_BLOCKSIZE_MAX)
+            limit = TFTP_BLOCKSIZE_MAX;
+    }
+    return limit;
+}
+
+/*
+ * Handle a read or write request
+ * Options not recognized here are omitted from the OACK as RFC 2347 requires.
+ */
+static void
+handleRequest(struct udp_pcb *pcb, const ip_addr_t *fromAddr, u16_t fromPort,
+              int opcode, char *cp, int len)
+{
+    char *strings[TFTP_REQUEST_STRINGS];
+    int stringCount = 0, i, f;
+    const char *name, *mode;
+    unsigned long blockSize = 0, windowSize = 0, tsize = 0;
+    int wantTsize = 0;
+    char oack[100];
+    int oackLength = 0;
+    FRESULT fr;
+
+    endTransfer();
+    strings[stringCount++] = cp;
+    for (i = 0 ; (i < len) && (stringCount < TFTP_REQUEST_STRINGS) ; i++) {
+        if ((cp[i] == '\0') && ((i + 1) < len)) {
+            strings[stringCount++] = cp + i + 1;
+        }
+    }
+    if ((stringCount < 2) || (cp[len - 1] != '\0')) {
+        return;
+    }
+    name = strings[0];
+    mode = strings[1];
+    if (debugFlags & DEBUGFLAG_TFTP)
+        printf("NAME:%s  MODE:%s\n", name, mode);
+    for (i = 2 ; (i + 1) < stringCount ; i += 2) {
+        const char *option = strings[i];
+        unsigned long value = strtoul(strings[i + 1], NULL, 10);
+        if (debugFlags & DEBUGFLAG_TFTP)
+            printf("OPTION:%s  VALUE:%lu\n", option, value);
+        if (strcasecmp(option, "blksize") == 0) {
+            if (value >= TFTP_BLOCKSIZE_MIN) {
+                unsigned int limit = blockSizeLimit();
+                blockSize = value > limit ? limit : value;
+            }
+        }
+        else if (strcasecmp(option, "windowsize") == 0) {
+            if (value >= 1) {
+                windowSize = value > TFTP_WINDOWSIZE_MAX ? TFTP_WINDOWSIZE_MAX :
+                                                           value;
+            }
+        }
+        else if (strcasecmp(option, "tsize") == 0) {
+            wantTsize = 1;
+            tsize = value;
+        }
+    }
+
+    if (strcasecmp(mode, "octet") != 0) {
+        replyERR(pcb, fromAddr, fromPort, "Bad Type");
+        return;
+    }
+    for (f = 0 ; f < FILE_TABLE_SIZE ; f++) {
+        if (match(name, fileTable[f].name)) {
+            break;
+        }
+    }
+    if (f == FILE_TABLE_SIZE) {
+        replyERR(pcb, fromAddr, fromPort, "Bad Name");
+        return;
+    }
+    if (opcode == TFTP_OPCODE_RRQ) {
+        int (*funcp)(void) = fileTable[f].preTransmit;
+        if (funcp && ((*funcp)() < 0)) {
+            replyERR(pcb, fromAddr, fromPort, "Error Fetching File");
+            return;
+        }
+    }
+    fr = f_open(&xfer.fil, name, (opcode==TFTP_OPCODE_RRQ) ?
+                                           FA_READ :
+                                           FA_WRITE | FA_CREATE_ALWAYS);
+    if (fr != FR_OK) {
+        const char *msg = ffsStrerror(fr);
+        if (debugFlags & DEBUGFLAG_TFTP) {
+            printf("\"%s\" -- %s\n", name, msg);
+        }
+        replyERR(pcb, fromAddr, fromPort, msg);
+        return;
+    }
+    xfer.fp = &xfer.fil;
+    xfer.fileIndex = f;
+    xfer.isRead = (opcode == TFTP_OPCODE_RRQ);
+    xfer.blockSize = TFTP_BLOCKSIZE_DEFAULT;
+    xfer.windowSize = 1;
+    xfer.lastBlock = 0;
+    xfer.nextBlock = 1;
+    xfer.finalBlock = 0;
+    xfer.sinceAck = 0;
+    xfer.gapAcked = 0;
+    xfer.writeCount = 0;
+    xfer.byteCount = 0;
+    xfer.usAtStart = MICROSECONDS_SINCE_BOOT();
+
+    if (blockSize) {
+        xfer.blockSize = blockSize;
+        oackLength = appendOption(oack, oackLength, "blksize", blockSize);
+    }
+    if (windowSize) {
+        xfer.windowSize = windowSize;
+        oackLength = appendOption(oack, oackLength, "windowsize", windowSize);
+    }
+    if (wantTsize) {
+        if (opcode == TFTP_OPCODE_RRQ) {
+            tsize = f_size(xfer.fp);
+        }
+        oackLength = appendOption(oack, oackLength, "tsize", tsize);
+    }
+
+    /*
+     * With options the OACK takes the place of the first data block
+     * of a read or the ACK of block 0 of a write.
+     */
+    if (oackLength) {
+        replyOACK(pcb, fromAddr, fromPort, oack, oackLength);
+    }
+    else if (opcode == TFTP_OPCODE_RRQ) {
+        sendWindow(pcb, fromAddr, fromPort);
+    }
+    else {
+        replyACK(pcb, fromAddr, fromPort, 0);
+    }
+}
+
+/*
+ * Write staged data to file
+ * Return NULL on success, otherwise an error message for the client.
+ */
+static const char *
+writeFlush(void)
+{
+    UINT nWritten;
+    FRESULT fr;
+
+    if (xfer.writeCount == 0) {
+        return NULL;
+    }
+    fr = f_write(xfer.fp, writeBuf, xfer.writeCount, &nWritten);
+    if (fr != FR_OK) {
+        if (debugFlags & DEBUGFLAG_TFTP) {
+            printf("Write failed -- %s\n", ffsStrerror(fr));
+        }
+        return ffsStrerror(fr);
+    }
+    if (nWritten != xfer.writeCount) {
+        if (debugFlags & DEBUGFLAG_TFTP) {
+            printf("Write failed %d!=%d\n", (int)nWritten, xfer.writeCount);
+        }
+        return "Disk Full";
+    }
+    xfer.writeCount = 0;
+    return NULL;
+}
+
+/*
+ * Add data to staging buffer, writing to file each time the buffer fills
+ */
+static const char *
+writeAppend(const char *cp, unsigned int n)
+{
+    const char *err;
+
+    while (n) {
+        unsigned int space = TFTP_WRITE_BUFFER_SIZE - xfer.writeCount;
+        unsigned int count = n < space ? n : space;
+        memcpy(writeBuf + xfer.writeCount, cp, count);
+        xfer.writeCount += count;
+        xfer.byteCount += count;
+        cp += count;
+        n -= count;
+        if (xfer.writeCount == TFTP_WRITE_BUFFER_SIZE) {
+            if ((err = writeFlush()) != NULL) {
+                return err;
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Handle data from client
+ * Acknowledge at the end of each window, at the end of file,
+ * and once for each break in sequence (RFC 7440).
+ */
+static void
+handleData(struct udp_pcb *pcb, const ip_addr_t *fromAddr, u16_t fromPort,
+           const unsigned char *cp, int len)
+{
+    u16_t wireBlock = (cp[2] << 8) | cp[3];
+    uint32_t block = xfer.lastBlock + (u16_t)(wireBlock - (u16_t)xfer.lastBlock);
+    int nBytes = len - (2 * sizeof(u16_t));
+    int bytesTrans;
+    const char *err;
+    FRESULT fr;
+
+    if (block == xfer.lastBlock) {
+        xfer.sinceAck = 0;
+        replyACK(pcb, fromAddr, fromPort, wireBlock);
+        return;
+    }
+    if (block != (xfer.lastBlock + 1)) {
+        if (!xfer.gapAcked) {
+            xfer.gapAcked = 1;
+            xfer.sinceAck = 0;
+            replyACK(pcb, fromAddr, fromPort, xfer.lastBlock);
+        }
+        return;
+    }
+    xfer.lastBlock = block;
+    xfer.gapAcked = 0;
+    if ((nBytes > 0)
+     && ((err = writeAppend((const char *)(cp+4), nBytes)) != NULL)) {
+        replyERR(pcb, fromAddr, fromPort, err);
+        endTransfer();
+        return;
+    }
+    if (nBytes < xfer.blockSize) {
+        int fileIndex = xfer.fileIndex;
+        uint32_t us;
+        if ((err = writeFlush()) != NULL) {
+            replyERR(pcb, fromAddr, fromPort, err);
+            endTransfer();
+            return;
+        }
+        fr = f_close(xfer.fp);
+        xfer.fp = NULL;
+        xfer.fileIndex = -1;
+        if (fr != FR_OK) {
+            if (debugFlags & DEBUGFLAG_TFTP) {
+                printf("Close failed -- %s\n", ffsStrerror(fr));
+            }
+            replyERR(pcb, fromAddr, fromPort, ffsStrerror(fr));
+        }
+        else {
+            replyACK(pcb, fromAddr, fromPort, wireBlock);
+        }
+        if (debugFlags & DEBUGFLAG_TFTP) {
+            us = MICROSECONDS_SINCE_BOOT() - xfer.usAtStart;
+            printf("TFTP: %s %lu bytes in %lu ms (%lu kB/s)\n",
+                                fileTable[fileIndex].name,
+                                (unsigned long)xfer.byteCount,
+                                (unsigned long)(us / 1000),
+                                us ? (unsigned long)(((uint64_t)xfer.byteCount *
+                                                         1000) / us) : 0UL);
+        }
+
+        bytesTrans = 0;
+        int (*funcPostReceive)(void) = fileTable[fileIndex].postReceive;
+        if (funcPostReceive) {
+            bytesTrans = (*funcPostReceive)();
+            if (bytesTrans < 0) {
+                replyERR(pcb, fromAddr, fromPort, "Error Stashing File");
+            }
+        }
+
+        void (*funcCommit)(void) = fileTable[fileIndex].commit;
+        if (funcCommit && bytesTrans > 0) {
+            (*funcCommit)();
+        }
+        return;
+    }
+    if (++xfer.sinceAck >= xfer.windowSize) {
+        xfer.sinceAck = 0;
+        replyACK(pcb, fromAddr, fromPort, wireBlock);
+    }
+}
+
+/*
+ * Handle acknowledgement from client
+ * An acknowledgement of anything other than the last block sent
+ * restarts transmission from the block following the one acknowledged.
+ * Acknowledgements of blocks already acknowledged are ignored.
+ */
+static void
+handleAck(struct udp_pcb *pcb, const ip_addr_t *fromAddr, u16_t fromPort,
+          const unsigned char *cp)
+{
+    u16_t wireBlock = (cp[2] << 8) | cp[3];
+    uint32_t block = xfer.lastBlock + (u16_t)(wireBlock - (u16_t)xfer.lastBlock);
+
+    if (block >= xfer.nextBlock) {
+        return;
+    }
+    if (xfer.finalBlock && (block == xfer.finalBlock)) {
+        endTransfer();
+        return;
+    }
+    if (block != (xfer.nextBlock - 1)) {
+        xfer.nextBlock = block + 1;
+    }
+    xfer.lastBlock = block;
+    sendWindow(pcb, fromAddr, fromPort);
+}
+
 /*
  * Handle an incoming packet
  */
@@ -214,13 +675,6 @@ tftp_recv_callback(void *arg, struct udp_pcb *pcb, struct pbuf *p,
 {
     unsigned char *cp = p->payload;
     long addr = htonl(fromAddr->addr);
-    int ackBlock = -1;
-    static u16_t lastBlock;
-    static int lastSend;
-    int bytesTrans;
-    static int fileIndex = -1;
-    FRESULT fr;
-    static FIL fil, *fp;
 
     if (debugFlags & DEBUGFLAG_TFTP)
         printf("%3d on port %d from %d.%d.%d.%d:%d  %02X%02X %02X%02X\n",
@@ -239,148 +693,19 @@ tftp_recv_callback(void *arg, struct udp_pcb *pcb, struct pbuf *p,
         int opcode = (cp[0] << 8) | cp[1];
         if ((opcode == TFTP_OPCODE_RRQ)
          || (opcode == TFTP_OPCODE_WRQ)) {
-            char *name = (char *)cp + 2, *mode = NULL;
-            int nullCount = 0, i = 2;
-            lastBlock = 0;
-            fileIndex = -1;
-            while (i < p->len) {
-                if (cp[i++] == '\0') {
-                    nullCount++;
-                    if (nullCount == 1)
-                        mode = (char *)cp + i;
-
-                    if (nullCount == 2) {
-                        int f;
-                        if (debugFlags & DEBUGFLAG_TFTP)
-                            printf("NAME:%s  MODE:%s\n", name, mode);
-
-                        if (strcasecmp(mode, "octet") != 0) {
-                            replyERR(pcb, fromAddr, fromPort, "Bad Type");
-                        }
-                        else {
-                            for (f = 0 ; f < FILE_TABLE_SIZE ; f++) {
-                                if (match(name, fileTable[f].name)) {
-                                    fileIndex = f;
-                                    break;
-                                }
-                            }
-
-                            if (fileIndex < 0) {
-                                replyERR(pcb, fromAddr, fromPort, "Bad Name");
-                                break;
-                            }
-
-                            if (opcode == TFTP_OPCODE_RRQ) {
-                                int (*funcp)(void) = fileTable[fileIndex].preTransmit;
-                                if (funcp) {
-                                    bytesTrans = (*funcp)();
-                                    if (bytesTrans < 0) {
-                                        replyERR(pcb, fromAddr, fromPort, "Error Fetching File");
-                                        break;
-                                    }
-                                }
-                            }
-
-                            if (fp) {
-                                f_close(fp);
-                                fp = NULL;
-                            }
-                            fr = f_open(&fil, name, (opcode==TFTP_OPCODE_RRQ) ?
-                                                   FA_READ :
-                                                   FA_WRITE | FA_CREATE_ALWAYS);
-                            if (fr == FR_OK) {
-                                ackBlock = 0;
-                                fp = &fil;
-                            }
-                            else {
-                                const char *msg = ffsStrerror(fr);
-                                if (debugFlags & DEBUGFLAG_TFTP) {
-                                    printf("\"%s\" -- %s\n", name, msg);
-                                }
-                                replyERR(pcb, fromAddr, fromPort, msg);
-                            }
-                        }
-                        break;
-                    }
-                }
-            }
-            if ((ackBlock == 0) && (opcode == TFTP_OPCODE_RRQ)) {
-                ackBlock = -1;
-                lastBlock = 1;
-                lastSend = sendBlock(pcb, fromAddr, fromPort, lastBlock, fp);
-            }
+            handleRequest(pcb, fromAddr, fromPort, opcode,
+                                                    (char *)cp + 2, p->len - 2);
         }
-        else if (opcode == TFTP_OPCODE_DATA && fileIndex >= 0) {
-            int block = (cp[2] << 8) | cp[3];
-            if (block == lastBlock) {
-                ackBlock = block;
-            }
-            else if (block == (u16_t)(lastBlock + 1)) {
-                int nBytes = p->len - (2 * sizeof(u16_t));
-                lastBlock = block;
-                ackBlock = block;
-                if (nBytes > 0) {
-                    UINT nWritten;
-                    fr = f_write(fp, (char *)(cp+4), nBytes, &nWritten);
-                    if ((fr != FR_OK) || (nWritten != nBytes)) {
-                        ackBlock = -1;
-                        if (debugFlags & DEBUGFLAG_TFTP) {
-                            printf("Write failed %s %d!=%d\n", ffsStrerror(fr),
-                                                         (int)nWritten, nBytes);
-                        }
-                        replyERR(pcb, fromAddr, fromPort, ffsStrerror(fr));
-                    }
-                }
-                if (fp && (nBytes < 512)) {
-                    fr = f_close(fp);
-                    fp = NULL;
-                    if (fr != FR_OK) {
-                        ackBlock = -1;
-                        if (debugFlags & DEBUGFLAG_TFTP) {
-                            printf("Close failed -- %s\n", ffsStrerror(fr));
-                        }
-                        replyERR(pcb, fromAddr, fromPort, ffsStrerror(fr));
-                    }
-
-                    bytesTrans = 0;
-                    int (*funcPostReceive)(void) = fileTable[fileIndex].postReceive;
-                    if (funcPostReceive) {
-                        bytesTrans = (*funcPostReceive)();
-                        if (bytesTrans < 0) {
-                            replyERR(pcb, fromAddr, fromPort, "Error Stashing File");
-                        }
-                    }
-
-                    void (*funcCommit)(void) = fileTable[fileIndex].commit;
-                    if (funcCommit && bytesTrans > 0) {
-                        (*funcCommit)();
-                    }
-
-                    fileIndex = -1;
-                }
-            }
+        else if (opcode == TFTP_OPCODE_DATA && xfer.fileIndex >= 0
+                                            && !xfer.isRead) {
+            handleData(pcb, fromAddr, fromPort, cp, p->len);
         }
-        else if (opcode == TFTP_OPCODE_ACK && fileIndex >= 0) {
-            int block = (cp[2] << 8) | cp[3];
-            if (block == lastBlock) {
-                lastBlock++;
-                if (lastSend == 512) {
-                    lastSend = sendBlock(pcb, fromAddr, fromPort, lastBlock, fp);
-                }
-                else {
-                    f_close(fp);
-                    fp = NULL;
-                    fileIndex = -1;
-                }
-            }
-            else {
-                lastSend = sendBlock(pcb, fromAddr, fromPort, lastBlock, NULL);
-            }
+        else if (opcode == TFTP_OPCODE_ACK && xfer.fileIndex >= 0
+                                           && xfer.isRead) {
+            handleAck(pcb, fromAddr, fromPort, cp);
         }
     }
     pbuf_free(p);
-    if (ackBlock >= 0)
-        replyACK(pcb, fromAddr, fromPort, ackBlock);
 }
 
 /*
@@ -392,8 +717,13 @@ filesystemReadbacks(void)
     int i, bytesTrans;
 
     for (i = 0 ; i < FILE_TABLE_SIZE ; i++) {
+        if (fileTable[i].uploadOnly) {
+            continue;
+        }
         bytesTrans = 0;
-        int (*funcPostReceive)(void) = fileTable[i].postReceive;
+        int (*funcPostReceive)(void) = fileTable[i].readback ?
+                                                fileTable[i].readback :
+                                                fileTable[i].postReceive;
         if (funcPostReceive) {
             bytesTrans = (*funcPostReceive)();
             if (bytesTrans < 0) {
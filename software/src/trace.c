@@ -0,0 +1,129 @@
+/*
+ * Binary trace of hot path events
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ff.h>
+#include "trace.h"
+
+#define TRACE_FILE_NAME     "/TRACE.bin"
+#define TRACE_FILE_MAGIC    0x54524331  /* "TRC1" */
+
+struct traceRing traceRing;
+
+static const char *eventNames[TRACE_EV_COUNT] = {
+    [TRACE_EV_EPICS_RX]           = "EPICS_RX",
+    [TRACE_EV_EPICS_BAD_SIZE]     = "EPICS_BAD_SIZE",
+    [TRACE_EV_EPICS_COMMAND]      = "EPICS_COMMAND",
+    [TRACE_EV_EPICS_REPLY]        = "EPICS_REPLY",
+    [TRACE_EV_EPICS_BAD_MAGIC]    = "EPICS_BAD_MAGIC",
+    [TRACE_EV_WFR_REG_WRITE]      = "WFR_REG_WRITE",
+    [TRACE_EV_WFR_NO_PBUF]        = "WFR_NO_PBUF",
+    [TRACE_EV_WFR_BLOCK]          = "WFR_BLOCK",
+    [TRACE_EV_WFR_STREAM_OVERRUN] = "WFR_STREAM_OVERRUN",
+    [TRACE_EV_WFR_COMPLETE]       = "WFR_COMPLETE",
+    [TRACE_EV_WFR_ACK]            = "WFR_ACK",
+    [TRACE_EV_WFR_SEGMENT]        = "WFR_SEGMENT",
+    [TRACE_EV_WFR_HEADER]         = "WFR_HEADER",
+    [TRACE_EV_WFR_FULL]           = "WFR_FULL",
+    [TRACE_EV_WFR_SOFT_TRIGGER]   = "WFR_SOFT_TRIGGER",
+};
+
+/*
+ * Index of oldest entry and number of entries present
+ */
+static uint32_t
+traceExtent(uint32_t *first)
+{
+    uint32_t count = traceRing.count;
+
+    if (count > TRACE_CAPACITY) {
+        *first = count - TRACE_CAPACITY;
+        return TRACE_CAPACITY;
+    }
+    *first = 0;
+    return count;
+}
+
+/*
+ * Write trace to file for TFTP transfer.
+ * File is a header of magic, entry count and total events recorded,
+ * followed by the entries, oldest first, in native (little-endian) order.
+ */
+int
+traceWriteFile(void)
+{
+    FRESULT fr;
+    FIL fil;
+    UINT nWritten;
+    uint32_t i, first, n, header[3];
+    int ret = 0;
+
+    n = traceExtent(&first);
+    fr = f_open(&fil, TRACE_FILE_NAME, FA_WRITE | FA_CREATE_ALWAYS);
+    if (fr != FR_OK) {
+        return -1;
+    }
+    header[0] = TRACE_FILE_MAGIC;
+    header[1] = n;
+    header[2] = first + n;
+    if ((f_write(&fil, header, sizeof header, &nWritten) != FR_OK)
+     || (nWritten != sizeof header)) {
+        ret = -1;
+    }
+    for (i = 0 ; (ret == 0) && (i < n) ; i++) {
+        struct traceEntry *ep;
+        ep = &traceRing.entries[(first + i) & (TRACE_CAPACITY - 1)];
+        if ((f_write(&fil, ep, sizeof *ep, &nWritten) != FR_OK)
+         || (nWritten != sizeof *ep)) {
+            ret = -1;
+        }
+    }
+    if (f_close(&fil) != FR_OK) {
+        ret = -1;
+    }
+    return ret;
+}
+
+int
+traceCommand(int argc, char **argv)
+{
+    uint32_t i, first, n, showCount = 20;
+
+    if (argc > 1) {
+        char *endp;
+        if (strcmp(argv[1], "clear") == 0) {
+            traceRing.count = 0;
+            return 0;
+        }
+        showCount = strtoul(argv[1], &endp, 0);
+        if (*endp != '\0') {
+            printf("Usage: %s [count|clear]\n", argv[0]);
+            return 1;
+        }
+    }
+    n = traceExtent(&first);
+    printf("%u events recorded, %u in buffer\n", (unsigned int)(first + n),
+                                                 (unsigned int)n);
+    if (showCount < n) {
+        first += n - showCount;
+        n = showCount;
+    }
+    for (i = 0 ; i < n ; i++) {
+        struct traceEntry *ep;
+        const char *name = NULL;
+        ep = &traceRing.entries[(first + i) & (TRACE_CAPACITY - 1)];
+        if (ep->event < TRACE_EV_COUNT)
+            name = eventNames[ep->event];
+        printf("%10u ", (unsigned int)ep->usSinceBoot);
+        if (name)
+            printf("%-18s", name);
+        else
+            printf("EVENT_%-12u", (unsigned int)ep->event);
+        printf(" %08X %08X %08X\n", (unsigned int)ep->args[0],
+                                    (unsigned int)ep->args[1],
+                                    (unsigned int)ep->args[2]);
+    }
+    return 0;
+}
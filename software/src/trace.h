@@ -0,0 +1,88 @@
+/*
+ * Binary trace of hot path events
+ *
+ * Recording an event costs a few stores, so tracing can be left enabled
+ * without the timing changes caused by formatting and printing text.
+ * Events are recorded only when the corresponding debug flag is set.
+ * Not to be used from interrupt handlers.
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+#include "gpio.h"
+#include "util.h"
+
+/*
+ * Event identifiers.
+ * Keep in step with software/scripts/traceDecode.py.
+ */
+enum traceEvent {
+    TRACE_EV_EPICS_RX = 1,          /* length, IPv4 address, port */
+    TRACE_EV_EPICS_BAD_SIZE,        /* length */
+    TRACE_EV_EPICS_COMMAND,         /* command, argument count, args[0] */
+    TRACE_EV_EPICS_REPLY,           /* reply size */
+    TRACE_EV_EPICS_BAD_MAGIC,       /* magic */
+    TRACE_EV_WFR_REG_WRITE,         /* recorder, register offset, value */
+    TRACE_EV_WFR_NO_PBUF,           /* recorder, packet type */
+    TRACE_EV_WFR_BLOCK,             /* recorder, block, size */
+    TRACE_EV_WFR_STREAM_OVERRUN,    /* recorder, words discarded */
+    TRACE_EV_WFR_COMPLETE,          /* recorder, blocks resent */
+    TRACE_EV_WFR_ACK,               /* recorder, block */
+    TRACE_EV_WFR_SEGMENT,           /* recorder, segment, start */
+    TRACE_EV_WFR_HEADER,            /* recorder, acquisition count, byte count */
+    TRACE_EV_WFR_FULL,              /* recorder */
+    TRACE_EV_WFR_SOFT_TRIGGER,      /* DSBPM */
+    TRACE_EV_COUNT
+};
+
+/*
+ * Recorder identifier argument
+ */
+#define TRACE_RECORDER(dsbpm,recorder) (((dsbpm) << 8) | (recorder))
+
+/*
+ * Packet type argument to TRACE_EV_WFR_NO_PBUF
+ */
+#define TRACE_PACKET_PAYLOAD     0
+#define TRACE_PACKET_COMPRESSED  1
+#define TRACE_PACKET_HEADER      2
+
+#define TRACE_ARG_COUNT  3
+#define TRACE_CAPACITY   4096  /* Must be a power of 2 */
+
+struct traceEntry {
+    uint32_t usSinceBoot;
+    uint32_t event;
+    uint32_t args[TRACE_ARG_COUNT];
+};
+
+struct traceRing {
+    uint32_t          count;
+    struct traceEntry entries[TRACE_CAPACITY];
+};
+extern struct traceRing traceRing;
+
+static inline void
+traceRecord(uint32_t event, uint32_t a0, uint32_t a1, uint32_t a2)
+{
+    struct traceEntry *ep;
+
+    ep = &traceRing.entries[traceRing.count++ & (TRACE_CAPACITY - 1)];
+    ep->usSinceBoot = MICROSECONDS_SINCE_BOOT();
+    ep->event = event;
+    ep->args[0] = a0;
+    ep->args[1] = a1;
+    ep->args[2] = a2;
+}
+
+#define TRACE(flag,event,a0,a1,a2) do {                 \
+        if (debugFlags & (flag))                        \
+            traceRecord((event), (a0), (a1), (a2));     \
+    } while (0)
+
+int traceWriteFile(void);
+int traceCommand(int argc, char **argv);
+
+#endif /* _TRACE_H_ */
@@ -24,6 +24,7 @@ fatal(const char *fmt, ...)
     va_start(args, fmt);
     vsnprintf(cbuf, sizeof cbuf, fmt, args);
     va_end(args);
+    consoleSynchronousOutput();
     displayShowFatal(cbuf);
     printf("*** Fatal error: %s\n", cbuf);
     while ((GPIO_READ(GPIO_IDX_SECONDS_SINCE_BOOT) - then) < 60) {
@@ -70,6 +71,7 @@ showReg(unsigned int i)
 void
 resetFPGA(void)
 {
+    consoleSynchronousOutput();
     st7789vBacklightEnable(0);
     st7789vFlood(0, 0, DISPLAY_WIDTH, DISPLAY_HEIGHT, 0);
     st7789vAwaitCompletion();
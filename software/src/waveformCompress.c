@@ -0,0 +1,82 @@
+/*
+ * Lossless waveform block compression
+ */
+#include <stdint.h>
+#include "waveformCompress.h"
+
+static inline uint32_t
+atomAt(const uint8_t *src, size_t i, unsigned int bytesPerAtom)
+{
+    if (bytesPerAtom == 2)
+        return src[2*i] | (src[2*i+1] << 8);
+    return src[4*i] | (src[4*i+1] << 8) |
+           (src[4*i+2] << 16) | ((uint32_t)src[4*i+3] << 24);
+}
+
+static inline uint32_t
+zigzag(uint32_t v, unsigned int bytesPerAtom)
+{
+    if (bytesPerAtom == 2) {
+        int16_t d = (int16_t)v;
+        return (uint16_t)(((uint16_t)d << 1) ^ (uint16_t)(d >> 15));
+    }
+    else {
+        int32_t d = (int32_t)v;
+        return ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+    }
+}
+
+size_t
+waveformCompress(void *dst, const void *src, size_t length,
+                 unsigned int bytesPerAtom, unsigned int stride)
+{
+    const uint8_t *in = src;
+    uint8_t *out = dst;
+    uint8_t *limit = out + length;
+    size_t count, i, n;
+    uint32_t zz[WFC_GROUP_SIZE];
+
+    if (((bytesPerAtom != 2) && (bytesPerAtom != 4)) || (stride == 0))
+        return 0;
+    count = length / bytesPerAtom;
+    if ((count * bytesPerAtom) != length)
+        return 0;
+    for (i = 0 ; i < count ; i += n) {
+        uint32_t all = 0;
+        unsigned int width = 0, j;
+        uint64_t acc = 0;
+        unsigned int accBits = 0;
+
+        n = count - i;
+        if (n > WFC_GROUP_SIZE)
+            n = WFC_GROUP_SIZE;
+        for (j = 0 ; j < n ; j++) {
+            uint32_t v = atomAt(in, i + j, bytesPerAtom);
+            if ((i + j) >= stride)
+                v -= atomAt(in, i + j - stride, bytesPerAtom);
+            zz[j] = zigzag(v, bytesPerAtom);
+            all |= zz[j];
+        }
+        while (all) {
+            width++;
+            all >>= 1;
+        }
+        if ((out + 1 + ((n * width) + 7) / 8) >= limit)
+            return 0;
+        *out++ = width;
+        if (width == 0)
+            continue;
+        for (j = 0 ; j < n ; j++) {
+            acc |= (uint64_t)zz[j] << accBits;
+            accBits += width;
+            while (accBits >= 8) {
+                *out++ = acc;
+                acc >>= 8;
+                accBits -= 8;
+            }
+        }
+        if (accBits)
+            *out++ = acc;
+    }
+    return out - (uint8_t *)dst;
+}
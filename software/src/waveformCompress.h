@@ -0,0 +1,30 @@
+/*
+ * Lossless waveform block compression
+ *
+ * A block is a sequence of little-endian atoms, 2 or 4 bytes each,
+ * interleaved across 'stride' channels.  Each atom is replaced by the
+ * difference from the previous atom of the same channel.  The first
+ * sample of a block is differenced against zero so that every block
+ * can be decoded on its own.  Differences are zig-zag encoded
+ * (0, -1, 1, -2, 2 ... become 0, 1, 2, 3, 4 ...) and packed in groups
+ * of WFC_GROUP_SIZE values.  Each group is a byte holding the number of
+ * bits per value followed by the values, least significant bit first,
+ * padded to a byte boundary.
+ */
+
+#ifndef _WAVEFORM_COMPRESS_H_
+#define _WAVEFORM_COMPRESS_H_
+
+#include <stddef.h>
+
+#define WFC_GROUP_SIZE  32
+
+/*
+ * Compress 'length' bytes from src to dst.
+ * Returns the compressed length, or 0 if the result would be no
+ * smaller than the original (dst must have room for 'length' bytes).
+ */
+size_t waveformCompress(void *dst, const void *src, size_t length,
+                        unsigned int bytesPerAtom, unsigned int stride);
+
+#endif /* _WAVEFORM_COMPRESS_H_ */
@@ -3,14 +3,20 @@
  */
 
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
 #include <xil_cache.h>
+#include <xil_mmu.h>
 #include <xparameters.h>
+#include <xtime_l.h>
+#include <lwip/netif.h>
 #include "dsbpmProtocol.h"
 #include "waveformRecorder.h"
 #include "gpio.h"
 #include "util.h"
 #include "memcpy2.h"
+#include "trace.h"
+#include "waveformCompress.h"
 
 #define MAX_RECORDERS                   16
 
@@ -26,7 +32,9 @@
 #define WR_CSR_EVENT_TRIGGER_6_ENABLE   0x40000000
 #define WR_CSR_EVENT_TRIGGER_5_ENABLE   0x20000000
 #define WR_CSR_EVENT_TRIGGER_4_ENABLE   0x10000000
+#define WR_CSR_LOSS_OF_BEAM_TRIGGER_ENABLE 0x02000000
 #define WR_CSR_SOFT_TRIGGER_ENABLE      0x01000000
+#define WR_CSR_CONTINUOUS_MODE          0x400
 #define WR_CSR_TEST_ACQUISITION_MODE    0x200
 #define WR_CSR_DIAGNOSTIC_MODE          0x100
 #define WR_CSR_ARM                      0x1
@@ -38,6 +46,8 @@
 #define WR_CSR_AXI_FIFO_OVERRUN          0x10
 #define WR_CSR_AXI_BRESP_MASK            0x60
 #define WR_CSR_IS_FULL                   0x80
+#define WR_CSR_SEGMENTS_DONE_MASK        0xFE0000
+#define WR_CSR_SEGMENTS_DONE_SHIFT       17
 
 /*
  * Register offsets
@@ -49,6 +59,20 @@
 #define WR_REG_OFFSET_ADDRESS_MSB_POINTER  4
 #define WR_REG_OFFSET_TIMESTAMP_SECONDS    5
 #define WR_REG_OFFSET_TIMESTAMP_FRACTION      6
+#define WR_REG_OFFSET_WRITE_COUNT          7
+
+/*
+ * Write-only segmented acquisition registers.
+ * Once a segmented acquisition is complete the address and timestamp
+ * registers show the values for the selected segment.
+ */
+#define WR_REG_OFFSET_SEGMENT_SHIFT        5
+#define WR_REG_OFFSET_SEGMENT_SELECT       6
+
+/*
+ * Segments must hold at least one full-length AXI burst
+ */
+#define SEGMENT_WORDS_MIN   64
 
 
 /*
@@ -59,17 +83,118 @@
 #define isArmed(rp)       (WR_READ(rp, WR_REG_OFFSET_CSR) & WR_CSR_ARM)
 #define MAX_BYTES_PER_ATOM 4
 
+/*
+ * Data packets normally reference the recorder buffer directly rather
+ * than copying it into a freshly allocated pbuf.  The Ethernet driver
+ * flushes the referenced lines from the cache before starting DMA.
+ * That works only if the GEM, a low power domain bus master, has a path
+ * to the buffer.  Processor DDR is always reachable.  The recorder buffers
+ * are in PL DDR behind the PS master ports (0x5_0000_0000 in the current
+ * block design), and whether the GEM reaches them there depends on the
+ * interconnect and XMPU set up for the board, so set WFR_EMAC_DMA_PL_DDR
+ * only for a design where that has been confirmed.  Otherwise data is
+ * copied.  Without 64-bit descriptors nothing above 4 GiB is reachable.
+ */
+#ifndef WFR_EMAC_DMA_PL_DDR
+# define WFR_EMAC_DMA_PL_DDR 0
+#endif
+static int
+emacCanDMA(UINTPTR base, UINTPTR length)
+{
+    uint64_t end = (uint64_t)base + length;
+
+#if !defined(__aarch64__)
+    if (end > 0x100000000ULL)
+        return 0;
+#endif
+    if (WFR_EMAC_DMA_PL_DDR)
+        return 1;
+#ifdef XPAR_PSU_DDR_0_S_AXI_BASEADDR
+    if ((base >= XPAR_PSU_DDR_0_S_AXI_BASEADDR)
+     && (end <= ((uint64_t)XPAR_PSU_DDR_0_S_AXI_HIGHADDR + 1)))
+        return 1;
+#endif
+#ifdef XPAR_PSU_DDR_1_S_AXI_BASEADDR
+    if ((base >= XPAR_PSU_DDR_1_S_AXI_BASEADDR)
+     && (end <= ((uint64_t)XPAR_PSU_DDR_1_S_AXI_HIGHADDR + 1)))
+        return 1;
+#endif
+    return 0;
+}
+static int forceCopy;
+
+/*
+ * The recorders write to PL DDR behind the processor's back.  Choose
+ * at build time how the processor is kept from reading stale lines:
+ *  WFR_CACHE_FLUSH_ALL      Clean and invalidate the entire data cache.
+ *  WFR_CACHE_FLUSH_RANGE    Clean and invalidate only the acquired bytes.
+ *                           Long acquisitions fall back to the entire
+ *                           cache since set/way maintenance is then
+ *                           cheaper than walking every line by address.
+ *  WFR_CACHE_NONCACHEABLE   Map recorder buffers as normal non-cacheable
+ *                           memory.  No maintenance, slower reads.
+ *  WFR_CACHE_COHERENT       No maintenance.  Only valid if the gateware
+ *                           routes recorder writes through a coherent
+ *                           (HPC/ACE-Lite) port, which the current PL
+ *                           DDR design does not.
+ * Range maintenance uses clean and invalidate rather than invalidate
+ * alone since the latter discards dirty lines sharing the buffer edges.
+ */
+#define WFR_CACHE_FLUSH_ALL     0
+#define WFR_CACHE_FLUSH_RANGE   1
+#define WFR_CACHE_NONCACHEABLE  2
+#define WFR_CACHE_COHERENT      3
+#ifndef WFR_CACHE_STRATEGY
+# define WFR_CACHE_STRATEGY WFR_CACHE_FLUSH_RANGE
+#endif
+#define WFR_CACHE_RANGE_LIMIT   (8*1024*1024)
+
 /*
  * Communication with IOC
  */
 #define TIMEOUT_US      1000000 // 1s
 #define RETRY_LIMIT     10
 
+/*
+ * Transmit scheduling.
+ * Windowed transfers from all recorders are interleaved.  Recorders
+ * with a numerically lower priority are served first and those with
+ * equal priority take turns a block at a time.
+ */
+#define TX_PRIORITY_COUNT   4
+
+/*
+ * Post-mortem readout.
+ * Selected recorders are also triggered by loss of beam and
+ * acquisitions that end after a loss of beam are sent ahead of
+ * everything else.  Loss-of-beam onset is found by polling so the
+ * measured latency includes up to one main loop pass of detection delay.
+ */
+static struct lossOfBeamState {
+    unsigned int status;
+    unsigned int onsetCount;
+    uint32_t     usAtOnset;
+} lossOfBeam[CFG_DSBPM_COUNT];
+static struct {
+    unsigned int count;
+    uint32_t     usLatest;
+    uint32_t     usMax;
+} postMortemLatency;
+
+/*
+ * Continuous streaming.
+ * Send a partly-filled packet if data have been waiting this long.
+ * Declare an overrun if the recorder gets within 1/8 of the buffer
+ * of lapping the reader and resume half a buffer behind the writer.
+ */
+#define STREAM_FLUSH_US     20000
+#define STREAM_GUARD(rp)    ((rp)->acqByteCapacity / 8)
+
 /*
  * Information for a single recorder
  */
 struct recorderData {
-    enum { CS_IDLE, CS_HEADER, CS_ACTIVE } commState;
+    enum { CS_IDLE, CS_HEADER, CS_ACTIVE, CS_STREAM } commState;
     char           *acqBuf;
     unsigned int    acqByteCapacity;
     unsigned int    acqSampleCapacity;
@@ -86,11 +211,71 @@ struct recorderData {
     unsigned int    recorderNumber;
     unsigned int    waveformNumber;
     unsigned int    startByteOffset;
-    unsigned int    bytesLeft;
-    unsigned int    bytesInPreviousPacket;
+    unsigned int    byteCount;
+    unsigned int    blockSize;
+    unsigned int    blockCount;
+    int             isCompressed;
     uint32_t        sysUsAtPreviousPacket;
     unsigned int    retryCount;
-    int             txBlock;
+    unsigned int    txBlock;
+
+    /*
+     * Windowed transfer state.
+     * Bit N of the masks refers to block ackBlock+N.
+     */
+    int             isWindowed;
+    unsigned int    windowSize;
+    unsigned int    ackBlock;
+    unsigned int    resendMask;
+    unsigned int    resentMask;
+    unsigned int    resendCount;
+    unsigned int    txPriority;
+
+    /*
+     * Post-mortem readout
+     */
+    int             isPostMortem;
+    int             isPostMortemTransfer;
+    unsigned int    lossOfBeamOnsetAtArm;
+    unsigned int    lossOfBeamStatus;
+
+    /*
+     * Segmented acquisition.
+     * Each segment is a ring buffer of its own occupying
+     * 1/(2**segmentShift) of the recorder buffer.
+     * Start offsets are relative to the beginning of the segment.
+     */
+    unsigned int    segmentShift;
+    unsigned int    acqSegmentShift;
+    unsigned int    segmentCount;
+    unsigned int    segmentBytes;
+    unsigned int    segmentStart[DSBPM_PROTOCOL_WAVEFORM_SEGMENT_CAPACITY];
+    struct dsbpmWaveformSegment segments[DSBPM_PROTOCOL_WAVEFORM_SEGMENT_CAPACITY];
+
+    /*
+     * Continuous streaming state
+     */
+    int             canStream;
+    unsigned int    bytesPerWord;
+    uint64_t        streamWords;
+    unsigned int    streamSequence;
+    unsigned int    streamOverruns;
+
+    /*
+     * Packet creation
+     */
+    int             isZeroCopy;
+    unsigned int    packetCount;
+    uint64_t        packetTicks;
+    uint64_t        compressionIn;
+    uint64_t        compressionOut;
+
+    /*
+     * Main loop stall for cache maintenance on acquisition completion
+     */
+    unsigned int    fillCount;
+    uint64_t        fillTicks;
+    uint64_t        fillTicksMax;
 };
 static struct recorderData recorderData[CFG_DSBPM_COUNT][CFG_NUM_RECORDERS];
 
@@ -118,12 +303,8 @@ showRec(struct recorderData *rp)
 static void
 wrWrite(struct recorderData *rp, int regOffset, uint32_t val)
 {
-    if (debugFlags & DEBUGFLAG_WAVEFORM_HEAD) {
-        printf("WFR %d:%d R%d <- ", rp->dsbpmNumber,
-                                    rp->recorderNumber,
-                                    regOffset);
-        showWfrReg(NULL, val);
-    }
+    TRACE(DEBUGFLAG_WAVEFORM_HEAD, TRACE_EV_WFR_REG_WRITE,
+                    TRACE_RECORDER(rp->dsbpmNumber, rp->recorderNumber), regOffset, val);
     WR_WRITE(rp, regOffset, val);
 }
 
@@ -140,12 +321,33 @@ const UINTPTR ext_ddr_start[CFG_DSBPM_COUNT] =
     (UINTPTR)&_ext_ddr_1_start,
 };
 
+#if WFR_CACHE_STRATEGY == WFR_CACHE_NONCACHEABLE
+/*
+ * Translation table granularity is 2 MiB below 4 GiB and 1 GiB above.
+ * Nothing other than recorder buffers is placed in PL DDR so marking
+ * whole sections is safe.
+ */
+static void
+mapNoncacheable(UINTPTR base, UINTPTR length)
+{
+    UINTPTR end = base + length;
+
+    Xil_DCacheFlush();
+    while (base < end) {
+        UINTPTR section = (base < 0x100000000ULL) ? 0x200000 : 0x40000000;
+        base &= ~(section - 1);
+        Xil_SetTlbAttributes(base, NORM_NONCACHE);
+        base += section;
+    }
+}
+#endif
+
 void
 wfrInit(unsigned int bpm)
 {
     int i, r;
     int bytesPerSample, bytesPerAtom, pretrigCount, acqCount, maxPretrig, acqSampleCapacity;
-    int cyclesPerWord;
+    int cyclesPerWord, txPriority, canStream;
     struct recorderData *rp;
     static UINTPTR iBufBase[CFG_DSBPM_COUNT];
 
@@ -159,6 +361,7 @@ wfrInit(unsigned int bpm)
         iBufBase[bpm] = ext_ddr_start[bpm];
     }
     for (i = 0 ; i < CFG_NUM_RECORDERS ; i++) {
+        canStream = 0;
         switch(i) {
         case 0:
             r = GPIO_IDX_ADC_RECORDER_BASE + bpm*GPIO_IDX_RECORDER_PER_DSBPM;
@@ -169,6 +372,7 @@ wfrInit(unsigned int bpm)
             maxPretrig = CFG_RECORDER_ADC_SAMPLE_CAPACITY;
             pretrigCount = 40;
             acqCount = 10000;
+            txPriority = 3;
             break;
 
         case 1:
@@ -180,6 +384,7 @@ wfrInit(unsigned int bpm)
             maxPretrig = CFG_RECORDER_TBT_SAMPLE_CAPACITY;
             pretrigCount = 40;
             acqCount = 10000;
+            txPriority = 1;
             break;
 
         case 2:
@@ -191,6 +396,7 @@ wfrInit(unsigned int bpm)
             maxPretrig = CFG_RECORDER_FA_SAMPLE_CAPACITY;
             pretrigCount = 40;
             acqCount = 1000;
+            txPriority = 1;
             break;
 
         case 3: case 4:
@@ -203,6 +409,7 @@ wfrInit(unsigned int bpm)
             maxPretrig = CFG_RECORDER_PT_SAMPLE_CAPACITY;
             pretrigCount = 40;
             acqCount = 1000;
+            txPriority = 2;
             break;
 
         case 5:
@@ -214,6 +421,8 @@ wfrInit(unsigned int bpm)
             maxPretrig = CFG_RECORDER_TBT_POS_SAMPLE_CAPACITY;
             pretrigCount = 40;
             acqCount = 10000;
+            txPriority = 0;
+            canStream = 1;
             break;
 
         case 6:
@@ -225,6 +434,8 @@ wfrInit(unsigned int bpm)
             maxPretrig = CFG_RECORDER_FA_POS_SAMPLE_CAPACITY;
             pretrigCount = 40;
             acqCount = 1000;
+            txPriority = 0;
+            canStream = 1;
             break;
 
         default: fatal("Waveform recorder defines mangled!");
@@ -243,6 +454,9 @@ wfrInit(unsigned int bpm)
         rp->cyclesPerWord = cyclesPerWord;
         rp->bytesPerAtom = bytesPerAtom;
         rp->commState = CS_IDLE;
+        rp->txPriority = txPriority;
+        rp->canStream = canStream;
+        rp->bytesPerWord = bytesPerSample * cyclesPerWord;
         rp->dsbpmNumber = bpm;
         rp->recorderNumber = i;
         rp->waveformNumber = 1;
@@ -253,8 +467,12 @@ wfrInit(unsigned int bpm)
         wrWrite(rp, WR_REG_OFFSET_CSR, rp->csrModeBits);
         rp->acqSampleCapacity = acqSampleCapacity * cyclesPerWord;
         rp->acqByteCapacity = bytesPerSample * acqSampleCapacity * cyclesPerWord;
+        rp->isZeroCopy = emacCanDMA(iBufBase[bpm], rp->acqByteCapacity);
         iBufBase[bpm] += rp->acqByteCapacity;
     }
+#if WFR_CACHE_STRATEGY == WFR_CACHE_NONCACHEABLE
+    mapNoncacheable(ext_ddr_start[bpm], iBufBase[bpm] - ext_ddr_start[bpm]);
+#endif
 }
 
 /*
@@ -268,72 +486,437 @@ recorderPointer(unsigned int bpm, unsigned int recorder)
     return &recorderData[bpm][recorder];
 }
 
+/*
+ * Largest block that fits in a single frame.
+ * Allow for the larger compressed data header since a block
+ * that doesn't compress is sent as is.
+ */
+#define BLOCK_SIZE_LIMIT    16384
+static unsigned int
+blockCapacity(void)
+{
+    unsigned int capacity = DSBPM_PROTOCOL_WAVEFORM_PAYLOAD_CAPACITY;
+    unsigned int overhead = 20 + 8 +
+                        offsetof(struct dsbpmWaveformCompressedData, payload);
+
+    if (netif_default && (netif_default->mtu > overhead)) {
+        capacity = netif_default->mtu - overhead;
+        if (capacity > BLOCK_SIZE_LIMIT)
+            capacity = BLOCK_SIZE_LIMIT;
+        capacity -= capacity % DSBPM_PROTOCOL_WAVEFORM_BLOCK_ALIGNMENT;
+    }
+    return capacity;
+}
+
+static void
+setBlockSize(struct recorderData *rp, unsigned int blockSize)
+{
+    unsigned int capacity = blockCapacity();
+
+    blockSize -= blockSize % DSBPM_PROTOCOL_WAVEFORM_BLOCK_ALIGNMENT;
+    if (blockSize == 0)
+        blockSize = DSBPM_PROTOCOL_WAVEFORM_PAYLOAD_CAPACITY;
+    if (blockSize > capacity)
+        blockSize = capacity;
+    rp->blockSize = blockSize;
+    rp->blockCount = (rp->byteCount + blockSize - 1) / blockSize;
+}
+
+/*
+ * Chain a reference to a section of the recorder buffer onto a packet
+ */
+static int
+appendReference(struct pbuf *p, char *base, unsigned int length)
+{
+    struct pbuf *r = pbuf_alloc(PBUF_RAW, length, PBUF_REF);
+
+    if (r == NULL)
+        return 0;
+    r->payload = base;
+    pbuf_cat(p, r);
+    return 1;
+}
+
+/*
+ * Find the contiguous section of the recorder buffer holding the
+ * acquisition bytes starting at 'offset'.  Return the buffer offset
+ * and reduce *length to the size of the section.  A section ends at
+ * the end of the ring buffer or, for segmented acquisitions, at the
+ * end of the segment or of the segment's own ring buffer.
+ */
+static unsigned int
+acquisitionSpan(struct recorderData *rp, unsigned int offset,
+                unsigned int *length)
+{
+    unsigned int capacity, base, start;
+
+    if (rp->segmentCount) {
+        unsigned int segment = offset / rp->segmentBytes;
+        unsigned int segmentOffset = offset % rp->segmentBytes;
+        capacity = rp->acqByteCapacity >> rp->acqSegmentShift;
+        base = segment * capacity;
+        start = (rp->segmentStart[segment] + segmentOffset) % capacity;
+        if (*length > (rp->segmentBytes - segmentOffset))
+            *length = rp->segmentBytes - segmentOffset;
+    }
+    else {
+        capacity = rp->acqByteCapacity;
+        base = 0;
+        start = (rp->startByteOffset + offset) % capacity;
+    }
+    if (*length > (capacity - start))
+        *length = capacity - start;
+    return base + start;
+}
+
+#if (WFR_CACHE_STRATEGY == WFR_CACHE_FLUSH_RANGE) || \
+    (WFR_CACHE_STRATEGY == WFR_CACHE_FLUSH_ALL)
+/*
+ * Clean and invalidate a section of the acquisition
+ */
+static void
+flushRing(struct recorderData *rp, unsigned int offset, unsigned int length)
+{
+    while (length) {
+        unsigned int n = length;
+        unsigned int b = acquisitionSpan(rp, offset, &n);
+        Xil_DCacheFlushRange((INTPTR)(rp->acqBuf + b), n);
+        offset += n;
+        length -= n;
+    }
+}
+#endif
+
+/*
+ * Create a packet with room for a header followed by a section of the
+ * acquisition.  The section may wrap around the end of the buffer or
+ * span segments so may be made up of more than one piece.
+ */
+static struct pbuf *
+payloadPacket(struct recorderData *rp, unsigned int headerLength,
+              unsigned int offset, unsigned int dataLength)
+{
+    unsigned int packetLength, done, n, b;
+    struct pbuf *p;
+    XTime then, now;
+    int isZeroCopy = rp->isZeroCopy && !forceCopy;
+
+    XTime_GetTime(&then);
+    packetLength = headerLength;
+    if (!isZeroCopy)
+        packetLength += dataLength;
+
+    /*
+     * Create the packet
+     */
+    p = pbuf_alloc(PBUF_TRANSPORT, packetLength, PBUF_RAM);
+    if (p && isZeroCopy) {
+        /* Reference each piece */
+        for (done = 0 ; done < dataLength ; done += n) {
+            n = dataLength - done;
+            b = acquisitionSpan(rp, offset + done, &n);
+            if (!appendReference(p, rp->acqBuf + b, n)) {
+                pbuf_free(p);
+                p = NULL;
+                break;
+            }
+        }
+    }
+    if (p == NULL) {
+        TRACE(DEBUGFLAG_WAVEFORM_XFER, TRACE_EV_WFR_NO_PBUF,
+                    TRACE_RECORDER(rp->dsbpmNumber, rp->recorderNumber), TRACE_PACKET_PAYLOAD, 0);
+        return NULL;
+    }
+    if (!isZeroCopy) {
+        char *cp = (char *)p->payload + headerLength;
+        for (done = 0 ; done < dataLength ; done += n) {
+            n = dataLength - done;
+            b = acquisitionSpan(rp, offset + done, &n);
+            memcpy2(cp + done, rp->acqBuf + b, n);
+        }
+    }
+    XTime_GetTime(&now);
+    rp->packetTicks += now - then;
+    rp->packetCount++;
+    rp->sysUsAtPreviousPacket = MICROSECONDS_SINCE_BOOT();
+    return p;
+}
+
+/*
+ * Create a compressed data packet.
+ * Blocks made up of more than one piece are first
+ * gathered into a contiguous buffer.
+ */
+static struct pbuf *
+compressedPacket(struct recorderData *rp, unsigned int offset,
+                 unsigned int dataLength)
+{
+    static char scratch[BLOCK_SIZE_LIMIT];
+    const unsigned int headerLength =
+                        offsetof(struct dsbpmWaveformCompressedData, payload);
+    const char *src;
+    unsigned int done, span, b;
+    struct dsbpmWaveformCompressedData *cp;
+    struct pbuf *p;
+    size_t n;
+    XTime then, now;
+
+    XTime_GetTime(&then);
+    p = pbuf_alloc(PBUF_TRANSPORT, headerLength + dataLength, PBUF_RAM);
+    if (p == NULL) {
+        TRACE(DEBUGFLAG_WAVEFORM_XFER, TRACE_EV_WFR_NO_PBUF,
+                    TRACE_RECORDER(rp->dsbpmNumber, rp->recorderNumber), TRACE_PACKET_COMPRESSED, 0);
+        return NULL;
+    }
+    span = dataLength;
+    b = acquisitionSpan(rp, offset, &span);
+    src = rp->acqBuf + b;
+    if (span < dataLength) {
+        for (done = 0 ; done < dataLength ; done += span) {
+            span = dataLength - done;
+            b = acquisitionSpan(rp, offset + done, &span);
+            memcpy2(scratch + done, rp->acqBuf + b, span);
+        }
+        src = scratch;
+    }
+    cp = (struct dsbpmWaveformCompressedData *)p->payload;
+    n = waveformCompress(cp->payload, src, dataLength, rp->bytesPerAtom,
+                                          rp->bytesPerSample / rp->bytesPerAtom);
+    if (n) {
+        cp->compressed = 1;
+        pbuf_realloc(p, headerLength + n);
+    }
+    else {
+        cp->compressed = 0;
+        memcpy2(cp->payload, src, dataLength);
+        n = dataLength;
+    }
+    cp->originalLength = dataLength;
+    XTime_GetTime(&now);
+    rp->packetTicks += now - then;
+    rp->packetCount++;
+    rp->compressionIn += dataLength;
+    rp->compressionOut += n;
+    rp->sysUsAtPreviousPacket = MICROSECONDS_SINCE_BOOT();
+    return p;
+}
+
 /*
  * Create a data packet
  */
 static struct pbuf *
-dataPacket(struct recorderData *rp)
+dataPacket(struct recorderData *rp, unsigned int block)
 {
-    int offset, dataLength, packetLength;
+    unsigned int offset, dataLength;
     struct dsbpmWaveformData *dp;
-    struct pbuf *p = NULL;
+    struct pbuf *p;
 
-    offset = (rp->startByteOffset +
-              (rp->txBlock * DSBPM_PROTOCOL_WAVEFORM_PAYLOAD_CAPACITY)) %
-                                                            rp->acqByteCapacity;
-    dataLength = rp->bytesLeft;
-    if (dataLength > 0) {
-        if (dataLength > DSBPM_PROTOCOL_WAVEFORM_PAYLOAD_CAPACITY)
-            dataLength = DSBPM_PROTOCOL_WAVEFORM_PAYLOAD_CAPACITY;
-        packetLength = sizeof(*dp) -
-                        (DSBPM_PROTOCOL_WAVEFORM_PAYLOAD_CAPACITY - dataLength);
-
-        /*
-         * Create the packet
-         */
-        p = pbuf_alloc(PBUF_TRANSPORT, packetLength, PBUF_RAM);
+    if (block >= rp->blockCount)
+        return NULL;
+    offset = block * rp->blockSize;
+    dataLength = rp->byteCount - (block * rp->blockSize);
+    if (dataLength > rp->blockSize)
+        dataLength = rp->blockSize;
+    if (rp->isCompressed)
+        p = compressedPacket(rp, offset, dataLength);
+    else
+        p = payloadPacket(rp, offsetof(struct dsbpmWaveformData, payload),
+                                                        offset, dataLength);
+    if (p == NULL)
+        return NULL;
+    /* Compressed data packet starts with the same fields */
+    dp = (struct dsbpmWaveformData *)p->payload;
+    dp->magic = rp->isCompressed ? DSBPM_PROTOCOL_MAGIC_WAVEFORM_COMPRESSED_DATA :
+                                   DSBPM_PROTOCOL_MAGIC_WAVEFORM_DATA;
+    dp->dsbpmNumber = rp->dsbpmNumber;
+    dp->recorderNumber = rp->recorderNumber;
+    dp->waveformNumber = rp->waveformNumber;
+    dp->blockNumber = block;
+    TRACE(DEBUGFLAG_WAVEFORM_XFER, TRACE_EV_WFR_BLOCK,
+                    TRACE_RECORDER(rp->dsbpmNumber, rp->recorderNumber), block, dataLength);
+    return p;
+}
+
+/*
+ * Bytes written by a continuously-streaming recorder but not yet sent.
+ * Skip ahead if the recorder is about to lap the reader.
+ */
+static unsigned int
+streamBytesAvailable(struct recorderData *rp)
+{
+    uint32_t words = WR_READ(rp, WR_REG_OFFSET_WRITE_COUNT) -
+                                                    (uint32_t)rp->streamWords;
+    uint64_t bytes = (uint64_t)words * rp->bytesPerWord;
+
+    if (bytes > (rp->acqByteCapacity - STREAM_GUARD(rp))) {
+        unsigned int skip = (bytes - (rp->acqByteCapacity / 2)) / rp->bytesPerWord;
+        rp->streamWords += skip;
+        rp->streamOverruns++;
+        TRACE(DEBUGFLAG_WAVEFORM_XFER, TRACE_EV_WFR_STREAM_OVERRUN,
+                    TRACE_RECORDER(rp->dsbpmNumber, rp->recorderNumber), skip, 0);
+        bytes -= (uint64_t)skip * rp->bytesPerWord;
+    }
+    return bytes;
+}
+
+/*
+ * Send the next section of a continuous stream
+ */
+static int
+streamHasData(struct recorderData *rp)
+{
+    unsigned int bytes = streamBytesAvailable(rp);
+
+    return (bytes >= DSBPM_PROTOCOL_WAVEFORM_PAYLOAD_CAPACITY)
+        || ((bytes != 0)
+         && ((MICROSECONDS_SINCE_BOOT() - rp->sysUsAtPreviousPacket) > STREAM_FLUSH_US));
+}
+
+static struct pbuf *
+streamPacket(struct recorderData *rp)
+{
+    unsigned int offset, dataLength;
+    uint64_t byteOffset;
+    struct dsbpmWaveformStream *sp;
+    struct pbuf *p;
+
+    dataLength = streamBytesAvailable(rp);
+    byteOffset = rp->streamWords * rp->bytesPerWord;
+    if (dataLength > DSBPM_PROTOCOL_WAVEFORM_PAYLOAD_CAPACITY)
+        dataLength = DSBPM_PROTOCOL_WAVEFORM_PAYLOAD_CAPACITY;
+    dataLength -= dataLength % rp->bytesPerWord;
+    if (dataLength == 0)
+        return NULL;
+    offset = byteOffset % rp->acqByteCapacity;
+#if (WFR_CACHE_STRATEGY == WFR_CACHE_FLUSH_RANGE) || \
+    (WFR_CACHE_STRATEGY == WFR_CACHE_FLUSH_ALL)
+    flushRing(rp, offset, dataLength);
+#endif
+    p = payloadPacket(rp, offsetof(struct dsbpmWaveformStream, payload),
+                                                        offset, dataLength);
+    if (p == NULL)
+        return NULL;
+    sp = (struct dsbpmWaveformStream *)p->payload;
+    sp->magic = DSBPM_PROTOCOL_MAGIC_WAVEFORM_STREAM;
+    sp->dsbpmNumber = rp->dsbpmNumber;
+    sp->recorderNumber = rp->recorderNumber;
+    sp->waveformNumber = rp->waveformNumber;
+    sp->sequenceNumber = rp->streamSequence++;
+    sp->byteOffsetHi = byteOffset >> 32;
+    sp->byteOffsetLo = byteOffset;
+    sp->overrunCount = rp->streamOverruns;
+    rp->streamWords += dataLength / rp->bytesPerWord;
+    return p;
+}
+
+/*
+ * Stop-and-wait transfer -- send the block most recently requested.
+ * Give up if the packet can't be created.
+ */
+static struct pbuf *
+stopAndWaitPacket(struct recorderData *rp)
+{
+    struct pbuf *p = dataPacket(rp, rp->txBlock);
+
+    rp->commState = (p == NULL) ? CS_IDLE : CS_ACTIVE;
+    return p;
+}
+
+/*
+ * Windowed transfer -- send the next block, if any.
+ * Retransmissions take precedence over blocks not yet sent.
+ * If the packet can't be created the block is left pending so
+ * that it will be sent by a later call.
+ */
+static struct pbuf *
+windowPacket(struct recorderData *rp)
+{
+    struct pbuf *p;
+
+    if (rp->resendMask) {
+        unsigned int n = __builtin_ctz(rp->resendMask);
+        p = dataPacket(rp, rp->ackBlock + n);
         if (p) {
-            dp = (struct dsbpmWaveformData *)p->payload;
-            dp->magic = DSBPM_PROTOCOL_MAGIC_WAVEFORM_DATA;
-            dp->dsbpmNumber = rp->dsbpmNumber;
-            dp->recorderNumber = rp->recorderNumber;
-            dp->waveformNumber = rp->waveformNumber;
-            dp->blockNumber = rp->txBlock;
-            if ((offset + dataLength) <= rp->acqByteCapacity) {
-                memcpy2(dp->payload, rp->acqBuf + offset, dataLength);
-            }
-            else {
-                /* Handle ring buffer wraparound */
-                unsigned int l1, l2;
-                l1 = rp->acqByteCapacity - offset;
-                memcpy2(dp->payload, rp->acqBuf + offset, l1);
-                offset = 0;
-                l2 = dataLength - l1;
-                memcpy2(dp->payload + l1, rp->acqBuf + offset, l2);
-            }
-            rp->sysUsAtPreviousPacket = MICROSECONDS_SINCE_BOOT();
-            if (debugFlags & DEBUGFLAG_WAVEFORM_XFER)
-                printf("WFR %d:%d block %d size %d\n",
-                                            rp->dsbpmNumber,
-                                            rp->recorderNumber,
-                                            (int)dp->blockNumber, dataLength);
-        }
-        else {
-            if (debugFlags & DEBUGFLAG_WAVEFORM_XFER)
-                printf("dataPacket(): pbuf_alloc() could not allocate pbuf "
-                        "DSBPM:Recorder %d:%d\n",
-                        rp->dsbpmNumber, rp->recorderNumber);
+            rp->resendMask &= ~(1U << n);
+            rp->resentMask |= 1U << n;
+            rp->resendCount++;
         }
+        return p;
     }
-    if (p) {
+    if ((rp->txBlock < rp->blockCount)
+     && (rp->txBlock < (rp->ackBlock + rp->windowSize))) {
+        p = dataPacket(rp, rp->txBlock);
+        if (p) rp->txBlock++;
+        return p;
+    }
+    return NULL;
+}
+
+/*
+ * Handle a windowed acknowledgement
+ */
+static struct pbuf *
+windowAck(struct recorderData *rp, const struct dsbpmWaveformAck *ackp)
+{
+    unsigned int advance, received, outstanding;
+
+    if (rp->commState == CS_HEADER) {
+        rp->isWindowed = 1;
+        rp->windowSize = ackp->windowSize;
+        if (rp->windowSize < 1)
+            rp->windowSize = 1;
+        if (rp->windowSize > DSBPM_PROTOCOL_WAVEFORM_WINDOW_CAPACITY)
+            rp->windowSize = DSBPM_PROTOCOL_WAVEFORM_WINDOW_CAPACITY;
+        rp->ackBlock = 0;
+        rp->txBlock = 0;
+        rp->resendMask = 0;
+        rp->resentMask = 0;
+        rp->resendCount = 0;
         rp->commState = CS_ACTIVE;
-        rp->bytesInPreviousPacket = dataLength;
+    }
+    else if (!rp->isWindowed) {
+        return NULL;
+    }
+
+    /*
+     * Ignore stale acknowledgements and those for blocks not yet sent
+     */
+    if ((ackp->blockNumber < rp->ackBlock) || (ackp->blockNumber > rp->txBlock))
+        return NULL;
+    advance = ackp->blockNumber - rp->ackBlock;
+    if (advance >= 32) {
+        rp->resendMask = 0;
+        rp->resentMask = 0;
     }
     else {
+        rp->resendMask >>= advance;
+        rp->resentMask >>= advance;
+    }
+    rp->ackBlock = ackp->blockNumber;
+    rp->retryCount = 0;
+    rp->sysUsAtPreviousPacket = MICROSECONDS_SINCE_BOOT();
+    if (rp->ackBlock >= rp->blockCount) {
+        TRACE(DEBUGFLAG_WAVEFORM_XFER, TRACE_EV_WFR_COMPLETE,
+                    TRACE_RECORDER(rp->dsbpmNumber, rp->recorderNumber), rp->resendCount, 0);
         rp->commState = CS_IDLE;
-        rp->bytesInPreviousPacket = 0;
+        return NULL;
     }
-    return p;
+
+    /*
+     * Any block sent but missing below the highest block received
+     * has been lost.  Queue it for retransmission unless that has
+     * already been done.
+     */
+    received = ackp->receivedMask << 1;
+    outstanding = rp->txBlock - rp->ackBlock;
+    if (outstanding < 32)
+        received &= (1U << outstanding) - 1;
+    if (received) {
+        unsigned int highest = 31 - __builtin_clz(received);
+        unsigned int lost = ~received & ((1U << highest) - 1);
+        rp->resendMask |= lost & ~rp->resentMask;
+    }
+    return windowPacket(rp);
 }
 
 /*
@@ -341,7 +924,7 @@ dataPacket(struct recorderData *rp)
  * Hand back a pointer to the data packet to be transmitted.
  */
 struct pbuf *
-wfrAckPacket(struct dsbpmWaveformAck *ackp)
+wfrAckPacket(struct dsbpmWaveformAck *ackp, int ackSize)
 {
     struct recorderData *rp = recorderPointer(ackp->dsbpmNumber, ackp->recorderNumber);
 
@@ -351,46 +934,88 @@ wfrAckPacket(struct dsbpmWaveformAck *ackp)
     if ((rp == NULL)
      || ((rp->commState != CS_ACTIVE) && (rp->commState != CS_HEADER))
      || (ackp->magic != DSBPM_PROTOCOL_MAGIC_WAVEFORM_ACK)
-     || (ackp->waveformNumber != rp->waveformNumber)
-     || (ackp->blockNumber != rp->txBlock))
+     || (ackp->waveformNumber != rp->waveformNumber))
         return NULL;
-    if (debugFlags & DEBUGFLAG_WAVEFORM_XFER)
-        printf("WFR %d:%d ACK %d\n",
-                                (int)ackp->dsbpmNumber,
-                                (int)ackp->recorderNumber,
-                                (int)ackp->blockNumber);
+    TRACE(DEBUGFLAG_WAVEFORM_XFER, TRACE_EV_WFR_ACK,
+                    TRACE_RECORDER(ackp->dsbpmNumber, ackp->recorderNumber),
+                    ackp->blockNumber, 0);
+    if (rp->commState == CS_HEADER) {
+        if (ackSize >= sizeof *ackp)
+            setBlockSize(rp, ackp->blockSize);
+        rp->isCompressed = (ackSize >= DSBPM_PROTOCOL_WAVEFORM_ACK_WINDOWED_SIZE)
+                        && (ackp->flags & DSBPM_PROTOCOL_WAVEFORM_ACK_FLAG_COMPRESS);
+    }
+    if ((ackSize >= DSBPM_PROTOCOL_WAVEFORM_ACK_WINDOWED_SIZE)
+     && (ackp->flags & DSBPM_PROTOCOL_WAVEFORM_ACK_FLAG_WINDOWED))
+        return windowAck(rp, ackp);
 
     /*
-     * Determine contents
+     * Stop-and-wait
      */
+    if ((rp->commState == CS_ACTIVE) && rp->isWindowed)
+        return NULL;
+    if (ackp->blockNumber != rp->txBlock)
+        return NULL;
+    rp->isWindowed = 0;
     rp->retryCount = 0;
-    if (rp->commState != CS_HEADER) {
+    if (rp->commState != CS_HEADER)
         rp->txBlock++;
-        if (rp->bytesInPreviousPacket < rp->bytesLeft) {
-            rp->bytesLeft -= rp->bytesInPreviousPacket;
-        }
-        else {
-            rp->bytesLeft = 0;
-        }
+    return stopAndWaitPacket(rp);
+}
+
+/*
+ * Find the start of each segment of a segmented acquisition.
+ * The address and timestamp registers show the values for the
+ * selected segment once the forwarding across clock domains
+ * has had time to complete.
+ */
+static void
+segmentExtent(struct recorderData *rp)
+{
+    unsigned int capacity = rp->acqByteCapacity >> rp->acqSegmentShift;
+    unsigned int count, i;
+
+    count = (WR_READ(rp, WR_REG_OFFSET_CSR) & WR_CSR_SEGMENTS_DONE_MASK) >>
+                                                    WR_CSR_SEGMENTS_DONE_SHIFT;
+    if (count > DSBPM_PROTOCOL_WAVEFORM_SEGMENT_CAPACITY)
+        count = DSBPM_PROTOCOL_WAVEFORM_SEGMENT_CAPACITY;
+    rp->segmentBytes = WR_READ(rp, WR_REG_OFFSET_ACQUISITION_COUNT) *
+                                                            rp->bytesPerWord;
+    for (i = 0 ; i < count ; i++) {
+        char *nextAddress;
+        wrWrite(rp, WR_REG_OFFSET_SEGMENT_SELECT, i);
+        microsecondSpin(1);
+        nextAddress = (char *)((uint64_t) WR_READ(rp, WR_REG_OFFSET_ADDRESS_LSB_POINTER) |
+                ((uint64_t) WR_READ(rp, WR_REG_OFFSET_ADDRESS_MSB_POINTER)) << 32);
+        rp->segmentStart[i] = ((nextAddress - rp->acqBuf) - (i * capacity) +
+                                        capacity - rp->segmentBytes) % capacity;
+        rp->segments[i].seconds = WR_READ(rp, WR_REG_OFFSET_TIMESTAMP_SECONDS);
+        rp->segments[i].fraction = WR_READ(rp, WR_REG_OFFSET_TIMESTAMP_FRACTION);
+        TRACE(DEBUGFLAG_WAVEFORM_HEAD, TRACE_EV_WFR_SEGMENT,
+                    TRACE_RECORDER(rp->dsbpmNumber, rp->recorderNumber), i, rp->segmentStart[i]);
     }
-    return dataPacket(rp);
+    rp->segmentCount = count;
+    rp->startByteOffset = 0;
+    rp->byteCount = count * rp->segmentBytes;
+    setBlockSize(rp, DSBPM_PROTOCOL_WAVEFORM_PAYLOAD_CAPACITY);
 }
 
 /*
- * Create a header packet
+ * Find the section of the ring buffer holding the acquisition
  */
-static struct pbuf *
-headerPacket(struct recorderData *rp)
+static void
+acquisitionExtent(struct recorderData *rp)
 {
-    struct pbuf *p;
-    struct dsbpmWaveformHeader *hp;
     unsigned int count;
 
+    if (rp->acqSegmentShift) {
+        segmentExtent(rp);
+        return;
+    }
+    rp->segmentCount = 0;
     count = WR_READ(rp, WR_REG_OFFSET_ACQUISITION_COUNT);
     if (count > rp->acqCount)
         count = rp->acqCount;
-    if (debugFlags & DEBUGFLAG_WAVEFORM_HEAD)
-        showRec(rp);
 
     /* All recorders use a ring buffer */
     char *nextAddress = (char *)((uint64_t) WR_READ(rp, WR_REG_OFFSET_ADDRESS_LSB_POINTER) |
@@ -399,39 +1024,177 @@ headerPacket(struct recorderData *rp)
                            rp->acqByteCapacity -
                            (rp->acqCount * rp->bytesPerSample * rp->cyclesPerWord)) %
                                                         rp->acqByteCapacity;
-    p = pbuf_alloc(PBUF_TRANSPORT, sizeof(*hp), PBUF_RAM);
+    rp->byteCount = count * rp->bytesPerSample * rp->cyclesPerWord;
+    setBlockSize(rp, DSBPM_PROTOCOL_WAVEFORM_PAYLOAD_CAPACITY);
+}
+
+/*
+ * Create a header packet
+ * Clients that did not ask for the extended header get the header
+ * sent by older firmware, without block capacity or segment table.
+ */
+static int isLegacyHeader;
+static struct pbuf *
+headerPacket(struct recorderData *rp)
+{
+    struct pbuf *p;
+    unsigned int length;
+    struct dsbpmWaveformHeader *hp;
+
+    if (debugFlags & DEBUGFLAG_WAVEFORM_HEAD)
+        showRec(rp);
+    if (isLegacyHeader)
+        length = DSBPM_PROTOCOL_WAVEFORM_HEADER_LEGACY_SIZE;
+    else
+        length = offsetof(struct dsbpmWaveformHeader, segments) +
+                                (rp->segmentCount * sizeof(hp->segments[0]));
+    p = pbuf_alloc(PBUF_TRANSPORT, length, PBUF_RAM);
     if (p) {
         hp = (struct dsbpmWaveformHeader *)p->payload;
         hp->magic = DSBPM_PROTOCOL_MAGIC_WAVEFORM_HEADER;
         hp->dsbpmNumber = rp->dsbpmNumber;
         hp->recorderNumber = rp->recorderNumber;
+        hp->lossOfBeamStatus = rp->lossOfBeamStatus;
+        if (rp->isPostMortemTransfer)
+            hp->lossOfBeamStatus |= DSBPM_PROTOCOL_WAVEFORM_POST_MORTEM;
         hp->waveformNumber = rp->waveformNumber;
-        hp->seconds = WR_READ(rp, WR_REG_OFFSET_TIMESTAMP_SECONDS);
-        hp->fraction = WR_READ(rp, WR_REG_OFFSET_TIMESTAMP_FRACTION);
-        hp->byteCount = rp->bytesLeft = count * rp->bytesPerSample * rp->cyclesPerWord;
+        if (rp->segmentCount) {
+            hp->seconds = rp->segments[0].seconds;
+            hp->fraction = rp->segments[0].fraction;
+            if (!isLegacyHeader)
+                memcpy(hp->segments, rp->segments,
+                                rp->segmentCount * sizeof(hp->segments[0]));
+        }
+        else {
+            hp->seconds = WR_READ(rp, WR_REG_OFFSET_TIMESTAMP_SECONDS);
+            hp->fraction = WR_READ(rp, WR_REG_OFFSET_TIMESTAMP_FRACTION);
+        }
+        hp->byteCount = rp->byteCount;
         hp->bytesPerSample = rp->bytesPerSample;
         hp->bytesPerAtom = rp->bytesPerAtom;
+        if (!isLegacyHeader) {
+            hp->blockCapacity = blockCapacity();
+            hp->segmentCount = rp->segmentCount;
+        }
         rp->commState = CS_HEADER;
+        rp->isWindowed = 0;
+        rp->isCompressed = 0;
         rp->txBlock = 0;
         rp->sysUsAtPreviousPacket = MICROSECONDS_SINCE_BOOT();
-        if (debugFlags & DEBUGFLAG_WAVEFORM_HEAD)
-            printf("acqCount:%d(%X)  start byte offset:%d(%X)  bytesLeft:%d\n"
-                   "    bytesPerSample:%d  bytesPerAtom:%d cyclesPerWord:%d\n",
-                                    rp->acqCount, rp->acqCount,
-                                    rp->startByteOffset, rp->startByteOffset,
-                                    rp->bytesLeft, rp->bytesPerSample,
-                                    rp->bytesPerAtom, rp->cyclesPerWord);
+        TRACE(DEBUGFLAG_WAVEFORM_HEAD, TRACE_EV_WFR_HEADER,
+                    TRACE_RECORDER(rp->dsbpmNumber, rp->recorderNumber), rp->acqCount, rp->byteCount);
     }
     else {
-        if (debugFlags & DEBUGFLAG_WAVEFORM_HEAD)
-            printf("headerPacket(): pbuf_alloc() could not allocate pbuf "
-                    "DSBPM:Recorder %d:%d\n",
-                    rp->dsbpmNumber, rp->recorderNumber);
+        TRACE(DEBUGFLAG_WAVEFORM_HEAD, TRACE_EV_WFR_NO_PBUF,
+                    TRACE_RECORDER(rp->dsbpmNumber, rp->recorderNumber), TRACE_PACKET_HEADER, 0);
     }
-    rp->bytesInPreviousPacket = 0;
     return p;
 }
 
+/*
+ * Ensure that the processor sees the acquired data.
+ */
+static void
+recorderCacheMaintenance(struct recorderData *rp, epicsUInt32 csr)
+{
+    XTime then, now;
+
+    XTime_GetTime(&then);
+#if WFR_CACHE_STRATEGY == WFR_CACHE_FLUSH_RANGE
+    if ((csr & WR_CSR_DIAGNOSTIC_MODE)
+     || (rp->byteCount > WFR_CACHE_RANGE_LIMIT)) {
+        Xil_DCacheFlush();
+    }
+    else {
+        flushRing(rp, 0, rp->byteCount);
+    }
+#elif WFR_CACHE_STRATEGY == WFR_CACHE_FLUSH_ALL
+    /*
+     * The buffer is almost certainly bigger than the cache
+     * so it's fine to simply invalidate everything.
+     * After discussions with Xilinx and much testing I've
+     * confirmed that this is in fact the correct call.
+     * A call to 'Invalidate' seems to result in a mangled
+     * system.  This is likely because the cache is write-back.
+     */
+    Xil_DCacheFlush();
+#endif
+    XTime_GetTime(&now);
+    rp->fillTicks += now - then;
+    if ((now - then) > rp->fillTicksMax)
+        rp->fillTicksMax = now - then;
+    rp->fillCount++;
+}
+
+/*
+ * Blocks not yet acknowledged
+ */
+static unsigned int
+queueDepth(struct recorderData *rp)
+{
+    switch (rp->commState) {
+    case CS_HEADER: return rp->blockCount;
+    case CS_ACTIVE: return rp->blockCount -
+                            (rp->isWindowed ? rp->ackBlock : rp->txBlock);
+    case CS_STREAM: return (streamBytesAvailable(rp) +
+                                DSBPM_PROTOCOL_WAVEFORM_PAYLOAD_CAPACITY - 1) /
+                                        DSBPM_PROTOCOL_WAVEFORM_PAYLOAD_CAPACITY;
+    default:        return 0;
+    }
+}
+
+/*
+ * Pick the windowed transfer or continuous stream to send the next block.
+ * Stop-and-wait transfers are clocked entirely by acknowledgements.
+ */
+static int
+windowHasSpace(const struct recorderData *rp)
+{
+    return (rp->commState == CS_ACTIVE)
+        && rp->isWindowed
+        && (rp->resendMask
+         || ((rp->txBlock < rp->blockCount)
+          && (rp->txBlock < (rp->ackBlock + rp->windowSize))));
+}
+
+/*
+ * Post-mortem transfers take precedence over all configured priorities
+ */
+static unsigned int
+effectivePriority(const struct recorderData *rp)
+{
+    return rp->isPostMortemTransfer ? 0 : rp->txPriority + 1;
+}
+
+static struct pbuf *
+scheduledPacket(void)
+{
+    static unsigned int turn[TX_PRIORITY_COUNT + 1];
+    struct recorderData *base = &recorderData[0][0];
+    unsigned int n = CFG_DSBPM_COUNT * CFG_NUM_RECORDERS;
+    unsigned int priority, i;
+
+    for (priority = 0 ; priority <= TX_PRIORITY_COUNT ; priority++) {
+        for (i = 1 ; i <= n ; i++) {
+            unsigned int idx = (turn[priority] + i) % n;
+            struct recorderData *rp = base + idx;
+            if (effectivePriority(rp) != priority)
+                continue;
+            if (rp->commState == CS_STREAM) {
+                if (streamHasData(rp)) {
+                    turn[priority] = idx;
+                    return streamPacket(rp);
+                }
+            }
+            else if (windowHasSpace(rp)) {
+                turn[priority] = idx;
+                return windowPacket(rp);
+            }
+        }
+    }
+    return NULL;
+}
+
 /*
  * Called from publisher fast-update routine
  */
@@ -526,12 +1289,87 @@ recorderDiagnosticCheck(struct recorderData *rp)
     printf("Words transferred: %u\n", wordCount);
 }
 
+/*
+ * Note the onset of each loss of beam
+ */
+static void
+lossOfBeamPoll(void)
+{
+    int bpm;
+
+    for (bpm = 0 ; bpm < CFG_DSBPM_COUNT ; bpm++) {
+        struct lossOfBeamState *lp = &lossOfBeam[bpm];
+        unsigned int status = GPIO_READ(bpm*GPIO_IDX_PER_DSBPM +
+                                        GPIO_IDX_LOSS_OF_BEAM_TRIGGER);
+        if (status && !lp->status) {
+            lp->onsetCount++;
+            lp->usAtOnset = MICROSECONDS_SINCE_BOOT();
+        }
+        lp->status = status;
+    }
+}
+
+/*
+ * Recorder has filled -- prepare transfer and create header
+ */
+static struct pbuf *
+filledPacket(struct recorderData *rp, epicsUInt32 csr)
+{
+    struct lossOfBeamState *lp = &lossOfBeam[rp->dsbpmNumber];
+    int isOnset = (lp->onsetCount != rp->lossOfBeamOnsetAtArm);
+    struct pbuf *p;
+
+    /* Clear full status */
+    wrWrite(rp, WR_REG_OFFSET_CSR, rp->csrModeBits);
+    TRACE(DEBUGFLAG_WAVEFORM_HEAD, TRACE_EV_WFR_FULL,
+            TRACE_RECORDER(rp->dsbpmNumber, rp->recorderNumber), 0, 0);
+    rp->lossOfBeamStatus = lp->status;
+    rp->isPostMortemTransfer = rp->isPostMortem && (isOnset || lp->status);
+
+    acquisitionExtent(rp);
+    recorderCacheMaintenance(rp, csr);
+    rp->retryCount = 0;
+    if ((csr & WR_CSR_DIAGNOSTIC_MODE) && !rp->segmentCount)
+        recorderDiagnosticCheck(rp);
+
+    p = headerPacket(rp);
+    if (p && rp->isPostMortemTransfer && isOnset) {
+        uint32_t us = MICROSECONDS_SINCE_BOOT() - lp->usAtOnset;
+        postMortemLatency.count++;
+        postMortemLatency.usLatest = us;
+        if (us > postMortemLatency.usMax)
+            postMortemLatency.usMax = us;
+    }
+    return p;
+}
+
+/*
+ * Post-mortem recorders are checked on every call rather than in turn
+ */
+static struct pbuf *
+postMortemPacket(void)
+{
+    int bpm, recorder;
+
+    for (bpm = 0 ; bpm < CFG_DSBPM_COUNT ; bpm++) {
+        for (recorder = 0 ; recorder < CFG_NUM_RECORDERS ; recorder++) {
+            struct recorderData *rp = &recorderData[bpm][recorder];
+            if (rp->isPostMortem && (rp->commState == CS_IDLE)) {
+                epicsUInt32 csr = WR_READ(rp, WR_REG_OFFSET_CSR);
+                if (csr & WR_CSR_IS_FULL)
+                    return filledPacket(rp, csr);
+            }
+        }
+    }
+    return NULL;
+}
+
 /*
  * Called from publisher work-check routine
  * Hand back a pointer to the packet to be transmitted.
  */
 struct pbuf *
-wfrCheckForWork(void)
+wfrCheckForWork(int legacyHeader)
 {
     static int bpm;
     static int recorder;
@@ -539,8 +1377,15 @@ wfrCheckForWork(void)
     struct pbuf *p = NULL;
     uint32_t now;
 
+    isLegacyHeader = legacyHeader;
+    lossOfBeamPoll();
+    if ((p = postMortemPacket()) != NULL)
+        return p;
+
     /*
-     * Rotate through recorders one at a time
+     * Rotate through recorders one at a time looking for a newly
+     * filled recorder or a timeout.  Otherwise send the next block
+     * of whichever windowed transfer is due.
      */
     if (recorder >= (CFG_NUM_RECORDERS - 1)) {
         recorder = 0;
@@ -564,28 +1409,10 @@ wfrCheckForWork(void)
     if (rp->commState == CS_IDLE) {
         epicsUInt32 csr = WR_READ(rp, WR_REG_OFFSET_CSR);
         if (csr & WR_CSR_IS_FULL) {
-            /* Clear full status */
-            wrWrite(rp, WR_REG_OFFSET_CSR, rp->csrModeBits);
-            if (debugFlags & DEBUGFLAG_WAVEFORM_HEAD)
-                printf("DSBPM:Recorder %d:%d is full\n", rp->dsbpmNumber, rp->recorderNumber);
-
-            /*
-             * The buffer is almost certainly bigger than the cache
-             * so it's fine to simply invalidate everything.
-             * After discussions with Xilinx and much testing I've
-             * confirmed that this is in fact the correct call.
-             * A call to 'Invalidate' seems to result in a mangled
-             * system.  This is likely because the cache is write-back.
-             */
-            Xil_DCacheFlush();
-            rp->retryCount = 0;
-            if (csr & WR_CSR_DIAGNOSTIC_MODE)
-                recorderDiagnosticCheck(rp);
-
-            p = headerPacket(rp);
+            p = filledPacket(rp, csr);
         }
     }
-    else {
+    else if (rp->commState != CS_STREAM) {
         now = MICROSECONDS_SINCE_BOOT();
         if ((now - rp->sysUsAtPreviousPacket) > TIMEOUT_US) {
             if (++rp->retryCount < RETRY_LIMIT) {
@@ -596,9 +1423,26 @@ wfrCheckForWork(void)
                  * be a really bad idea since udp_sendto mangles the pbuf.
                  */
                 switch (rp->commState) {
-                case CS_HEADER: p = headerPacket(rp); break;
-                case CS_ACTIVE: p = dataPacket(rp);   break;
-                default:                              break;
+                case CS_HEADER:
+                    p = headerPacket(rp);
+                    break;
+
+                case CS_ACTIVE:
+                    if (rp->isWindowed) {
+                        /*
+                         * Resend the oldest unacknowledged block.
+                         * The IOC will report any other gaps.
+                         */
+                        rp->resendMask |= 1;
+                        rp->resentMask = 0;
+                        p = windowPacket(rp);
+                    }
+                    else {
+                        p = stopAndWaitPacket(rp);
+                    }
+                    break;
+
+                default: break;
                 }
             }
             else {
@@ -606,9 +1450,28 @@ wfrCheckForWork(void)
             }
         }
     }
+    if (p == NULL)
+        p = scheduledPacket();
     return p;
 }
 
+/*
+ * Round requested segment count down to a power of 2 that
+ * leaves each segment room for at least one burst.
+ */
+static void
+setSegmentCount(struct recorderData *rp, unsigned int count)
+{
+    unsigned int words = rp->acqByteCapacity / rp->bytesPerWord;
+    unsigned int shift = 0;
+
+    while (((2U << shift) <= count)
+        && ((2U << shift) <= DSBPM_PROTOCOL_WAVEFORM_SEGMENT_CAPACITY)
+        && ((words >> (shift + 1)) >= SEGMENT_WORDS_MIN))
+        shift++;
+    rp->segmentShift = shift;
+}
+
 /*
  * Called from server packet handler
  */
@@ -629,8 +1492,7 @@ waveformRecorderCommand(int waveformCommand, unsigned int index,
         if (index >= CFG_DSBPM_COUNT)
             return 0;
 
-        if (debugFlags & DEBUGFLAG_WAVEFORM_HEAD)
-            printf("Recorder soft trigger\n");
+        TRACE(DEBUGFLAG_WAVEFORM_HEAD, TRACE_EV_WFR_SOFT_TRIGGER, index, 0, 0);
 
         GPIO_WRITE(index*GPIO_IDX_PER_DSBPM+GPIO_IDX_WFR_SOFT_TRIGGER,
                 0);
@@ -645,15 +1507,43 @@ waveformRecorderCommand(int waveformCommand, unsigned int index,
     switch (waveformCommand) {
     case DSBPM_PROTOCOL_CMD_RECORDERS_LO_ARM:
         csr = (rp->triggerMask & 0xFF) << 24;
+        if (rp->isPostMortem)
+            csr |= WR_CSR_LOSS_OF_BEAM_TRIGGER_ENABLE;
+        rp->isPostMortemTransfer = 0;
+        rp->lossOfBeamOnsetAtArm = lossOfBeam[bpm].onsetCount;
         if (val) {
             if (!isArmed(rp)) {
-                wrWrite(rp, WR_REG_OFFSET_ACQUISITION_COUNT, rp->acqCount);
+                unsigned int acqCount = rp->acqCount;
+                unsigned int segmentWords;
+                rp->acqSegmentShift = (rp->csrModeBits & WR_CSR_CONTINUOUS_MODE) ?
+                                                            0 : rp->segmentShift;
+                segmentWords = (rp->acqByteCapacity / rp->bytesPerWord) >>
+                                                            rp->acqSegmentShift;
+                if (acqCount > segmentWords)
+                    acqCount = segmentWords;
+                wrWrite(rp, WR_REG_OFFSET_ACQUISITION_COUNT, acqCount);
                 wrWrite(rp, WR_REG_OFFSET_PRETRIGGER_COUNT, rp->pretrigCount);
+                wrWrite(rp, WR_REG_OFFSET_SEGMENT_SHIFT, rp->acqSegmentShift);
                 rp->waveformNumber++;
+                rp->streamWords = 0;
+                rp->streamSequence = 0;
+                rp->streamOverruns = 0;
+            }
+            if (rp->csrModeBits & WR_CSR_CONTINUOUS_MODE) {
+                /* Stream offsets are buffer offsets */
+                rp->startByteOffset = 0;
+                rp->segmentCount = 0;
+                rp->commState = CS_STREAM;
+                rp->sysUsAtPreviousPacket = MICROSECONDS_SINCE_BOOT();
+            }
+            else {
+                rp->commState = CS_IDLE;
             }
-            rp->commState = CS_IDLE;
             csr |= WR_CSR_ARM;
         }
+        else if (rp->commState == CS_STREAM) {
+            rp->commState = CS_IDLE;
+        }
         if (debugFlags & DEBUGFLAG_RECORDER_DIAG)
             rp->csrModeBits |= WR_CSR_DIAGNOSTIC_MODE;
         else
@@ -681,6 +1571,34 @@ waveformRecorderCommand(int waveformCommand, unsigned int index,
         }
         break;
 
+    case DSBPM_PROTOCOL_CMD_RECORDERS_LO_TX_PRIORITY:
+        if (val >= TX_PRIORITY_COUNT) val = TX_PRIORITY_COUNT - 1;
+        rp->txPriority = val;
+        break;
+
+    case DSBPM_PROTOCOL_CMD_RECORDERS_LO_QUEUE_DEPTH:
+        for (bpm = 0 ; bpm < CFG_DSBPM_COUNT ; bpm++) {
+            for (recorder = 0 ; recorder < CFG_NUM_RECORDERS ; recorder++) {
+                if (replyArgCount < capacity)
+                    reply[replyArgCount++] =
+                                    queueDepth(&recorderData[bpm][recorder]);
+            }
+        }
+        break;
+
+    case DSBPM_PROTOCOL_CMD_RECORDERS_LO_CONTINUOUS_MODE:
+        if (val && rp->canStream) rp->csrModeBits |=  WR_CSR_CONTINUOUS_MODE;
+        else                      rp->csrModeBits &= ~WR_CSR_CONTINUOUS_MODE;
+        break;
+
+    case DSBPM_PROTOCOL_CMD_RECORDERS_LO_SEGMENT_COUNT:
+        setSegmentCount(rp, val);
+        break;
+
+    case DSBPM_PROTOCOL_CMD_RECORDERS_LO_POST_MORTEM:
+        rp->isPostMortem = (val != 0);
+        break;
+
     case DSBPM_PROTOCOL_CMD_RECORDERS_LO_ACQUISITION_MODE:
         if (val) rp->csrModeBits |=  WR_CSR_TEST_ACQUISITION_MODE;
         else     rp->csrModeBits &= ~WR_CSR_TEST_ACQUISITION_MODE;
@@ -692,3 +1610,82 @@ waveformRecorderCommand(int waveformCommand, unsigned int index,
 
     return replyArgCount;
 }
+
+/*
+ * Show data packet creation and cache maintenance cost and
+ * select copy/reference mode.
+ * Counters are cleared once shown so that modes can be compared
+ * by running the same transfer after each selection.
+ */
+int
+wfrCommand(int argc, char **argv)
+{
+    int bpm, i, n;
+
+    if (argc > 1) {
+        if (strcmp(argv[1], "copy") == 0)     forceCopy = 1;
+        else if (strcmp(argv[1], "ref") == 0) forceCopy = 0;
+        else {
+            printf("Usage: %s [copy|ref]\n", argv[0]);
+            return 1;
+        }
+    }
+    for (bpm = 0 ; bpm < CFG_DSBPM_COUNT ; bpm++) {
+        for (i = 0 ; i < CFG_NUM_RECORDERS ; i++) {
+            struct recorderData *rp = &recorderData[bpm][i];
+            if (rp->commState != CS_IDLE)
+                printf("WFR %d:%d priority %d%s, %u blocks queued\n",
+                                          bpm, i, rp->txPriority,
+                                          rp->isPostMortemTransfer ?
+                                                        " (post-mortem)" : "",
+                                          queueDepth(rp));
+            if (rp->packetCount) {
+                uint64_t cycles = (rp->packetTicks *
+                                 (XPAR_CPU_CORTEXA53_0_CPU_CLK_FREQ_HZ / 1000)) /
+                                                    (COUNTS_PER_SECOND / 1000);
+                printf("WFR %d:%d %9u blocks %7u CPU cycles per block\n",
+                                          bpm, i, rp->packetCount,
+                                          (unsigned int)(cycles / rp->packetCount));
+                rp->packetCount = 0;
+                rp->packetTicks = 0;
+            }
+            if (rp->compressionOut) {
+                printf("WFR %d:%d compression ratio %u.%02u\n", bpm, i,
+                        (unsigned int)(rp->compressionIn / rp->compressionOut),
+                        (unsigned int)(((rp->compressionIn % rp->compressionOut) * 100) /
+                                                               rp->compressionOut));
+                rp->compressionIn = 0;
+                rp->compressionOut = 0;
+            }
+            if (rp->fillCount) {
+                printf("WFR %d:%d %9u fills  %7u us mean %7u us max cache stall\n",
+                          bpm, i, rp->fillCount,
+                          (unsigned int)((rp->fillTicks / rp->fillCount) /
+                                                    (COUNTS_PER_SECOND / 1000000)),
+                          (unsigned int)(rp->fillTicksMax /
+                                                    (COUNTS_PER_SECOND / 1000000)));
+                rp->fillCount = 0;
+                rp->fillTicks = 0;
+                rp->fillTicksMax = 0;
+            }
+        }
+    }
+    if (postMortemLatency.count) {
+        printf("%u post-mortem transfers, loss of beam to header %u us "
+               "latest, %u us max\n", postMortemLatency.count,
+                                (unsigned int)postMortemLatency.usLatest,
+                                (unsigned int)postMortemLatency.usMax);
+        postMortemLatency.count = 0;
+        postMortemLatency.usMax = 0;
+    }
+    for (bpm = 0, n = 0 ; bpm < CFG_DSBPM_COUNT ; bpm++) {
+        for (i = 0 ; i < CFG_NUM_RECORDERS ; i++) {
+            if (recorderData[bpm][i].isZeroCopy)
+                n++;
+        }
+    }
+    printf("Data packets %s recorder buffers (%d of %d reachable by Ethernet DMA).\n",
+                                     forceCopy ? "copy" : "reference", n,
+                                     CFG_DSBPM_COUNT * CFG_NUM_RECORDERS);
+    return 0;
+}
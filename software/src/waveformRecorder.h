@@ -13,8 +13,9 @@ void wfrInit(unsigned int bpm);
 int waveformRecorderCommand(int waveformCommand, unsigned int index,
         epicsUInt32 val, uint32_t reply[], int capacity);
 
-struct pbuf *wfrAckPacket(struct dsbpmWaveformAck *ackp);
-struct pbuf *wfrCheckForWork(void);
+struct pbuf *wfrAckPacket(struct dsbpmWaveformAck *ackp, int ackSize);
+struct pbuf *wfrCheckForWork(int legacyHeader);
 int wfrStatus(unsigned int bpm);
+int wfrCommand(int argc, char **argv);
 
 #endif
@@ -141,6 +141,17 @@
 #define GPIO_IDX_FA_POS_RECORDER_END     567
 #define GPIO_IDX_RECORDER_PER_DSBPM      (GPIO_IDX_FA_POS_RECORDER_END-GPIO_IDX_ADC_RECORDER_BASE+1)
 
+// Slow acquisition values latched together once per SA update (R)
+// Sequence number, SA seconds, SA fraction, then per-DSBPM values
+#define GPIO_IDX_SA_SNAPSHOT_BASE        768
+#define CFG_SA_SNAPSHOT_WORDS_PER_DSBPM  40
+
+// Fast acquisition position stream
+// Each row is seconds, fraction, then X, Y, Q, S for each DSBPM
+#define GPIO_IDX_FA_STREAM_CSR           896 // FA stream control/status
+#define GPIO_IDX_FA_STREAM_DATA_BASE     897 // FA stream row (R)
+#define CFG_FA_STREAM_ROW_CAPACITY       512
+
 #include <xil_io.h>
 #include <xparameters.h>
 #include "config.h"